@@ -1,29 +1,33 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : enable
 
-uniform vec3 light_positions[10];
-uniform vec3 light_colors[10];
-uniform vec3 ks;
-uniform float s;
-
-uniform sampler2D pos_tex;
-uniform sampler2D nor_tex;
-uniform sampler2D ke_tex;
-uniform sampler2D kd_tex;
-uniform vec2 window_size;
+// Per-frame values, shared by all programs, see UniformBlocks.h
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_positions[10]; // In camera space
+	vec3 light_colors[10];
+	vec3 ks;
+	float s;
+	vec2 window_size;
+	float time;
+	int num_lights;
+};
 
 void main()
 {
 	vec2 tex;
 	tex.x = gl_FragCoord.x/window_size.x;
 	tex.y = gl_FragCoord.y/window_size.y;
-	vec3 position = texture2D(pos_tex, tex).rgb;
-	vec3 normal = texture2D(nor_tex, tex).rgb;
-	vec3 ke = texture2D(ke_tex, tex).rgb;
-	vec3 kd = texture2D(kd_tex, tex).rgb;
+	vec3 position = gbufferPosition(tex);
+	vec3 normal = gbufferNormal(tex);
+	vec3 ke = gbufferKe(tex);
+	vec3 kd = gbufferKd(tex);
 	vec3 cameraPos = vec3(0.0, 0.0, 0.0);
 	vec3 color = ke;
 	if(ke == cameraPos) {
-		for(int i = 0; i < 10; i++) {
+		for(int i = 0; i < num_lights; i++) {
 			vec3 l = normalize(light_positions[i]-position);
 			vec3 h = normalize(normalize(cameraPos-position)+l);
 			vec3 t_col = light_colors[i] * (kd*max(0, dot(l, normal)) + ks*pow(max(0, dot(h, normal)), s));
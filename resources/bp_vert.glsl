@@ -1,8 +1,28 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : enable
 
-uniform mat4 P;
-uniform mat4 MV;
-uniform mat4 IT;
+// Per-frame values, shared by all programs, see UniformBlocks.h
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_positions[10]; // In camera space
+	vec3 light_colors[10];
+	vec3 ks;
+	float s;
+	vec2 window_size;
+	float time;
+	int num_lights;
+};
+
+// Per-draw values, see UniformBlocks.h
+layout(std140) uniform Object
+{
+	mat4 MV;
+	mat4 IT;
+	vec3 ka;
+	vec3 kd;
+};
 
 attribute vec4 aPos; // in object space
 attribute vec3 aNor; // in object space
@@ -12,7 +32,7 @@ varying vec3 vert_pos;
 
 void main()
 {
-	gl_Position = P * (MV * aPos);
+	gl_Position = projection * (MV * aPos);
 	vert_pos = (MV * aPos).xyz;
 	vec4 n = vec4(aNor, 0.0);
 	n = IT * n;
@@ -1,11 +1,14 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : enable
 
-uniform vec3 light_positions[10];
-uniform vec3 light_colors[10];
-uniform vec3 ka;
-uniform vec3 kd;
-uniform vec3 ks;
-uniform float s;
+// Per-draw values, see UniformBlocks.h
+layout(std140) uniform Object
+{
+	mat4 MV;
+	mat4 IT;
+	vec3 ka;
+	vec3 kd;
+};
 
 varying vec3 normal;
 varying vec3 vert_pos;
@@ -13,8 +16,18 @@ varying vec3 vert_pos;
 void main()
 {
 	vec3 n = normalize(normal);
+#ifdef PACKED_GBUFFER
+	// The position comes from the depth buffer
+	gl_FragData[0].xy = gbufferEncodeNormal(n);
+	if(ka != vec3(0.0)) {
+		gl_FragData[1] = vec4(ka, 1.0);
+	} else {
+		gl_FragData[1] = vec4(kd, 0.0);
+	}
+#else
 	gl_FragData[0].xyz = vert_pos;
 	gl_FragData[1].xyz = n;
 	gl_FragData[2].xyz = ka;
 	gl_FragData[3].xyz = kd;
+#endif
 }
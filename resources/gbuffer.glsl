@@ -0,0 +1,98 @@
+// G-buffer layout, inserted after the #version line of the shaders that read
+// or write it. Without PACKED_GBUFFER, pos_tex, nor_tex, ke_tex and kd_tex
+// are RGB16F. With it:
+// - pos_tex is the depth texture, positions are rebuilt with inv_proj
+// - nor_tex is RG16 with octahedral normals
+// - ke_tex is RGBA8 with ke if alpha is set, and kd otherwise. A lit surface
+//   never has ke, so the lighting passes only need one of them.
+// The background reads as zero everywhere.
+#if __VERSION__ >= 130
+#define GBUFFER_TEXTURE texture
+#else
+#define GBUFFER_TEXTURE texture2D
+#endif
+
+uniform sampler2D pos_tex;
+uniform sampler2D nor_tex;
+uniform sampler2D ke_tex;
+uniform sampler2D kd_tex;
+
+#ifdef PACKED_GBUFFER
+uniform mat4 inv_proj;
+
+vec2 gbufferSign(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit vector to [0, 1]^2, folding the lower half of the octahedron
+vec2 gbufferEncodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx))*gbufferSign(n.xy);
+	return e*0.5 + 0.5;
+}
+
+vec3 gbufferDecodeNormal(vec2 e)
+{
+	e = e*2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if(n.z < 0.0) {
+		n.xy = (1.0 - abs(e.yx))*gbufferSign(e);
+	}
+	return normalize(n);
+}
+
+float gbufferDepth(vec2 tex)
+{
+	return GBUFFER_TEXTURE(pos_tex, tex).r;
+}
+#endif
+
+// Camera-space position
+vec3 gbufferPosition(vec2 tex)
+{
+#ifdef PACKED_GBUFFER
+	float depth = gbufferDepth(tex);
+	if(depth == 1.0) {
+		return vec3(0.0);
+	}
+	vec4 p = inv_proj * vec4(vec3(tex, depth)*2.0 - 1.0, 1.0);
+	return p.xyz/p.w;
+#else
+	return GBUFFER_TEXTURE(pos_tex, tex).rgb;
+#endif
+}
+
+// Camera-space normal
+vec3 gbufferNormal(vec2 tex)
+{
+#ifdef PACKED_GBUFFER
+	if(gbufferDepth(tex) == 1.0) {
+		return vec3(0.0);
+	}
+	return gbufferDecodeNormal(GBUFFER_TEXTURE(nor_tex, tex).rg);
+#else
+	return GBUFFER_TEXTURE(nor_tex, tex).rgb;
+#endif
+}
+
+vec3 gbufferKe(vec2 tex)
+{
+#ifdef PACKED_GBUFFER
+	vec4 k = GBUFFER_TEXTURE(ke_tex, tex);
+	return k.a > 0.5 ? k.rgb : vec3(0.0);
+#else
+	return GBUFFER_TEXTURE(ke_tex, tex).rgb;
+#endif
+}
+
+vec3 gbufferKd(vec2 tex)
+{
+#ifdef PACKED_GBUFFER
+	vec4 k = GBUFFER_TEXTURE(ke_tex, tex);
+	return k.a > 0.5 ? vec3(0.0) : k.rgb;
+#else
+	return GBUFFER_TEXTURE(kd_tex, tex).rgb;
+#endif
+}
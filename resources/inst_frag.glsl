@@ -0,0 +1,25 @@
+#version 120
+
+varying vec3 normal;
+varying vec3 vert_pos;
+varying vec3 ka;
+varying vec3 kd;
+
+void main()
+{
+	vec3 n = normalize(normal);
+#ifdef PACKED_GBUFFER
+	// The position comes from the depth buffer
+	gl_FragData[0].xy = gbufferEncodeNormal(n);
+	if(ka != vec3(0.0)) {
+		gl_FragData[1] = vec4(ka, 1.0);
+	} else {
+		gl_FragData[1] = vec4(kd, 0.0);
+	}
+#else
+	gl_FragData[0].xyz = vert_pos;
+	gl_FragData[1].xyz = n;
+	gl_FragData[2].xyz = ka;
+	gl_FragData[3].xyz = kd;
+#endif
+}
@@ -0,0 +1,46 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : enable
+
+// Per-frame values, shared by all programs, see UniformBlocks.h
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_positions[10]; // In camera space
+	vec3 light_colors[10];
+	vec3 ks;
+	float s;
+	vec2 window_size;
+	float time;
+	int num_lights;
+};
+
+attribute vec4 aPos; // In object space
+attribute vec3 aNor; // In object space
+attribute vec2 aTex;
+
+// Per-instance attributes
+attribute mat4 iMV;
+attribute mat4 iIT;
+attribute vec3 iKa;
+attribute vec3 iKd;
+
+varying vec3 normal; // In camera space
+varying vec3 vert_pos;
+varying vec2 vTex;
+varying vec3 ka;
+varying vec3 kd;
+
+void main()
+{
+	vec3 pos_calc = vec3(aPos.x, (cos(aPos.x + time) + 2) * cos(aPos.y), (cos(aPos.x + time) + 2) * sin(aPos.y));
+	gl_Position = projection * (iMV * vec4(pos_calc, 1.0));
+	vert_pos = (iMV * vec4(pos_calc, 1.0)).xyz;
+	vec3 dpdx = vec3(1.0, -sin(aPos.x + time)*cos(aPos.y), -sin(aPos.x + time)*sin(aPos.y));
+	vec3 dpdt = vec3(0.0, -(cos(aPos.x + time) + 2)*sin(aPos.y), (cos(aPos.x + time) + 2)*cos(aPos.y));
+	vec3 nor_calc = normalize(cross(dpdt, dpdx));
+	normal = normalize(vec3(iIT * vec4(nor_calc, 0.0)));
+	vTex = aTex;
+	ka = iKa;
+	kd = iKd;
+}
@@ -0,0 +1,41 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : enable
+
+// Per-frame values, shared by all programs, see UniformBlocks.h
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_positions[10]; // In camera space
+	vec3 light_colors[10];
+	vec3 ks;
+	float s;
+	vec2 window_size;
+	float time;
+	int num_lights;
+};
+
+attribute vec4 aPos; // in object space
+attribute vec3 aNor; // in object space
+
+// Per-instance attributes
+attribute mat4 iMV;
+attribute mat4 iIT;
+attribute vec3 iKa;
+attribute vec3 iKd;
+
+varying vec3 normal;
+varying vec3 vert_pos;
+varying vec3 ka;
+varying vec3 kd;
+
+void main()
+{
+	gl_Position = projection * (iMV * aPos);
+	vert_pos = (iMV * aPos).xyz;
+	vec4 n = vec4(aNor, 0.0);
+	n = iIT * n;
+	normal = normalize(n.xyz);
+	ka = iKa;
+	kd = iKd;
+}
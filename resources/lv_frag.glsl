@@ -0,0 +1,31 @@
+#version 120
+
+// One light of the light volume pass, added to the light buffer
+uniform vec3 light_position;
+uniform vec3 light_color;
+uniform vec3 ks;
+uniform float s;
+
+uniform vec2 window_size;
+
+void main()
+{
+	vec2 tex;
+	tex.x = gl_FragCoord.x/window_size.x;
+	tex.y = gl_FragCoord.y/window_size.y;
+	vec3 position = gbufferPosition(tex);
+	vec3 normal = gbufferNormal(tex);
+	vec3 ke = gbufferKe(tex);
+	vec3 kd = gbufferKd(tex);
+	vec3 cameraPos = vec3(0.0, 0.0, 0.0);
+	vec3 color = vec3(0.0, 0.0, 0.0);
+	if(ke == cameraPos) {
+		vec3 l = normalize(light_position-position);
+		vec3 h = normalize(normalize(cameraPos-position)+l);
+		vec3 t_col = light_color * (kd*max(0, dot(l, normal)) + ks*pow(max(0, dot(h, normal)), s));
+		float d = distance(light_position, position);
+		float atten = 1.0 / (1.0 + 0.0429*d + 0.9857*d*d);
+		color = t_col * atten;
+	}
+	gl_FragColor = vec4(color.rgb, 1.0);
+}
@@ -0,0 +1,133 @@
+#version 430
+
+// One invocation per object
+layout(local_size_x = 64) in;
+
+// See IndirectScene.h
+struct Object
+{
+	mat4 local;
+	vec4 translation;
+	vec4 ka;
+	vec4 kd;
+	ivec4 info; // Draw command, animation
+};
+struct Command
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Objects { Object objects[]; };
+// Center and half extent of each command's mesh, in object space
+layout(std430, binding = 1) readonly buffer Bounds { vec4 bounds[]; };
+layout(std430, binding = 2) buffer Commands { Command commands[]; };
+// InstanceData of Instances.h: MV, IT, ka, kd, ks, s
+layout(std430, binding = 3) writeonly buffer InstanceData { float instances[]; };
+
+uniform int num_objects;
+uniform float time;
+uniform mat4 view;
+uniform mat4 view_proj;
+
+// SceneStore::Animation
+const int SPIN = 1;
+const int SHEAR = 2;
+const int BOUNCE = 3;
+const float PI = 3.14159265358979;
+
+// See SceneStore::animation()
+mat4 animation(int kind)
+{
+	mat4 A = mat4(1.0);
+	if(kind == SPIN) {
+		float c = cos(time);
+		float s = sin(time);
+		A[0] = vec4(c, 0.0, -s, 0.0);
+		A[2] = vec4(s, 0.0, c, 0.0);
+	} else if(kind == SHEAR) {
+		A[1][2] = 0.5*cos(time);
+	} else if(kind == BOUNCE) {
+		float sv = -0.5*(0.5*cos(4.0*PI/1.7*(time + 0.9)) + 0.5) + 1.0;
+		A[0][0] = sv;
+		A[2][2] = sv;
+		A[3][1] = 0.4*(0.5*sin(2.0*PI/1.7*(time + 0.9)) + 0.5);
+	}
+	return A;
+}
+
+// Whether a box is outside one of the planes of the frustum
+bool outside(vec3 center, vec3 extent)
+{
+	vec4 r0 = vec4(view_proj[0][0], view_proj[1][0], view_proj[2][0], view_proj[3][0]);
+	vec4 r1 = vec4(view_proj[0][1], view_proj[1][1], view_proj[2][1], view_proj[3][1]);
+	vec4 r2 = vec4(view_proj[0][2], view_proj[1][2], view_proj[2][2], view_proj[3][2]);
+	vec4 r3 = vec4(view_proj[0][3], view_proj[1][3], view_proj[2][3], view_proj[3][3]);
+	vec4 planes[6] = vec4[6](r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2);
+	for(int i = 0; i < 6; i++) {
+		vec4 p = planes[i];
+		if(dot(p.xyz, center) + p.w + dot(abs(p.xyz), extent) < 0.0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// The inverse transpose of an affine matrix, from its cofactors, see
+// Transform::affineNormalMatrix()
+mat4 normalMatrix(mat4 M)
+{
+	mat3 C = mat3(cross(M[1].xyz, M[2].xyz), cross(M[2].xyz, M[0].xyz), cross(M[0].xyz, M[1].xyz));
+	C /= dot(M[0].xyz, C[0]);
+	mat4 N = mat4(C);
+	for(int c = 0; c < 3; c++) {
+		N[c][3] = -dot(C[c], M[3].xyz);
+	}
+	return N;
+}
+
+void store(int base, mat4 m)
+{
+	for(int c = 0; c < 4; c++) {
+		for(int r = 0; r < 4; r++) {
+			instances[base + 4*c + r] = m[c][r];
+		}
+	}
+}
+
+void main()
+{
+	int i = int(gl_GlobalInvocationID.x);
+	if(i >= num_objects) {
+		return;
+	}
+	Object object = objects[i];
+	int command = object.info.x;
+	mat4 M = object.local;
+	M = animation(object.info.y) * M;
+	M[3].xyz += object.translation.xyz;
+
+	// The world box around the transformed object box
+	vec3 center = (M * vec4(bounds[2*command].xyz, 1.0)).xyz;
+	vec3 e = bounds[2*command + 1].xyz;
+	mat3 A = mat3(M);
+	vec3 extent = abs(A[0])*e.x + abs(A[1])*e.y + abs(A[2])*e.z;
+	if(outside(center, extent)) {
+		return;
+	}
+
+	uint slot = commands[command].baseInstance + atomicAdd(commands[command].instanceCount, 1u);
+	mat4 MV = view * M;
+	int base = int(slot)*42;
+	store(base, MV);
+	store(base + 16, normalMatrix(MV));
+	for(int k = 0; k < 3; k++) {
+		instances[base + 32 + k] = object.ka[k];
+		instances[base + 35 + k] = object.kd[k];
+		instances[base + 38 + k] = 0.0;
+	}
+	instances[base + 41] = 0.0;
+}
@@ -0,0 +1,86 @@
+#version 430
+
+// One work group per tile
+layout(local_size_x = 16, local_size_y = 16) in;
+
+uniform samplerBuffer lights;
+layout(r32i, binding = 0) uniform writeonly iimageBuffer tiles;
+// The number of tiles with more than max_lights lights, whose lists are cut
+layout(std430, binding = 0) buffer Overflow
+{
+	uint overflow_tiles;
+};
+
+uniform int num_lights;
+uniform int tile_size;
+uniform int max_lights;
+uniform ivec2 window_size;
+uniform vec2 proj; // P[0][0] and P[1][1]
+
+shared uint zmin;
+shared uint zmax;
+shared int count;
+
+void main()
+{
+	ivec2 tile = ivec2(gl_WorkGroupID.xy);
+	int base = (tile.y*int(gl_NumWorkGroups.x) + tile.x)*(max_lights + 1);
+	if(gl_LocalInvocationIndex == 0) {
+		zmin = floatBitsToUint(3.0e38);
+		zmax = 0u;
+		count = 0;
+	}
+	barrier();
+
+	// Depth range of the tile. The background has its position at the camera.
+	ivec2 origin = tile*tile_size;
+	for(int y = int(gl_LocalInvocationID.y); y < tile_size; y += 16) {
+		for(int x = int(gl_LocalInvocationID.x); x < tile_size; x += 16) {
+			ivec2 p = origin + ivec2(x, y);
+			if(p.x < window_size.x && p.y < window_size.y) {
+				float z = -gbufferPosition((vec2(p) + 0.5)/vec2(window_size)).z;
+				if(z > 0.0) {
+					// Positive floats sort like their bits
+					atomicMin(zmin, floatBitsToUint(z));
+					atomicMax(zmax, floatBitsToUint(z));
+				}
+			}
+		}
+	}
+	barrier();
+	float znear = uintBitsToFloat(zmin);
+	float zfar = uintBitsToFloat(zmax);
+
+	// Side planes of the tile, through the camera, pointing inwards. The pixel
+	// at ndc looks along (ndc.x/proj.x, ndc.y/proj.y, -1).
+	vec2 d0 = (2.0*vec2(origin)/vec2(window_size) - 1.0)/proj;
+	vec2 d1 = (2.0*vec2(origin + tile_size)/vec2(window_size) - 1.0)/proj;
+	vec3 planes[4];
+	planes[0] = normalize(vec3(1.0, 0.0, d0.x));
+	planes[1] = normalize(vec3(-1.0, 0.0, -d1.x));
+	planes[2] = normalize(vec3(0.0, 1.0, d0.y));
+	planes[3] = normalize(vec3(0.0, -1.0, -d1.y));
+
+	for(int i = int(gl_LocalInvocationIndex); i < num_lights; i += 256) {
+		vec4 light = texelFetch(lights, 2*i);
+		vec3 c = light.xyz;
+		float r = light.w;
+		bool inside = r > 0.0 && -c.z + r >= znear && -c.z - r <= zfar;
+		for(int k = 0; k < 4; k++) {
+			inside = inside && dot(planes[k], c) >= -r;
+		}
+		if(inside) {
+			int slot = atomicAdd(count, 1);
+			if(slot < max_lights) {
+				imageStore(tiles, base + 1 + slot, ivec4(i));
+			}
+		}
+	}
+	barrier();
+	if(gl_LocalInvocationIndex == 0) {
+		imageStore(tiles, base, ivec4(min(count, max_lights)));
+		if(count > max_lights) {
+			atomicAdd(overflow_tiles, 1u);
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#version 140
+
+uniform vec3 ks;
+uniform float s;
+
+uniform vec2 window_size;
+
+// Light lists, see TiledLighting.h
+uniform samplerBuffer lights;
+uniform isamplerBuffer tiles;
+uniform int tile_size;
+uniform int tiles_x;
+uniform int max_lights;
+
+out vec4 fragColor;
+
+void main()
+{
+	vec2 tex;
+	tex.x = gl_FragCoord.x/window_size.x;
+	tex.y = gl_FragCoord.y/window_size.y;
+	vec3 position = gbufferPosition(tex);
+	vec3 normal = gbufferNormal(tex);
+	vec3 ke = gbufferKe(tex);
+	vec3 kd = gbufferKd(tex);
+	vec3 cameraPos = vec3(0.0, 0.0, 0.0);
+	vec3 color = ke;
+	if(ke == cameraPos) {
+		ivec2 tile = ivec2(gl_FragCoord.xy) / tile_size;
+		int base = (tile.y*tiles_x + tile.x)*(max_lights + 1);
+		int count = texelFetch(tiles, base).r;
+		for(int k = 0; k < count; k++) {
+			int i = texelFetch(tiles, base + 1 + k).r;
+			vec3 light_position = texelFetch(lights, 2*i).xyz;
+			vec3 light_color = texelFetch(lights, 2*i + 1).rgb;
+			vec3 l = normalize(light_position-position);
+			vec3 h = normalize(normalize(cameraPos-position)+l);
+			vec3 t_col = light_color * (kd*max(0, dot(l, normal)) + ks*pow(max(0, dot(h, normal)), s));
+			float atten = 1.0 / (1.0 + 0.0429*distance(light_position, position) + 0.9857*distance(light_position, position)*distance(light_position, position));
+			color += t_col * atten;
+		}
+	}
+	fragColor = vec4(color.rgb, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 140
+
+uniform mat4 P;
+uniform mat4 MV;
+
+in vec4 aPos; // in object space
+
+void main()
+{
+	gl_Position = P * (MV * aPos);
+}
@@ -1,9 +1,29 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : enable
+
+// Per-frame values, shared by all programs, see UniformBlocks.h
+layout(std140) uniform Frame
+{
+	mat4 projection;
+	mat4 view;
+	vec3 light_positions[10]; // In camera space
+	vec3 light_colors[10];
+	vec3 ks;
+	float s;
+	vec2 window_size;
+	float time;
+	int num_lights;
+};
+
+// Per-draw values, see UniformBlocks.h
+layout(std140) uniform Object
+{
+	mat4 MV;
+	mat4 IT;
+	vec3 ka;
+	vec3 kd;
+};
 
-uniform mat4 P;
-uniform mat4 MV;
-uniform mat4 IT;
-uniform float time;
 attribute vec4 aPos; // In object space
 attribute vec3 aNor; // In object space
 attribute vec2 aTex;
@@ -15,7 +35,7 @@ varying vec2 vTex;
 void main()
 {
 	vec3 pos_calc = vec3(aPos.x, (cos(aPos.x + time) + 2) * cos(aPos.y), (cos(aPos.x + time) + 2) * sin(aPos.y));
-	gl_Position = P * (MV * vec4(pos_calc, 1.0));
+	gl_Position = projection * (MV * vec4(pos_calc, 1.0));
 	vert_pos = (MV * vec4(pos_calc, 1.0)).xyz;
 	vec3 dpdx = vec3(1.0, -sin(aPos.x + time)*cos(aPos.y), -sin(aPos.x + time)*sin(aPos.y));
 	vec3 dpdt = vec3(0.0, -(cos(aPos.x + time) + 2)*sin(aPos.y), (cos(aPos.x + time) + 2)*cos(aPos.y));
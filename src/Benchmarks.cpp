@@ -0,0 +1,814 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stack>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "Camera.h"
+#include "GLSL.h"
+#include "ImageDiff.h"
+#include "MatrixStack.h"
+#include "ObjParser.h"
+#include "Program.h"
+#include "SceneStore.h"
+#include "Shape.h"
+#include "Sphere.h"
+#include "Revo.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+#include "WorldObject.h"
+
+using namespace std;
+
+// The meshes, as numbered in main.cpp's scene store
+enum
+{
+	MESH_BUNNY,
+	MESH_TEAPOT,
+	MESH_SPHERE,
+	MESH_SPIRAL
+};
+
+// Applies the placement and animation of a world object at time t, the way
+// render() did before the scene store. Kept as the baseline of
+// --bench=scene-store.
+static void applyObjectTransform(shared_ptr<MatrixStack> MV, const WorldObject &wobj, double t, const shared_ptr<Shape> &spinning, const shared_ptr<Shape> &sheared)
+{
+	MV->translate(wobj.translate);
+	if(wobj.shape_type == 0) {
+		MV->translate(0.0, (0.0-wobj.shape->lowest_y)*wobj.scale.y, 0.0);
+		if(wobj.shape == spinning) {
+			MV->rotate(t, 0.0, 1.0, 0.0);
+		} else if(wobj.shape == sheared) {
+			glm::mat4 S(1.0f);
+			S[1][2] = 0.5f*cos(t);
+			MV->multMatrix(S);
+		}
+	} else if(wobj.shape_type == 1) {
+		MV->translate(0.0, (0.0-wobj.c_sphere->lowest_y)*wobj.scale.y, 0.0);
+		MV->translate(0.0, 0.4*(0.5 * sin((2.0*M_PI)/(1.7)*(t+0.9)) + 0.5), 0.0);
+		double scale_val = -0.5*(0.5*cos((4.0*M_PI)/(1.7)*(t+0.9))+0.5)+1.0;
+		MV->scale(scale_val, 1.0, scale_val);
+	} else if(wobj.shape_type == 2) {
+		MV->rotate(0.5 * M_PI, 0.0, 0.0, 1.0);
+	}
+	MV->scale(wobj.scale);
+}
+
+#ifdef _WIN32
+// Quotes an argument of _spawnv(), whose command line the child's C runtime
+// splits again: backslashes are literal, unless they come before a quote
+static string quote(const string &arg)
+{
+	string quoted = "\"";
+	int backslashes = 0;
+	for(char c : arg) {
+		if(c == '\\') {
+			backslashes++;
+			continue;
+		}
+		quoted.append(c == '"' ? 2*backslashes + 1 : backslashes, '\\');
+		quoted += c;
+		backslashes = 0;
+	}
+	quoted.append(2*backslashes, '\\');
+	return quoted + "\"";
+}
+#endif
+
+// Runs args[0] (looked up in the PATH if it has no directory) with the
+// arguments args, without a shell, and with its output and errors written to
+// log. Returns whether it exited with 0.
+static bool run(const vector<string> &args, const string &log)
+{
+#ifdef _WIN32
+	vector<string> quoted;
+	for(const string &arg : args) {
+		quoted.push_back(quote(arg));
+	}
+	vector<const char *> argv;
+	for(const string &arg : quoted) {
+		argv.push_back(arg.c_str());
+	}
+	argv.push_back(NULL);
+	int fd = _open(log.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE);
+	if(fd < 0) {
+		return false;
+	}
+	// The child inherits our stdout and stderr, so point them to the log
+	cout.flush();
+	fflush(stdout);
+	fflush(stderr);
+	int out = _dup(1);
+	int err = _dup(2);
+	_dup2(fd, 1);
+	_dup2(fd, 2);
+	intptr_t status = _spawnvp(_P_WAIT, args[0].c_str(), argv.data());
+	_dup2(out, 1);
+	_dup2(err, 2);
+	_close(out);
+	_close(err);
+	_close(fd);
+	return status == 0;
+#else
+	vector<char *> argv;
+	for(const string &arg : args) {
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	}
+	argv.push_back(NULL);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 1, log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	posix_spawn_file_actions_adddup2(&actions, 1, 2);
+	pid_t pid;
+	int error = posix_spawnp(&pid, argv[0], &actions, NULL, argv.data(), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(error != 0) {
+		return false;
+	}
+	int status;
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR) {
+			return false;
+		}
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// Renders each canonical scene in a child process at a fixed time, compares
+// its first frame to the golden image in goldenDir, and writes the frame time
+// statistics of every scene to json. With updateGolden, the images become the
+// new golden ones instead. A scene may share the golden image of another,
+// e.g. to compare the G-buffer layouts.
+bool Benchmarks::scenes(const Scenes &settings)
+{
+	struct Scene
+	{
+		const char *name;
+		int objects;
+		int lights;
+		const char *lighting;
+		bool packed;
+		const char *golden;
+	};
+	Scene scenes[] = {
+		{"grid", 100, 10, "fullscreen", false, "grid"},
+		{"objects-1k", 1000, 10, "fullscreen", false, "objects-1k"},
+		{"objects-10k", 10000, 10, "fullscreen", false, "objects-10k"},
+		{"lights-100", 100, 100, "tiled", false, "lights-100"},
+		{"lights-1000", 100, 1000, "clustered", false, "lights-1000"},
+		{"volumes", 100, 100, "volumes", false, "volumes"},
+		// The packed G-buffer, decoded by each lighting pass
+		{"grid-packed", 100, 10, "fullscreen", true, "grid"},
+		{"lights-100-packed", 100, 100, "tiled", true, "lights-100"},
+		{"lights-1000-packed", 100, 1000, "clustered", true, "lights-1000"},
+		{"volumes-packed", 100, 100, "volumes", true, "volumes"},
+	};
+	// One frame is too few for statistics
+	int frames = settings.frames > 1 ? settings.frames : 30;
+	double time = max(settings.time, 0.0);
+	// The images, profiles and logs of the scenes go next to the JSON, e.g.
+	// in bench_scenes/ for bench.json, so that runs with different JSON files
+	// can run at once
+	filesystem::path jsonPath = settings.json;
+	filesystem::path dir = jsonPath.parent_path()/(jsonPath.stem().string() + "_scenes");
+	filesystem::create_directories(dir);
+	if(settings.updateGolden) {
+		filesystem::create_directories(settings.goldenDir);
+	}
+
+	ofstream json(settings.json);
+	if(!json) {
+		cout << "Couldn't write " << settings.json << endl;
+		return false;
+	}
+	json << "{\n\t\"renderer\": \"" << (settings.software ? "cpu" : "gl") << "\",\n";
+	json << "\t\"gpu_driven\": " << (settings.gpuDriven ? "true" : "false") << ",\n";
+	json << "\t\"time\": " << time << ",\n\t\"frames\": " << frames << ",\n\t\"scenes\": [";
+	bool ok = true;
+	for(const Scene &scene : scenes) {
+		string base = (dir/scene.name).string();
+		string image = base + ".png";
+		string golden = settings.goldenDir + scene.golden + ".png";
+		bool owner = string(scene.name) == scene.golden;
+		// --output is a printf pattern, so its % signs are doubled
+		string output;
+		for(char c : image) {
+			output += c == '%' ? "%%" : string(1, c);
+		}
+		ostringstream timeArg;
+		timeArg << time;
+		vector<string> args = {
+			settings.executable, settings.resourceDir, settings.software ? "--renderer=cpu" : "--headless",
+			"--objects=" + to_string(scene.objects), "--lights=" + to_string(scene.lights), string("--lighting=") + scene.lighting,
+			"--time=" + timeArg.str(), "--frames=" + to_string(frames), "--save-every=" + to_string(frames),
+			"--output=" + output, "--profile=" + base + ".csv",
+			string("--gbuffer=") + (scene.packed ? "packed" : "full")
+		};
+		if(settings.gpuDriven) {
+			args.push_back("--gpu-driven");
+		}
+		cout << scene.name << ": " << scene.objects << " objects, " << scene.lights << " lights, " << scene.lighting << " lighting";
+		cout << (scene.packed ? ", packed G-buffer: " : ": ") << flush;
+		filesystem::remove(image);
+		bool rendered = run(args, base + ".log");
+
+		// The profile's rows, and the frame's
+		vector< vector<string> > rows;
+		ifstream csv(base + ".csv");
+		string line;
+		getline(csv, line);
+		while(getline(csv, line)) {
+			vector<string> fields;
+			istringstream fieldStream(line);
+			string field;
+			while(getline(fieldStream, field, ',')) {
+				fields.push_back(field);
+			}
+			if(fields.size() == 7) {
+				rows.push_back(fields);
+			}
+		}
+		rendered = rendered && !rows.empty() && filesystem::exists(image);
+
+		bool passed = false;
+		ImageDiff d;
+		if(!rendered) {
+			cout << "FAILED to render, see " << base << ".log" << endl;
+		} else if(settings.updateGolden && owner) {
+			filesystem::copy_file(image, golden, filesystem::copy_options::overwrite_existing);
+			passed = true;
+			cout << "frame " << rows[0][3] << " ms, wrote " << golden << endl;
+		} else {
+			d = ImageDiff::compare(image, golden, settings.tolerance, settings.threshold);
+			passed = d.read && d.perceptual <= settings.outliers*d.pixels;
+			cout << "frame " << rows[0][3] << " ms, " << d.perceptual << " pixels visibly different from " << (owner ? "the golden image" : golden) << ", ";
+			cout << (passed ? "ok" : "FAILED") << endl;
+		}
+		ok = ok && passed;
+
+		json << (&scene == scenes ? "" : ",") << "\n\t\t{\n";
+		json << "\t\t\t\"name\": \"" << scene.name << "\",\n";
+		json << "\t\t\t\"objects\": " << scene.objects << ",\n";
+		json << "\t\t\t\"lights\": " << scene.lights << ",\n";
+		json << "\t\t\t\"lighting\": \"" << scene.lighting << "\",\n";
+		json << "\t\t\t\"gbuffer\": \"" << (scene.packed ? "packed" : "full") << "\",\n";
+		json << "\t\t\t\"passed\": " << (passed ? "true" : "false") << ",\n";
+		if(d.read) {
+			json << "\t\t\t\"max_difference\": " << d.maxDiff << ",\n";
+			json << "\t\t\t\"visibly_different_pixels\": " << d.perceptual << ",\n";
+		}
+		json << "\t\t\t\"stages\": [";
+		for(size_t i = 0; i < rows.size(); i++) {
+			const vector<string> &r = rows[i];
+			json << (i == 0 ? "" : ",") << "\n\t\t\t\t{\"stage\": \"" << r[0] << "\", \"clock\": \"" << r[1] << "\", ";
+			// Counters are not times
+			const char *unit = r[1] == "count" ? "" : "_ms";
+			json << "\"min" << unit << "\": " << r[2] << ", \"avg" << unit << "\": " << r[3] << ", \"p95" << unit << "\": " << r[4] << ", ";
+			json << "\"max" << unit << "\": " << r[5] << ", \"samples\": " << r[6] << "}";
+		}
+		json << (rows.empty() ? "" : "\n\t\t\t") << "]\n\t\t}";
+	}
+	json << "\n\t]\n}\n";
+	cout << "Wrote " << settings.json << endl;
+	return ok;
+}
+
+// Writes an OBJ file of a grid with about the given number of triangles,
+// with positions, normals and texcoords
+static bool writeGridObj(const string &filename, int triangles)
+{
+	FILE *f = fopen(filename.c_str(), "w");
+	if(!f) {
+		cout << "Couldn't write " << filename << endl;
+		return false;
+	}
+	int n = max(1, (int)sqrt(triangles/2.0));
+	for(int i = 0; i <= n; i++) {
+		for(int j = 0; j <= n; j++) {
+			float u = (float)i/n;
+			float v = (float)j/n;
+			float y = 0.1f*sin(6.0f*u)*cos(6.0f*v);
+			fprintf(f, "v %f %f %f\nvn %f %f %f\nvt %f %f\n", u, y, v, 0.0f, 1.0f, 0.0f, u, v);
+		}
+	}
+	for(int i = 0; i < n; i++) {
+		for(int j = 0; j < n; j++) {
+			int a = i*(n + 1) + j + 1;
+			int b = a + n + 1;
+			fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, b + 1, b + 1, b + 1);
+			fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b + 1, b + 1, b + 1, a + 1, a + 1, a + 1);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+// Reports the MB/s of tinyobjloader and of ObjParser on one thread and on
+// the pool, for the bundled OBJ files and for synthetic grids
+bool Benchmarks::obj(const string &resourceDir, shared_ptr<ThreadPool> pool)
+{
+	vector<string> files;
+	const char *bundled[] = {"bunny.obj", "teapot.obj", "sphere.obj", "cube.obj"};
+	for(const char *name : bundled) {
+		files.push_back(resourceDir + name);
+	}
+	string tmp = (filesystem::temp_directory_path()/"a5_grid_").string();
+	int synthetic[] = {1000000, 4000000};
+	for(int triangles : synthetic) {
+		string name = tmp + to_string(triangles) + ".obj";
+		if(!writeGridObj(name, triangles)) {
+			return false;
+		}
+		files.push_back(name);
+	}
+
+	// Runs parse at least 3 times and for at least half a second, and
+	// returns the best MB/s
+	auto measure = [](size_t bytes, const function<void()> &parse) {
+		double best = 0.0;
+		double total = 0.0;
+		for(int run = 0; run < 3 || total < 0.5; run++) {
+			auto start = chrono::steady_clock::now();
+			parse();
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			total += seconds;
+			best = max(best, bytes/1e6/max(seconds, 1e-9));
+		}
+		return best;
+	};
+	bool ok = true;
+	for(const string &file : files) {
+		ObjParser parser;
+		if(!parser.parse(file, pool)) {
+			return false;
+		}
+		size_t bytes = parser.bytes;
+		size_t tinyCorners = 0;
+		size_t tinyPositions = 0;
+		double tiny = measure(bytes, [&]() {
+			tinyobj::attrib_t attrib;
+			vector<tinyobj::shape_t> shapes;
+			vector<tinyobj::material_t> materials;
+			string err;
+			tinyobj::LoadObj(&attrib, &shapes, &materials, &err, file.c_str());
+			tinyPositions = attrib.vertices.size();
+			tinyCorners = 0;
+			for(auto &shape : shapes) {
+				tinyCorners += shape.mesh.indices.size();
+			}
+		});
+		double serial = measure(bytes, [&]() { parser.parse(file); });
+		double parallel = measure(bytes, [&]() { parser.parse(file, pool); });
+		bool match = parser.positions.size() == tinyPositions && parser.corners.size() == tinyCorners;
+		cout << filesystem::path(file).filename().string() << " (" << bytes/1e6 << " MB, " << parser.corners.size()/3 << " triangles): ";
+		cout << "tinyobjloader " << tiny << " MB/s, 1 thread " << serial << " MB/s, ";
+		cout << pool->size() + 1 << " threads " << parallel << " MB/s" << (match ? "" : ", MISMATCH") << endl;
+		ok = ok && match;
+	}
+	for(int triangles : synthetic) {
+		filesystem::remove(tmp + to_string(triangles) + ".obj");
+	}
+	return ok;
+}
+
+// Times the per-frame update of the modelview matrices of 100k and 1M
+// objects on one thread, from the scene store and from the vector of
+// WorldObjects it replaced, and checks that both give the same matrices and
+// that handles survive removals
+bool Benchmarks::sceneStore()
+{
+	// The meshes only matter through their lowest points here
+	auto shape = make_shared<Shape>();
+	shape->lowest_y = -0.1f;
+	auto teapot = make_shared<Shape>();
+	teapot->lowest_y = -0.2f;
+	auto cust_sphere = make_shared<Sphere>();
+	auto spiral = make_shared<Revo>();
+	// The initial view of the scene
+	auto camera = make_shared<Camera>();
+	camera->setInitDistance(20.0f);
+	auto MV = make_shared<MatrixStack>();
+	camera->applyViewMatrix(MV);
+	glm::mat4 V = MV->topMatrix();
+	double t = 1.0;
+
+	// Best ms of 3 runs
+	auto measure = [](const function<void()> &update) {
+		double best = 1e30;
+		for(int run = 0; run < 3; run++) {
+			auto start = chrono::steady_clock::now();
+			update();
+			best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	};
+	bool ok = true;
+	int counts[] = {100000, 1000000};
+	for(int n : counts) {
+		// The same objects both ways, as loadScene() places them
+		std::mt19937 gen(0);
+		std::uniform_real_distribution<> distr(0.2, 0.6);
+		std::uniform_real_distribution<> distcol(0.0, 1.0);
+		int gridSize = (int)ceil(sqrt((double)n));
+		vector<WorldObject> wobjs;
+		wobjs.reserve(n);
+		SceneStore store;
+		store.reserve(n);
+		vector<SceneStore::Handle> added(n);
+		for(int k = 0; k < n; k++) {
+			glm::vec3 rotation(0.0f);
+			glm::vec3 translation(k/gridSize, 0.0f, k%gridSize);
+			glm::vec3 scale((float)distr(gen));
+			glm::vec3 ambient(0.0f);
+			glm::vec3 diffuse(distcol(gen), distcol(gen), distcol(gen));
+			glm::vec3 specular(1.0f);
+			float shininess = 10.0f;
+			glm::vec3 lift(0.0f);
+			if(k % 4 == 0) {
+				wobjs.emplace_back(rotation, translation, scale, shape, ambient, diffuse, specular, shininess);
+				lift.y = -shape->lowest_y*scale.y;
+				added[k] = store.add(MESH_BUNNY, SceneStore::SPIN, translation + lift, rotation, scale, ambient, diffuse, specular, shininess);
+			} else if(k % 4 == 1) {
+				wobjs.emplace_back(rotation, translation, scale, teapot, ambient, diffuse, specular, shininess);
+				lift.y = -teapot->lowest_y*scale.y;
+				added[k] = store.add(MESH_TEAPOT, SceneStore::SHEAR, translation + lift, rotation, scale, ambient, diffuse, specular, shininess);
+			} else if(k % 4 == 2) {
+				scale *= 0.5f;
+				wobjs.emplace_back(rotation, translation, scale, cust_sphere, ambient, diffuse, specular, shininess);
+				lift.y = -cust_sphere->lowest_y*scale.y;
+				added[k] = store.add(MESH_SPHERE, SceneStore::BOUNCE, translation + lift, rotation, scale, ambient, diffuse, specular, shininess);
+			} else {
+				scale *= 0.15f;
+				wobjs.emplace_back(rotation, translation, scale, spiral, ambient, diffuse, specular, shininess);
+				added[k] = store.add(MESH_SPIRAL, SceneStore::STATIC, translation, glm::vec3(0.0f, 0.0f, 0.5*M_PI), scale, ambient, diffuse, specular, shininess);
+			}
+		}
+
+		// What render() did per object, and what it does now. Both include the
+		// normal matrices, which the draws used to compute.
+		vector<glm::mat4> baseline(n);
+		vector<glm::mat4> baselineNormals(n);
+		double before = measure([&]() {
+			for(int k = 0; k < n; k++) {
+				MV->pushMatrix();
+					applyObjectTransform(MV, wobjs[k], t, shape, teapot);
+					baseline[k] = MV->topMatrix();
+					baselineNormals[k] = glm::inverse(glm::transpose(baseline[k]));
+				MV->popMatrix();
+			}
+		});
+		double after = measure([&]() { store.update(t, V); });
+
+		// Relative to the size of the entries, which grow with the distance
+		float maxError = 0.0f;
+		const vector<glm::mat4> &modelViews = store.getModelViews();
+		for(int k = 0; k < n; k++) {
+			for(int c = 0; c < 4; c++) {
+				for(int r = 0; r < 4; r++) {
+					float e = fabs(modelViews[k][c][r] - baseline[k][c][r])/(1.0f + fabs(baseline[k][c][r]));
+					maxError = max(maxError, e);
+				}
+			}
+		}
+		bool match = maxError < 1e-5f;
+		cout << n << " objects: WorldObject vector " << before << " ms, scene store " << after << " ms (";
+		cout << before/after << "x), largest relative difference " << maxError << (match ? "" : ", MISMATCH") << endl;
+		ok = ok && match;
+
+		// Remove every other object, and check that the others still have
+		// their handles, and that the removed handles stay removed when their
+		// slots are reused
+		for(int k = 0; k < n; k += 2) {
+			store.remove(added[k]);
+		}
+		bool handles = store.size() == n/2;
+		for(int k = 1; k < n && handles; k += 2) {
+			handles = store.contains(added[k]) && !store.contains(added[k - 1]) && store.getHandle(store.getIndex(added[k])) == added[k];
+			handles = handles && store.getTranslations()[store.getIndex(added[k])].z == (float)(k%gridSize);
+		}
+		SceneStore::Handle reused = store.add(MESH_SPIRAL, SceneStore::STATIC, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 1.0f);
+		// In the slot of the last object removed
+		int last = (n - 1)/2*2;
+		handles = handles && store.contains(reused) && !store.contains(added[last]);
+		handles = handles && (uint32_t)reused == (uint32_t)added[last];
+		cout << "Handles after removing half of the objects: " << (handles ? "ok" : "FAILED") << endl;
+		ok = ok && handles;
+	}
+	return ok;
+}
+
+// Times the per-frame update of the modelview and normal matrices of 100k
+// and 1M objects with 1, 2, 4, ... threads, up to one per core (or to
+// workers plus the main thread), and checks that the threads give the same
+// matrices as one
+bool Benchmarks::transforms(int workers)
+{
+	auto camera = make_shared<Camera>();
+	camera->setInitDistance(20.0f);
+	auto MV = make_shared<MatrixStack>();
+	camera->applyViewMatrix(MV);
+	glm::mat4 V = MV->topMatrix();
+	double t = 1.0;
+	int maxThreads = workers > 0 ? workers + 1 : max(2, (int)thread::hardware_concurrency());
+	vector<int> threadCounts;
+	for(int threads = 1; threads < maxThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+	cout << thread::hardware_concurrency() << " cores" << endl;
+
+	bool ok = true;
+	int counts[] = {100000, 1000000};
+	for(int n : counts) {
+		// Like loadScene(), one of each kind in turn
+		const int meshOf[] = {MESH_BUNNY, MESH_TEAPOT, MESH_SPHERE, MESH_SPIRAL};
+		const int animationOf[] = {SceneStore::SPIN, SceneStore::SHEAR, SceneStore::BOUNCE, SceneStore::STATIC};
+		std::mt19937 gen(0);
+		std::uniform_real_distribution<> distr(0.2, 0.6);
+		int gridSize = (int)ceil(sqrt((double)n));
+		SceneStore store;
+		store.reserve(n);
+		vector<SceneStore::Handle> added(n);
+		for(int k = 0; k < n; k++) {
+			glm::vec3 translation(k/gridSize, 0.0f, k%gridSize);
+			glm::vec3 rotation(0.0f, 0.0f, k % 4 == 3 ? 0.5*M_PI : 0.0);
+			glm::vec3 scale((float)distr(gen));
+			store.add(meshOf[k % 4], animationOf[k % 4], translation, rotation, scale, glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(1.0f), 10.0f);
+		}
+
+		vector<glm::mat4> modelViews;
+		vector<glm::mat4> normalMatrices;
+		double serial = 0.0;
+		for(int threads : threadCounts) {
+			// The main thread is one of them
+			store.setThreadPool(threads > 1 ? make_shared<ThreadPool>(threads - 1) : nullptr);
+			double best = 1e30;
+			for(int run = 0; run < 3; run++) {
+				auto start = chrono::steady_clock::now();
+				store.update(t, V);
+				best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+			}
+			bool match = true;
+			if(threads == 1) {
+				serial = best;
+				modelViews = store.getModelViews();
+				normalMatrices = store.getNormalMatrices();
+			} else {
+				match = store.getModelViews() == modelViews && store.getNormalMatrices() == normalMatrices;
+			}
+			cout << n << " objects, " << threads << " threads: " << best << " ms (" << serial/best << "x)" << (match ? "" : ", MISMATCH") << endl;
+			ok = ok && match;
+		}
+		store.setThreadPool(nullptr);
+	}
+	return ok;
+}
+
+// MatrixStack as it was before it kept its matrices inline: a std::stack on
+// a std::deque, allocated every frame. The baseline of --bench=matrix-stack.
+struct DequeMatrixStack
+{
+	shared_ptr< stack<glm::mat4> > mstack;
+
+	DequeMatrixStack() : mstack(make_shared< stack<glm::mat4> >()) { mstack->push(glm::mat4(1.0f)); }
+	void pushMatrix() { mstack->push(mstack->top()); }
+	void popMatrix() { mstack->pop(); }
+	void multMatrix(const glm::mat4 &matrix) { mstack->top() *= matrix; }
+	void translate(const glm::vec3 &t) { mstack->top() *= glm::translate(glm::mat4(1.0f), t); }
+	void scale(const glm::vec3 &s) { mstack->top() *= glm::scale(glm::mat4(1.0f), s); }
+	void rotate(float angle, const glm::vec3 &axis) { mstack->top() *= glm::rotate(glm::mat4(1.0f), angle, axis); }
+	const glm::mat4 &topMatrix() const { return mstack->top(); }
+};
+
+// One frame of the per-object pattern of render() before the scene store
+// (see applyObjectTransform()): the camera, then for each object a push, its
+// translations, its animation, its scale and a pop. Keeps the modelview
+// matrices.
+template <typename Stack>
+static void matrixStackFrame(Stack &MV, double t, vector<glm::mat4> &modelViews)
+{
+	MV.pushMatrix();
+	MV.translate(glm::vec3(0.0f, 0.0f, -20.0f));
+	MV.rotate(0.3f, glm::vec3(1.0f, 0.0f, 0.0f));
+	MV.rotate(0.6f, glm::vec3(0.0f, 1.0f, 0.0f));
+	MV.translate(glm::vec3(-5.0f, 0.0f, -5.0f));
+	int n = (int)modelViews.size();
+	int gridSize = (int)ceil(sqrt((double)n));
+	glm::mat4 S(1.0f);
+	S[1][2] = 0.5f*cos(t);
+	float sv = (float)(-0.5*(0.5*cos((4.0*M_PI)/(1.7)*(t+0.9))+0.5)+1.0);
+	float hop = (float)(0.4*(0.5*sin((2.0*M_PI)/(1.7)*(t+0.9)) + 0.5));
+	for(int k = 0; k < n; k++) {
+		float scale = 0.2f + 0.4f*(k % 7)/6.0f;
+		MV.pushMatrix();
+			MV.translate(glm::vec3(k/gridSize, 0.0f, k%gridSize));
+			if(k % 4 == 0) {
+				MV.translate(glm::vec3(0.0f, 0.1f*scale, 0.0f));
+				MV.rotate((float)t, glm::vec3(0.0f, 1.0f, 0.0f));
+			} else if(k % 4 == 1) {
+				MV.translate(glm::vec3(0.0f, 0.2f*scale, 0.0f));
+				MV.multMatrix(S);
+			} else if(k % 4 == 2) {
+				scale *= 0.5f;
+				MV.translate(glm::vec3(0.0f, scale, 0.0f));
+				MV.translate(glm::vec3(0.0f, hop, 0.0f));
+				MV.scale(glm::vec3(sv, 1.0f, sv));
+			} else {
+				scale *= 0.15f;
+				MV.rotate(0.5f*M_PI, glm::vec3(0.0f, 0.0f, 1.0f));
+			}
+			MV.scale(glm::vec3(scale));
+			modelViews[k] = MV.topMatrix();
+		MV.popMatrix();
+	}
+	MV.popMatrix();
+}
+
+// Times the per-object matrix stack pattern of render() for 100 frames of
+// 10k objects, with the stack allocated every frame on a deque as it was, and
+// with MatrixStack kept from frame to frame, and checks that both give the
+// same matrices
+bool Benchmarks::matrixStack(double dt)
+{
+	const int frames = 100;
+	const int n = 10000;
+	vector<glm::mat4> before(n);
+	vector<glm::mat4> after(n);
+	// Best ns per object of 3 runs
+	auto measure = [&](const function<void(int)> &frame) {
+		double best = 1e30;
+		for(int run = 0; run < 3; run++) {
+			auto start = chrono::steady_clock::now();
+			for(int f = 0; f < frames; f++) {
+				frame(f);
+			}
+			best = min(best, chrono::duration<double, nano>(chrono::steady_clock::now() - start).count()/(frames*n));
+		}
+		return best;
+	};
+	double deque = measure([&](int f) {
+		auto MV = make_shared<DequeMatrixStack>();
+		matrixStackFrame(*MV, f*dt, before);
+	});
+	auto MV = make_shared<MatrixStack>();
+	double fixed = measure([&](int f) {
+		MV->clear();
+		matrixStackFrame(*MV, f*dt, after);
+	});
+
+	float maxError = 0.0f;
+	for(int k = 0; k < n; k++) {
+		for(int c = 0; c < 4; c++) {
+			for(int r = 0; r < 4; r++) {
+				maxError = max(maxError, fabs(after[k][c][r] - before[k][c][r])/(1.0f + fabs(before[k][c][r])));
+			}
+		}
+	}
+	bool match = maxError < 1e-6f;
+	cout << "Per object: deque stack " << deque << " ns, inline stack " << fixed << " ns (" << deque/fixed << "x), ";
+	cout << "largest relative difference " << maxError << (match ? ", ok" : ", MISMATCH") << endl;
+	return match;
+}
+
+// Reports the CPU time of setting the values of a draw: uniforms looked up
+// by name, uniforms looked up through handles, and the Object block of
+// UniformBlocks. The uniforms are the 8 of the light volume pass, the
+// program with the most of them. Needs the context.
+bool Benchmarks::uniforms(shared_ptr<Program> prog, shared_ptr<UniformBlocks> blocks, int width, int height)
+{
+	const int draws = 100000;
+	glm::mat4 M(1.0f);
+	glm::vec3 v(0.5f);
+	glm::vec2 size(width, height);
+	// The handles, as main.cpp keeps them
+	struct Handles
+	{
+		Program::Uniform P = Program::uniform("P");
+		Program::Uniform MV = Program::uniform("MV");
+		Program::Uniform ks = Program::uniform("ks");
+		Program::Uniform s = Program::uniform("s");
+		Program::Uniform light_position = Program::uniform("light_position");
+		Program::Uniform light_color = Program::uniform("light_color");
+		Program::Uniform window_size = Program::uniform("window_size");
+		Program::Uniform inv_proj = Program::uniform("inv_proj");
+	};
+	const Handles U = Handles();
+	prog->bind();
+	auto byName = [&](bool set) {
+		GLint sum = 0;
+		for(int i = 0; i < draws; i++) {
+			GLint l[8] = {
+				prog->getUniform("P"), prog->getUniform("MV"), prog->getUniform("inv_proj"),
+				prog->getUniform("window_size"), prog->getUniform("light_position"),
+				prog->getUniform("light_color"), prog->getUniform("ks"), prog->getUniform("s")
+			};
+			if(set) {
+				glUniformMatrix4fv(l[0], 1, GL_FALSE, glm::value_ptr(M));
+				glUniformMatrix4fv(l[1], 1, GL_FALSE, glm::value_ptr(M));
+				glUniformMatrix4fv(l[2], 1, GL_FALSE, glm::value_ptr(M));
+				glUniform2fv(l[3], 1, glm::value_ptr(size));
+				glUniform3fv(l[4], 1, glm::value_ptr(v));
+				glUniform3fv(l[5], 1, glm::value_ptr(v));
+				glUniform3fv(l[6], 1, glm::value_ptr(v));
+				glUniform1f(l[7], 1.0f);
+			}
+			for(GLint x : l) {
+				sum += x;
+			}
+		}
+		return sum;
+	};
+	auto byHandle = [&](bool set) {
+		GLint sum = 0;
+		for(int i = 0; i < draws; i++) {
+			GLint l[8] = {
+				prog->getUniform(U.P), prog->getUniform(U.MV), prog->getUniform(U.inv_proj),
+				prog->getUniform(U.window_size), prog->getUniform(U.light_position),
+				prog->getUniform(U.light_color), prog->getUniform(U.ks), prog->getUniform(U.s)
+			};
+			if(set) {
+				glUniformMatrix4fv(l[0], 1, GL_FALSE, glm::value_ptr(M));
+				glUniformMatrix4fv(l[1], 1, GL_FALSE, glm::value_ptr(M));
+				glUniformMatrix4fv(l[2], 1, GL_FALSE, glm::value_ptr(M));
+				glUniform2fv(l[3], 1, glm::value_ptr(size));
+				glUniform3fv(l[4], 1, glm::value_ptr(v));
+				glUniform3fv(l[5], 1, glm::value_ptr(v));
+				glUniform3fv(l[6], 1, glm::value_ptr(v));
+				glUniform1f(l[7], 1.0f);
+			}
+			for(GLint x : l) {
+				sum += x;
+			}
+		}
+		return sum;
+	};
+	// Fills the blocks of a frame of draws, and binds them one by one
+	auto byBlock = [&](bool set) {
+		blocks->setFrame(UniformBlocks::Frame());
+		for(int i = 0; i < draws; i++) {
+			blocks->addObject(M, v, v);
+		}
+		blocks->uploadObjects();
+		if(set) {
+			for(int i = 0; i < draws; i++) {
+				blocks->bindObject(i);
+			}
+		}
+		return (GLint)0;
+	};
+	// Best ns per draw of 5 runs
+	volatile GLint sink = 0;
+	auto measure = [&](const function<GLint(bool)> &run, bool set) {
+		double best = 1e30;
+		for(int r = 0; r < 5; r++) {
+			auto start = chrono::steady_clock::now();
+			sink = sink + run(set);
+			best = min(best, chrono::duration<double, nano>(chrono::steady_clock::now() - start).count()/draws);
+		}
+		return best;
+	};
+	cout << "Per draw (ns): lookups by name " << measure(byName, false);
+	cout << ", by handle " << measure(byHandle, false) << ", object blocks filled " << measure(byBlock, false) << endl;
+	cout << "With the GL calls: by name " << measure(byName, true);
+	cout << ", by handle " << measure(byHandle, true) << ", object blocks " << measure(byBlock, true) << endl;
+	prog->unbind();
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <memory>
+#include <string>
+
+class Program;
+class ThreadPool;
+class UniformBlocks;
+
+/**
+ * The benchmarks of --bench=..., which time an optimized part of the
+ * renderer against what it replaced, and check that both give the same
+ * results. Each returns whether the results matched.
+ * - scenes() renders the canonical scenes in child processes and compares
+ *   them with their golden images.
+ * - uniforms() needs an OpenGL context and the programs of the renderer. The
+ *   others need neither.
+ */
+class Benchmarks
+{
+public:
+	// Settings of scenes()
+	struct Scenes
+	{
+		std::string executable; // A5, run once per scene
+		std::string resourceDir;
+		std::string goldenDir;
+		bool updateGolden; // Replace the golden images instead of comparing
+		std::string json; // Where the frame time statistics are written
+		int frames;
+		double time; // Animation time of every frame
+		bool software;
+		bool gpuDriven;
+		// A scene passes when at most a fraction outliers of its pixels are
+		// visibly different, see ImageDiff
+		int tolerance;
+		float outliers;
+		float threshold;
+	};
+
+	static bool scenes(const Scenes &settings);
+	// tinyobjloader and ObjParser, on the OBJ files in resourceDir and on grids
+	static bool obj(const std::string &resourceDir, std::shared_ptr<ThreadPool> pool);
+	// The scene store, against the WorldObjects it replaced
+	static bool sceneStore();
+	// The scene store on up to workers threads besides the main one, or on
+	// one per core if workers is 0
+	static bool transforms(int workers);
+	// MatrixStack, against the std::stack it replaced, with frames dt apart
+	static bool matrixStack(double dt);
+	// Uniforms set by name, by handle, and through UniformBlocks, with prog
+	// the light volume program
+	static bool uniforms(std::shared_ptr<Program> prog, std::shared_ptr<UniformBlocks> blocks, int width, int height);
+};
+
+#endif
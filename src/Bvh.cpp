@@ -0,0 +1,161 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+// Boxes per leaf
+static const int LEAF_SIZE = 4;
+
+Bvh::Box Bvh::Box::transformed(const glm::mat4 &M) const
+{
+	glm::vec3 center = 0.5f*(min + max);
+	glm::vec3 extent = 0.5f*(max - min);
+	glm::vec3 c = glm::vec3(M * glm::vec4(center, 1.0f));
+	glm::vec3 e = glm::abs(glm::vec3(M[0]))*extent.x + glm::abs(glm::vec3(M[1]))*extent.y + glm::abs(glm::vec3(M[2]))*extent.z;
+	return Box(c - e, c + e);
+}
+
+void Bvh::frustumPlanes(const glm::mat4 &PV, glm::vec4 planes[6])
+{
+	// Gribb and Hartmann: -w <= x, y, z <= w in clip space
+	glm::vec4 rows[4];
+	for(int r = 0; r < 4; r++) {
+		rows[r] = glm::vec4(PV[0][r], PV[1][r], PV[2][r], PV[3][r]);
+	}
+	for(int i = 0; i < 3; i++) {
+		planes[2*i] = rows[3] + rows[i];
+		planes[2*i+1] = rows[3] - rows[i];
+	}
+}
+
+Bvh::Bvh()
+{
+}
+
+Bvh::~Bvh()
+{
+}
+
+void Bvh::build(const vector<Box> &boxes)
+{
+	this->boxes = boxes;
+	nodes.clear();
+	indices.resize(boxes.size());
+	for(size_t i = 0; i < indices.size(); i++) {
+		indices[i] = (int)i;
+	}
+	if(boxes.empty()) {
+		return;
+	}
+	nodes.reserve(2*boxes.size()/LEAF_SIZE + 1);
+	nodes.push_back(Node());
+	buildNode(0, 0, (int)boxes.size());
+}
+
+void Bvh::buildNode(int node, int begin, int end)
+{
+	Box box = boxes[indices[begin]];
+	Box centers(box.min + box.max, box.min + box.max);
+	for(int i = begin + 1; i < end; i++) {
+		const Box &b = boxes[indices[i]];
+		box = box.united(b);
+		centers = centers.united(Box(b.min + b.max, b.min + b.max));
+	}
+	nodes[node].box = box;
+	nodes[node].first = begin;
+	nodes[node].count = end - begin;
+	nodes[node].child = -1;
+	if(end - begin <= LEAF_SIZE) {
+		return;
+	}
+
+	// Split at the median center along the axis the centers spread the most
+	glm::vec3 spread = centers.max - centers.min;
+	int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+	int mid = (begin + end)/2;
+	nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [this, axis](int a, int b) {
+		return boxes[a].min[axis] + boxes[a].max[axis] < boxes[b].min[axis] + boxes[b].max[axis];
+	});
+	int child = (int)nodes.size();
+	nodes[node].child = child;
+	nodes.push_back(Node());
+	nodes.push_back(Node());
+	buildNode(child, begin, mid);
+	buildNode(child + 1, mid, end);
+}
+
+void Bvh::refit(const vector<Box> &boxes)
+{
+	assert(boxes.size() == this->boxes.size());
+	this->boxes = boxes;
+	// The children of a node come after it
+	for(int n = (int)nodes.size() - 1; n >= 0; n--) {
+		Node &node = nodes[n];
+		if(node.child >= 0) {
+			node.box = nodes[node.child].box.united(nodes[node.child + 1].box);
+			continue;
+		}
+		node.box = boxes[indices[node.first]];
+		for(int i = node.first + 1; i < node.first + node.count; i++) {
+			node.box = node.box.united(boxes[indices[i]]);
+		}
+	}
+}
+
+// Returns the planes of mask the box is not fully inside of, or -1 if it
+// is outside one of them
+static int clip(const Bvh::Box &box, const glm::vec4 planes[6], int mask)
+{
+	glm::vec3 center = 0.5f*(box.min + box.max);
+	glm::vec3 extent = 0.5f*(box.max - box.min);
+	for(int i = 0; i < 6; i++) {
+		if(!(mask & (1 << i))) {
+			continue;
+		}
+		const glm::vec4 &p = planes[i];
+		float d = glm::dot(glm::vec3(p), center) + p.w;
+		float r = glm::dot(glm::abs(glm::vec3(p)), extent);
+		if(d + r < 0.0f) {
+			return -1;
+		} else if(d - r >= 0.0f) {
+			mask &= ~(1 << i);
+		}
+	}
+	return mask;
+}
+
+void Bvh::cull(const glm::mat4 &PV, vector<int> &visible) const
+{
+	visible.clear();
+	if(nodes.empty()) {
+		return;
+	}
+	glm::vec4 planes[6];
+	frustumPlanes(PV, planes);
+
+	// Nodes to visit, with the planes their parent is not fully inside of
+	vector< pair<int, int> > stack;
+	stack.push_back(make_pair(0, 0x3F));
+	while(!stack.empty()) {
+		const Node &node = nodes[stack.back().first];
+		int mask = clip(node.box, planes, stack.back().second);
+		stack.pop_back();
+		if(mask < 0) {
+			continue;
+		}
+		if(mask == 0) {
+			visible.insert(visible.end(), indices.begin() + node.first, indices.begin() + node.first + node.count);
+		} else if(node.child >= 0) {
+			stack.push_back(make_pair(node.child, mask));
+			stack.push_back(make_pair(node.child + 1, mask));
+		} else {
+			for(int i = node.first; i < node.first + node.count; i++) {
+				if(clip(boxes[indices[i]], planes, mask) >= 0) {
+					visible.push_back(indices[i]);
+				}
+			}
+		}
+	}
+}
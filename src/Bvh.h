@@ -0,0 +1,72 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/**
+ * A bounding volume hierarchy over axis-aligned boxes, for culling them
+ * against the view frustum.
+ * - build() splits the boxes at the median of their centers along the
+ *   longest axis, down to a few boxes per leaf.
+ * - refit() takes new boxes for the same indices, and only recomputes the
+ *   boxes of the nodes. The tree stays correct, but gets looser as the boxes
+ *   move away from where they were built.
+ * - cull() skips the subtrees outside one of the planes, takes the ones
+ *   inside all of them without testing their boxes, and only tests the
+ *   planes a subtree straddles. Boxes straddling a plane are kept, so the
+ *   test is conservative.
+ * - Doesn't need an OpenGL context.
+ */
+class Bvh
+{
+public:
+	struct Box
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		Box() : min(0.0f), max(0.0f) {}
+		Box(const glm::vec3 &min, const glm::vec3 &max) : min(min), max(max) {}
+		// The box around this one transformed by an affine matrix
+		Box transformed(const glm::mat4 &M) const;
+		Box united(const Box &b) const { return Box(glm::min(min, b.min), glm::max(max, b.max)); }
+	};
+
+	// The planes of the frustum of a projection*view matrix, in world space,
+	// with normals pointing inside
+	static void frustumPlanes(const glm::mat4 &PV, glm::vec4 planes[6]);
+
+	Bvh();
+	virtual ~Bvh();
+	void build(const std::vector<Box> &boxes);
+	// boxes must have getBoxCount() boxes
+	void refit(const std::vector<Box> &boxes);
+	// Replaces visible with the indices of the boxes not outside the frustum
+	// of PV, in no particular order
+	void cull(const glm::mat4 &PV, std::vector<int> &visible) const;
+	int getNodeCount() const { return (int)nodes.size(); }
+	int getBoxCount() const { return (int)boxes.size(); }
+
+private:
+	struct Node
+	{
+		Box box;
+		// The boxes under the node are indices[first, first + count)
+		int first;
+		int count;
+		// The children are at child and child + 1, or -1 in leaves
+		int child;
+	};
+
+	// Builds the node of indices [begin, end) into nodes[node]
+	void buildNode(int node, int begin, int end);
+
+	std::vector<Node> nodes;
+	std::vector<int> indices;
+	std::vector<Box> boxes;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "Checks.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "ClusterBuilder.h"
+#include "ImageDiff.h"
+#include "MatrixStack.h"
+#include "MeshOptimizer.h"
+#include "Shape.h"
+#include "ThreadPool.h"
+#include "Transform.h"
+
+using namespace std;
+
+// Against brute force, for a few tile sizes and light counts
+bool Checks::clusters(shared_ptr<ThreadPool> pool, int width, int height, int slices, float sliceFar)
+{
+	std::mt19937 gen(0);
+	std::uniform_real_distribution<> distx(-5.0, 15.0);
+	std::uniform_real_distribution<> disty(0.0, 3.0);
+	std::uniform_real_distribution<> distrad(0.1, 4.0);
+	Camera cam;
+	cam.setInitDistance(20.0f);
+	cam.setAspect((float)width/(float)height);
+	auto P = make_shared<MatrixStack>();
+	auto MV = make_shared<MatrixStack>();
+	cam.applyProjectionMatrix(P);
+	cam.applyViewMatrix(MV);
+	bool ok = true;
+	int tileSizes[] = {8, 16, 32};
+	int lightCounts[] = {10, 100, 1000};
+	for(int tileSize : tileSizes) {
+		for(int lightCount : lightCounts) {
+			vector<glm::vec3> positions;
+			vector<float> radii;
+			for(int i = 0; i < lightCount; i++) {
+				glm::vec4 p(distx(gen), disty(gen), distx(gen), 1.0f);
+				positions.push_back(glm::vec3(MV->topMatrix() * p));
+				radii.push_back(distrad(gen));
+			}
+			ClusterBuilder builder;
+			builder.setThreadPool(pool);
+			builder.setTileSize(tileSize);
+			builder.setSlices(slices);
+			builder.setSliceFar(sliceFar);
+			builder.build(positions, radii, P->topMatrix(), width, height);
+			int found = 0;
+			bool match = builder.checkBruteForce(&found);
+			cout << "Clusters of " << tileSize << " pixels, " << lightCount << " lights: ";
+			cout << builder.getIndexCount() << " indices, " << found << " exact, " << (match ? "ok" : "FAILED") << endl;
+			ok = ok && match;
+		}
+	}
+	return ok;
+}
+
+// On grids triangulated like Sphere and Revo, too
+bool Checks::vertexCache(const string &resourceDir)
+{
+	bool ok = true;
+	const char *meshes[] = {"bunny.obj", "teapot.obj", "sphere.obj"};
+	for(const char *mesh : meshes) {
+		vector<float> posBuf, norBuf, texBuf;
+		vector<unsigned int> indBuf;
+		float lowest_y;
+		if(!Shape::parseMesh(resourceDir + mesh, posBuf, norBuf, texBuf, indBuf, lowest_y)) {
+			return false;
+		}
+		ok = MeshOptimizer::check(mesh, indBuf, posBuf) && ok;
+	}
+	// Rows of vertices around the y axis, with Sphere's and Revo's sizes
+	int grids[][2] = {{50, 50}, {50, 40}};
+	for(auto &grid : grids) {
+		int rows = grid[0];
+		int cols = grid[1];
+		vector<float> posBuf;
+		vector<unsigned int> indBuf;
+		for(int i = 0; i < rows; i++) {
+			for(int j = 0; j < cols; j++) {
+				double theta = 2.0*M_PI*j/(cols - 1);
+				posBuf.push_back((float)i);
+				posBuf.push_back((float)cos(theta));
+				posBuf.push_back((float)sin(theta));
+			}
+		}
+		for(int i = 0; i < rows - 1; i++) {
+			for(int j = 0; j < cols - 1; j++) {
+				unsigned int a = i*cols + j;
+				unsigned int b = (i + 1)*cols + j;
+				unsigned int tris[] = {a, a + 1, b + 1, a, b + 1, b};
+				indBuf.insert(indBuf.end(), tris, tris + 6);
+			}
+		}
+		ok = MeshOptimizer::check("grid " + to_string(rows) + "x" + to_string(cols), indBuf, posBuf) && ok;
+	}
+	return ok;
+}
+
+// Compares the normal matrices of Transform with glm::inverse(), for random
+// transforms of each kind the scene uses, and for general affine and
+// projective matrices. Also reports the time per matrix of both.
+bool Checks::normalMatrix()
+{
+	std::mt19937 gen(0);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> sizes(0.05f, 20.0f);
+	auto vec = [&]() { return glm::vec3(dist(gen), dist(gen), dist(gen)); };
+	auto turn = [&]() { return Transform::rotation((float)M_PI*dist(gen), vec() + glm::vec3(0.0f, 0.0f, 1.1f)); };
+	// A view like the camera's, and the object transforms of loadScene() and
+	// of the animations in SceneStore
+	auto view = [&]() { return Transform::translation(10.0f*vec())*turn()*turn(); };
+	auto shear = [&]() {
+		glm::mat4 S(1.0f);
+		S[1][2] = 0.5f*dist(gen);
+		return Transform(S, Transform::SHEAR);
+	};
+	struct Kind
+	{
+		const char *name;
+		function<Transform()> make;
+	};
+	Kind kinds[] = {
+		{"rigid", [&]() { return view()*Transform::translation(10.0f*vec())*turn(); }},
+		{"uniform scale", [&]() { return view()*Transform::translation(10.0f*vec())*turn()*Transform::scale(sizes(gen)); }},
+		{"scale", [&]() { return view()*Transform::translation(vec())*Transform::scale(glm::vec3(sizes(gen), sizes(gen), sizes(gen)))*turn(); }},
+		{"shear", [&]() { return view()*Transform::translation(vec())*shear()*turn()*Transform::scale(sizes(gen)); }},
+		{"affine", [&]() {
+			glm::mat4 M(1.0f);
+			// Far enough from singular for float
+			M[0] = glm::vec4(0.5f*vec() + glm::vec3(1.0f, 0.0f, 0.0f), 0.0f);
+			M[1] = glm::vec4(0.5f*vec() + glm::vec3(0.0f, 1.0f, 0.0f), 0.0f);
+			M[2] = glm::vec4(0.5f*vec() + glm::vec3(0.0f, 0.0f, 1.0f), 0.0f);
+			M[3] = glm::vec4(10.0f*vec(), 1.0f);
+			return Transform(M, Transform::SHEAR | Transform::TRANSLATION);
+		}},
+		{"projective", [&]() {
+			glm::mat4 P(1.0f);
+			P[2][3] = -1.0f;
+			P[3][2] = -0.2f;
+			P[3][3] = 0.0f;
+			return Transform(P, Transform::PROJECTIVE)*view();
+		}},
+	};
+
+	// The largest difference of two normal matrices a and b of M, relative to
+	// the largest entry of the upper 3x3, which turns the normals. The last
+	// row, -(N^T*t), is relative to its largest term, as it can be much
+	// smaller than its terms. The error of any float inverse grows with the
+	// condition number of M, estimated from the largest entries of M and of
+	// its inverse, so the errors are divided by it. Matrices that aren't
+	// affine are compared as a whole.
+	auto error = [](const glm::mat4 &a, const glm::mat4 &b, const glm::mat4 &M, bool affine) {
+		float diff = 0.0f;
+		float size = 0.0f;
+		float sizeM = 0.0f;
+		int rows = affine ? 3 : 4;
+		for(int c = 0; c < rows; c++) {
+			for(int r = 0; r < rows; r++) {
+				diff = max(diff, fabs(a[c][r] - b[c][r]));
+				size = max(size, fabs(b[c][r]));
+				sizeM = max(sizeM, fabs(M[c][r]));
+			}
+		}
+		float e = diff/size;
+		for(int c = 0; c < 3 && affine; c++) {
+			float terms = 0.0f;
+			for(int r = 0; r < 3; r++) {
+				terms = max(terms, fabs(b[c][r]*M[3][r]));
+			}
+			e = max(e, fabs(a[c][3] - b[c][3])/max(terms, size));
+		}
+		return e/max(1.0f, size*sizeM);
+	};
+	const int n = 100000;
+	const float tolerance = 1e-5f;
+	bool ok = true;
+	for(const Kind &kind : kinds) {
+		vector<Transform> transforms;
+		vector<glm::mat4> matrices;
+		for(int i = 0; i < n; i++) {
+			transforms.push_back(kind.make());
+			matrices.push_back(transforms.back().getMatrix());
+		}
+		bool affine = !(transforms[0].getParts() & Transform::PROJECTIVE);
+		vector<glm::mat4> reference(n);
+		vector<glm::mat4> single(n);
+		vector<glm::mat4> batch(n);
+		auto start = chrono::steady_clock::now();
+		for(int i = 0; i < n; i++) {
+			reference[i] = glm::inverse(glm::transpose(matrices[i]));
+		}
+		auto middle = chrono::steady_clock::now();
+		for(int i = 0; i < n; i++) {
+			single[i] = transforms[i].normalMatrix();
+		}
+		auto end = chrono::steady_clock::now();
+		double inverseNs = chrono::duration<double, nano>(middle - start).count()/n;
+		double singleNs = chrono::duration<double, nano>(end - middle).count()/n;
+		float singleError = 0.0f;
+		for(int i = 0; i < n; i++) {
+			singleError = max(singleError, error(single[i], reference[i], matrices[i], affine));
+		}
+		bool match = singleError < tolerance;
+		cout << kind.name << ": glm::inverse " << inverseNs << " ns, normalMatrix() " << singleNs << " ns, largest error " << singleError;
+		if(affine) {
+			start = chrono::steady_clock::now();
+			Transform::normalMatrices(matrices.data(), batch.data(), n);
+			end = chrono::steady_clock::now();
+			float batchError = 0.0f;
+			for(int i = 0; i < n; i++) {
+				batchError = max(batchError, error(batch[i], reference[i], matrices[i], affine));
+			}
+			cout << "; normalMatrices() " << chrono::duration<double, nano>(end - start).count()/n << " ns, largest error " << batchError;
+			match = match && batchError < tolerance;
+		}
+		cout << (match ? ", ok" : ", FAILED") << endl;
+		ok = ok && match;
+	}
+	return ok;
+}
+
+// Compares each operation of MatrixStack with the glm product it replaces,
+// on random matrices, in ulps of the largest sum of the magnitudes of the
+// terms of the product in each column. The kernels add in glm's order, and
+// neither side is fused into FMAs (see CMakeLists.txt), so translations,
+// scales and products must give the same bits. Rotations around x, y and z
+// may differ by an ulp, as glm's rotation matrix doesn't have exact ones on
+// its diagonal.
+bool Checks::matrixStack()
+{
+	const float exact = 0.0f;
+	std::mt19937 gen(0);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	auto vec = [&]() { return glm::vec3(dist(gen), dist(gen), dist(gen)); };
+	auto mat = [&]() {
+		glm::mat4 M;
+		for(int c = 0; c < 4; c++) {
+			M[c] = glm::vec4(10.0f*vec(), 10.0f*dist(gen));
+		}
+		return M;
+	};
+	const glm::vec3 axes[] = {
+		glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+		glm::vec3(0.0f, -2.0f, 0.0f)
+	};
+	struct Operation
+	{
+		const char *name;
+		float tolerance;
+		// Applies a random operation to the stack, and returns the matrix
+		// that glm multiplies by for it
+		function<glm::mat4(MatrixStack &)> apply;
+	};
+	Operation operations[] = {
+		{"translate", exact, [&](MatrixStack &MV) {
+			glm::vec3 t = 10.0f*vec();
+			MV.translate(t);
+			return glm::translate(glm::mat4(1.0f), t);
+		}},
+		{"scale", exact, [&](MatrixStack &MV) {
+			glm::vec3 s = 4.0f*vec();
+			MV.scale(s);
+			return glm::scale(glm::mat4(1.0f), s);
+		}},
+		{"rotate around x, y or z", exact + 1.0f, [&](MatrixStack &MV) {
+			float angle = (float)M_PI*dist(gen);
+			glm::vec3 axis = axes[gen() % 4];
+			MV.rotate(angle, axis);
+			return glm::rotate(glm::mat4(1.0f), angle, axis);
+		}},
+		{"rotate", exact, [&](MatrixStack &MV) {
+			float angle = (float)M_PI*dist(gen);
+			glm::vec3 axis = vec() + glm::vec3(0.0f, 0.0f, 1.1f);
+			MV.rotate(angle, axis);
+			return glm::rotate(glm::mat4(1.0f), angle, axis);
+		}},
+		{"multMatrix", exact, [&](MatrixStack &MV) {
+			glm::mat4 B = mat();
+			MV.multMatrix(B);
+			return B;
+		}},
+	};
+
+	bool ok = true;
+	for(const Operation &operation : operations) {
+		float maxUlps = 0.0f;
+		MatrixStack MV;
+		for(int i = 0; i < 100000; i++) {
+			glm::mat4 M = mat();
+			MV.loadIdentity();
+			MV.multMatrix(M);
+			glm::mat4 B = operation.apply(MV);
+			glm::mat4 reference = M*B;
+			const glm::mat4 &top = MV.topMatrix();
+			for(int c = 0; c < 4; c++) {
+				float size = 0.0f;
+				for(int r = 0; r < 4; r++) {
+					float terms = 0.0f;
+					for(int k = 0; k < 4; k++) {
+						terms += fabs(M[k][r]*B[c][k]);
+					}
+					size = max(size, terms);
+				}
+				float ulp = FLT_EPSILON*size;
+				for(int r = 0; r < 4; r++) {
+					maxUlps = max(maxUlps, fabs(top[c][r] - reference[c][r])/ulp);
+				}
+			}
+		}
+		bool match = maxUlps <= operation.tolerance;
+		cout << operation.name << ": largest difference from glm " << maxUlps << " ulps" << (match ? ", ok" : ", FAILED") << endl;
+		ok = ok && match;
+	}
+	return ok;
+}
+
+// E.g. the output of the packed and the full G-buffer rendered with the same
+// --time
+bool Checks::imageDiff(const string &image, const string &reference, int tolerance, float outliers, float threshold)
+{
+	ImageDiff d = ImageDiff::compare(image, reference, tolerance, threshold);
+	if(!d.read) {
+		return false;
+	}
+	bool ok = d.outliers <= outliers*d.pixels;
+	cout << image << " vs " << reference << ": max difference " << d.maxDiff << ", mean " << d.meanDiff;
+	cout << ", " << d.outliers << " pixels above " << tolerance << ", " << d.perceptual << " visibly different, ";
+	cout << (ok ? "ok" : "FAILED") << endl;
+	return ok;
+}
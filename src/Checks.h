@@ -0,0 +1,32 @@
+#pragma once
+#ifndef CHECKS_H
+#define CHECKS_H
+
+#include <memory>
+#include <string>
+
+class ThreadPool;
+
+/**
+ * The self-checks of --check=..., which compare an optimized part of the
+ * renderer with a simpler reference. Each prints a line per case, ending in
+ * "ok" or "FAILED", and returns whether all of them passed. None of them
+ * needs an OpenGL context.
+ */
+class Checks
+{
+public:
+	// The light lists of ClusterBuilder, for a width x height framebuffer
+	static bool clusters(std::shared_ptr<ThreadPool> pool, int width, int height, int slices, float sliceFar);
+	// MeshOptimizer, on the OBJ meshes in resourceDir and on grids
+	static bool vertexCache(const std::string &resourceDir);
+	// The normal matrices of Transform, against glm::inverse()
+	static bool normalMatrix();
+	// The operations of MatrixStack, against glm
+	static bool matrixStack();
+	// Whether at most a fraction outliers of the pixels of two PNG files
+	// differ by more than tolerance, see ImageDiff
+	static bool imageDiff(const std::string &image, const std::string &reference, int tolerance, float outliers, float threshold);
+};
+
+#endif
@@ -0,0 +1,346 @@
+#include "ClusterBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include "GLSL.h"
+#include "Program.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+ClusterBuilder::ClusterBuilder() :
+	P(1.0f),
+	width(0),
+	height(0),
+	tileSize(16),
+	slices(24),
+	sliceFar(100.0f),
+	tilesX(0),
+	tilesY(0),
+	znear(0.1f),
+	sliceScale(1.0f),
+	lightBufID(0),
+	lightTexID(0),
+	clusterBufID(0),
+	clusterTexID(0),
+	indexBufID(0),
+	indexTexID(0)
+{
+}
+
+ClusterBuilder::~ClusterBuilder()
+{
+}
+
+bool ClusterBuilder::inColumn(int i, int tx) const
+{
+	glm::vec3 c(lights[i].x, lights[i].y, lights[i].z);
+	float r = lights[i].w;
+	return glm::dot(xPlanes[tx], c) >= -r && glm::dot(xPlanes[tx+1], c) <= r;
+}
+
+bool ClusterBuilder::inRow(int i, int ty) const
+{
+	glm::vec3 c(lights[i].x, lights[i].y, lights[i].z);
+	float r = lights[i].w;
+	return glm::dot(yPlanes[ty], c) >= -r && glm::dot(yPlanes[ty+1], c) <= r;
+}
+
+bool ClusterBuilder::inSlice(int i, int k) const
+{
+	float z = -lights[i].z;
+	float r = lights[i].w;
+	return z + r >= depths[k] && z - r <= depths[k+1];
+}
+
+void ClusterBuilder::build(const vector<glm::vec3> &positions, const vector<float> &radii, const glm::mat4 &P, int width, int height)
+{
+	// Runs body over [0, n) on the pool if there is one
+	auto parallelFor = [this](int n, const function<void(int, int)> &body) {
+		if(pool) {
+			pool->parallelFor(n, body);
+		} else {
+			body(0, n);
+		}
+	};
+
+	this->P = P;
+	this->width = width;
+	this->height = height;
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+
+	// Near and far planes of the perspective projection
+	znear = P[3][2]/(P[2][2] - 1.0f);
+	float zfar = P[3][2]/(P[2][2] + 1.0f);
+	float zslice = min(sliceFar, zfar);
+	sliceScale = slices/log(zslice/znear);
+
+	// Boundary planes. The pixel at ndc looks along (ndc.x/P[0][0], ndc.y/P[1][1], -1).
+	xPlanes.resize(tilesX + 1);
+	for(int b = 0; b <= tilesX; b++) {
+		float ndc = min(2.0f*b*tileSize/width - 1.0f, 1.0f);
+		xPlanes[b] = glm::normalize(glm::vec3(1.0f, 0.0f, ndc/P[0][0]));
+	}
+	yPlanes.resize(tilesY + 1);
+	for(int b = 0; b <= tilesY; b++) {
+		float ndc = min(2.0f*b*tileSize/height - 1.0f, 1.0f);
+		yPlanes[b] = glm::normalize(glm::vec3(0.0f, 1.0f, ndc/P[1][1]));
+	}
+	depths.resize(slices + 1);
+	for(int k = 0; k < slices; k++) {
+		depths[k] = znear*exp(k/sliceScale);
+	}
+	depths[slices] = zfar;
+
+	// The planes of a light's columns, rows and slices are monotonic, so the
+	// clusters it overlaps form a box.
+	int n = (int)positions.size();
+	lights.resize(n);
+	tileRanges.resize(n);
+	sliceRanges.resize(n);
+	parallelFor(n, [&](int begin, int end) {
+		for(int i = begin; i < end; i++) {
+			lights[i] = glm::vec4(positions[i], radii[i]);
+			glm::ivec4 &t = tileRanges[i];
+			glm::ivec2 &s = sliceRanges[i];
+			t = glm::ivec4(0, -1, 0, -1);
+			s = glm::ivec2(0, -1);
+			if(radii[i] <= 0.0f) {
+				continue;
+			}
+			int tx = 0;
+			while(tx < tilesX && !inColumn(i, tx)) {
+				tx++;
+			}
+			t.x = tx;
+			while(tx < tilesX && inColumn(i, tx)) {
+				tx++;
+			}
+			t.y = tx - 1;
+			int ty = 0;
+			while(ty < tilesY && !inRow(i, ty)) {
+				ty++;
+			}
+			t.z = ty;
+			while(ty < tilesY && inRow(i, ty)) {
+				ty++;
+			}
+			t.w = ty - 1;
+			int k = 0;
+			while(k < slices && !inSlice(i, k)) {
+				k++;
+			}
+			s.x = k;
+			while(k < slices && inSlice(i, k)) {
+				k++;
+			}
+			s.y = k - 1;
+		}
+	});
+
+	// Count, then fill, the lists one slice per task, so that the lists of a
+	// cluster are only written by one thread
+	int perSlice = tilesX*tilesY;
+	clusters.assign(2*perSlice*slices, 0);
+	auto scatter = [&](bool fill, vector<int> &cursor) {
+		parallelFor(slices, [&](int begin, int end) {
+			for(int k = begin; k < end; k++) {
+				for(int i = 0; i < n; i++) {
+					if(k < sliceRanges[i].x || k > sliceRanges[i].y) {
+						continue;
+					}
+					const glm::ivec4 &t = tileRanges[i];
+					for(int ty = t.z; ty <= t.w; ty++) {
+						for(int tx = t.x; tx <= t.y; tx++) {
+							int c = (k*tilesY + ty)*tilesX + tx;
+							if(fill) {
+								indices[cursor[c]++] = i;
+							} else {
+								clusters[2*c+1]++;
+							}
+						}
+					}
+				}
+			}
+		});
+	};
+	vector<int> cursor(perSlice*slices);
+	scatter(false, cursor);
+	int total = 0;
+	for(int c = 0; c < perSlice*slices; c++) {
+		clusters[2*c] = total;
+		cursor[c] = total;
+		total += clusters[2*c+1];
+	}
+	indices.resize(total);
+	scatter(true, cursor);
+}
+
+// The distance from p to the segment ab
+static float distanceToSegment(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b)
+{
+	glm::vec3 ab = b - a;
+	float t = glm::clamp(glm::dot(p - a, ab)/glm::dot(ab, ab), 0.0f, 1.0f);
+	return glm::length(p - (a + t*ab));
+}
+
+// The distance from p to the planar convex quad q[0] q[1] q[2] q[3]
+static float distanceToQuad(const glm::vec3 &p, const glm::vec3 q[4])
+{
+	glm::vec3 n = glm::normalize(glm::cross(q[1] - q[0], q[3] - q[0]));
+	float h = glm::dot(p - q[0], n);
+	glm::vec3 x = p - h*n;
+	// x is inside if it is on the same side of all edges
+	int inside = 0;
+	float d = numeric_limits<float>::max();
+	for(int e = 0; e < 4; e++) {
+		const glm::vec3 &a = q[e];
+		const glm::vec3 &b = q[(e + 1) % 4];
+		inside += glm::dot(glm::cross(b - a, x - a), n) >= 0.0f ? 1 : -1;
+		d = min(d, distanceToSegment(p, a, b));
+	}
+	return abs(inside) == 4 ? abs(h) : d;
+}
+
+bool ClusterBuilder::checkBruteForce(int *found) const
+{
+	// The view-space point at ndc (x, y) and depth d in front of the camera
+	glm::mat4 invP = glm::inverse(P);
+	auto unproject = [&](float x, float y, float d) {
+		glm::vec4 clip = P*glm::vec4(0.0f, 0.0f, -d, 1.0f);
+		glm::vec4 v = invP*glm::vec4(x, y, clip.z/clip.w, 1.0f);
+		return glm::vec3(v)/v.w;
+	};
+	glm::vec4 nearPoint = invP*glm::vec4(0.0f, 0.0f, -1.0f, 1.0f);
+	glm::vec4 farPoint = invP*glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	float zn = -nearPoint.z/nearPoint.w;
+	float zf = -farPoint.z/farPoint.w;
+	// Slice k starts at zn*(zs/zn)^(k/slices), and the last one ends at zf
+	float zs = min(sliceFar, zf);
+	// The corners of a cluster are i + 2*j + 4*l for its left or right (i),
+	// bottom or top (j) and near or far (l) side, and its faces are
+	const int faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+	int count = 0;
+	bool ok = true;
+	for(int k = 0; k < slices; k++) {
+		float d[2] = {zn*pow(zs/zn, (float)k/slices), k + 1 == slices ? zf : zn*pow(zs/zn, (float)(k + 1)/slices)};
+		for(int ty = 0; ty < tilesY; ty++) {
+			float y[2] = {2.0f*ty*tileSize/height - 1.0f, min(2.0f*(ty + 1)*tileSize/height - 1.0f, 1.0f)};
+			for(int tx = 0; tx < tilesX; tx++) {
+				float x[2] = {2.0f*tx*tileSize/width - 1.0f, min(2.0f*(tx + 1)*tileSize/width - 1.0f, 1.0f)};
+				glm::vec3 corners[8];
+				glm::vec3 center(0.0f);
+				for(int c = 0; c < 8; c++) {
+					corners[c] = unproject(x[c & 1], y[(c >> 1) & 1], d[c >> 2]);
+					center += corners[c]/8.0f;
+				}
+				float radius = 0.0f;
+				for(int c = 0; c < 8; c++) {
+					radius = max(radius, glm::length(corners[c] - center));
+				}
+				int cluster = (k*tilesY + ty)*tilesX + tx;
+				const int *begin = indices.data() + clusters[2*cluster];
+				const int *end = begin + clusters[2*cluster+1];
+				for(int i = 0; i < (int)lights.size(); i++) {
+					glm::vec3 p(lights[i]);
+					float r = lights[i].w;
+					// Too far from the corners' bounding sphere to be near
+					if(r <= 0.0f || glm::length(p - center) > r + radius) {
+						continue;
+					}
+					// Zero inside all faces, or the distance to the nearest face
+					bool inside = true;
+					float dist = numeric_limits<float>::max();
+					for(const int *face : faces) {
+						glm::vec3 q[4] = {corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]]};
+						glm::vec3 n = glm::cross(q[1] - q[0], q[3] - q[0]);
+						inside = inside && glm::dot(p - q[0], n)*glm::dot(center - q[0], n) >= 0.0f;
+						dist = min(dist, distanceToQuad(p, q));
+					}
+					// With some slack for the rounding of both tests
+					if(!inside && dist > r*(1.0f - 1e-4f)) {
+						continue;
+					}
+					count++;
+					if(find(begin, end, i) == end) {
+						ok = false;
+					}
+				}
+			}
+		}
+	}
+	if(found) {
+		*found = count;
+	}
+	return ok;
+}
+
+void ClusterBuilder::init()
+{
+	glGenBuffers(1, &lightBufID);
+	glGenTextures(1, &lightTexID);
+	glGenBuffers(1, &clusterBufID);
+	glGenTextures(1, &clusterTexID);
+	glGenBuffers(1, &indexBufID);
+	glGenTextures(1, &indexTexID);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+// Streams data into a texture buffer
+static void uploadTextureBuffer(GLuint bufID, GLuint texID, GLenum format, const void *data, size_t size)
+{
+	// Buffers can't be empty
+	glBindBuffer(GL_TEXTURE_BUFFER, bufID);
+	glBufferData(GL_TEXTURE_BUFFER, max(size, (size_t)16), size > 0 ? data : NULL, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, texID);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, bufID);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusterBuilder::upload(const vector<glm::vec3> &colors)
+{
+	vector<glm::vec4> lightBuf(2*lights.size());
+	for(size_t i = 0; i < lights.size(); i++) {
+		lightBuf[2*i] = lights[i];
+		lightBuf[2*i+1] = glm::vec4(colors[i], 0.0f);
+	}
+	uploadTextureBuffer(lightBufID, lightTexID, GL_RGBA32F, lightBuf.data(), lightBuf.size()*sizeof(glm::vec4));
+	uploadTextureBuffer(clusterBufID, clusterTexID, GL_RG32I, clusters.data(), clusters.size()*sizeof(int));
+	uploadTextureBuffer(indexBufID, indexTexID, GL_R32I, indices.data(), indices.size()*sizeof(int));
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void ClusterBuilder::bind(const shared_ptr<Program> prog, int unit) const
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, lightTexID);
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_BUFFER, clusterTexID);
+	glActiveTexture(GL_TEXTURE0 + unit + 2);
+	glBindTexture(GL_TEXTURE_BUFFER, indexTexID);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(prog->getUniform("lights"), unit);
+	glUniform1i(prog->getUniform("clusters"), unit + 1);
+	glUniform1i(prog->getUniform("indices"), unit + 2);
+	glUniform1i(prog->getUniform("tile_size"), tileSize);
+	glUniform1i(prog->getUniform("tiles_x"), tilesX);
+	glUniform1i(prog->getUniform("tiles_y"), tilesY);
+	glUniform1i(prog->getUniform("slices"), slices);
+	glUniform1f(prog->getUniform("znear"), znear);
+	glUniform1f(prog->getUniform("slice_scale"), sliceScale);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void ClusterBuilder::unbind(int unit) const
+{
+	for(int i = 0; i < 3; i++) {
+		glActiveTexture(GL_TEXTURE0 + unit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
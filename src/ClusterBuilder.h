@@ -0,0 +1,99 @@
+#pragma once
+#ifndef CLUSTERBUILDER_H
+#define CLUSTERBUILDER_H
+
+#include <memory>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Program;
+class ThreadPool;
+
+/**
+ * Light lists of clustered deferred shading, built on the CPU.
+ * The view frustum is split into tileSize x tileSize pixel tiles on screen
+ * and into slices in depth, spaced logarithmically from the near plane to
+ * sliceFar (the last slice extends to the far plane). A light is in a cluster
+ * if its sphere of influence is not fully outside one of the six planes
+ * bounding the cluster.
+ * - build() and checkBruteForce() don't need an OpenGL context. The
+ *   projection must be symmetric, which checkBruteForce() doesn't assume.
+ * - lights: texture buffer with two RGBA32F texels per light,
+ *   (camera-space position, radius) and (color, 0)
+ * - clusters: texture buffer with one RG32I texel per cluster, the offset
+ *   and number of its lights in indices
+ * - indices: texture buffer of R32I light indices
+ */
+class ClusterBuilder
+{
+public:
+	ClusterBuilder();
+	virtual ~ClusterBuilder();
+	void setThreadPool(std::shared_ptr<ThreadPool> p) { pool = p; }
+	void setTileSize(int size) { tileSize = size; }
+	void setSlices(int n) { slices = n; }
+	void setSliceFar(float z) { sliceFar = z; }
+	// Builds the light lists. Light positions are in camera space.
+	void build(const std::vector<glm::vec3> &positions, const std::vector<float> &radii, const glm::mat4 &P, int width, int height);
+	// Tests every light against every cluster of the last build() exactly,
+	// with the sphere's distance to the cluster's corners' hull, and returns
+	// whether the lists have all the lights found. The lists may have more,
+	// as the plane tests are conservative. If found isn't NULL, it is set to
+	// the number of lights found in all clusters.
+	bool checkBruteForce(int *found = NULL) const;
+	int getClusterCount() const { return tilesX*tilesY*slices; }
+	int getIndexCount() const { return (int)indices.size(); }
+
+	void init();
+	// Uploads the lists of the last build() with the light colors
+	void upload(const std::vector<glm::vec3> &colors);
+	// Binds the buffers to texture units unit to unit+2, and sets the
+	// uniforms of the clustered lighting shader
+	void bind(const std::shared_ptr<Program> prog, int unit) const;
+	void unbind(int unit) const;
+
+private:
+	// Plane tests of a light against column tx, row ty and slice k
+	bool inColumn(int i, int tx) const;
+	bool inRow(int i, int ty) const;
+	bool inSlice(int i, int k) const;
+
+	std::shared_ptr<ThreadPool> pool;
+	// Of the last build()
+	glm::mat4 P;
+	int width;
+	int height;
+	int tileSize;
+	int slices;
+	float sliceFar;
+	int tilesX;
+	int tilesY;
+	float znear;
+	float sliceScale;
+	// Inward normals of the planes at the column and row boundaries, through
+	// the camera, and depths of the slice boundaries
+	std::vector<glm::vec3> xPlanes;
+	std::vector<glm::vec3> yPlanes;
+	std::vector<float> depths;
+	// Lights, and the ranges of columns, rows and slices they overlap
+	std::vector<glm::vec4> lights;
+	std::vector<glm::ivec4> tileRanges;
+	std::vector<glm::ivec2> sliceRanges;
+	// Per cluster offset and count into indices
+	std::vector<int> clusters;
+	std::vector<int> indices;
+
+	GLuint lightBufID;
+	GLuint lightTexID;
+	GLuint clusterBufID;
+	GLuint clusterTexID;
+	GLuint indexBufID;
+	GLuint indexTexID;
+};
+
+#endif
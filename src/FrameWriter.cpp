@@ -0,0 +1,187 @@
+#include "FrameWriter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "stb_image_write.h"
+
+#include "GLSL.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+FrameWriter::FrameWriter() :
+	ringSize(3),
+	async(false),
+	maxQueued(0),
+	next(0),
+	inFlight(0),
+	queued(0),
+	failed(0)
+{
+}
+
+FrameWriter::~FrameWriter()
+{
+}
+
+void FrameWriter::init(int nEncoders, bool readback)
+{
+	encoders = make_shared<ThreadPool>(nEncoders);
+	maxQueued = 2*encoders->size();
+	if(!readback) {
+		return;
+	}
+	async = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+	if(!async) {
+		cout << "Sync objects not supported, reading frames synchronously" << endl;
+		return;
+	}
+	ring.resize(max(1, ringSize));
+	for(auto &slot : ring) {
+		glGenBuffers(1, &slot.bufID);
+		slot.bufSize = 0;
+		slot.fence = 0;
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void FrameWriter::throttle()
+{
+	unique_lock<std::mutex> lock(mutex);
+	encoded.wait(lock, [this] { return queued < maxQueued; });
+}
+
+void FrameWriter::capture(const string &filename, int width, int height)
+{
+	// Don't let the encoders fall too far behind
+	throttle();
+
+	// RGBA rows are always aligned, and are the format drivers read fastest
+	size_t size = (size_t)4*width*height;
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	if(!async) {
+		vector<unsigned char> pixels(size);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		encode(filename, width, height, pixels);
+		return;
+	}
+
+	poll();
+	if(inFlight == (int)ring.size()) {
+		// Every buffer is in flight, so the oldest one has to be waited for
+		retire(ring[(next - inFlight + ring.size()) % ring.size()]);
+		inFlight--;
+	}
+	Slot &slot = ring[next];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.bufID);
+	if(slot.bufSize != size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		slot.bufSize = size;
+	}
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.filename = filename;
+	slot.width = width;
+	slot.height = height;
+	next = (next + 1) % ring.size();
+	inFlight++;
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void FrameWriter::write(const string &filename, int width, int height, vector<unsigned char> &rgba)
+{
+	throttle();
+	encode(filename, width, height, rgba);
+}
+
+void FrameWriter::poll()
+{
+	// Readbacks finish in order, so stop at the first one that hasn't
+	while(inFlight > 0) {
+		Slot &slot = ring[(next - inFlight + ring.size()) % ring.size()];
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break;
+		}
+		retire(slot);
+		inFlight--;
+	}
+}
+
+void FrameWriter::retire(Slot &slot)
+{
+	// Flush the first time, so that the fence is sure to signal
+	GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	while(status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(slot.fence, 0, 1000000000);
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	// The mapping can't outlive this call, as only this thread may unmap it
+	vector<unsigned char> pixels(slot.bufSize);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.bufID);
+	void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.bufSize, GL_MAP_READ_BIT);
+	if(data) {
+		memcpy(pixels.data(), data, slot.bufSize);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		cerr << "Couldn't map the pixels of " << slot.filename << endl;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+	if(data) {
+		encode(slot.filename, slot.width, slot.height, pixels);
+	} else {
+		lock_guard<std::mutex> lock(mutex);
+		failed++;
+	}
+}
+
+void FrameWriter::encode(const string &filename, int width, int height, vector<unsigned char> &pixels)
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		queued++;
+	}
+	auto rgba = make_shared< vector<unsigned char> >();
+	rgba->swap(pixels);
+	encoders->submit([this, filename, width, height, rgba]() {
+		// Drop the alpha and flip the rows, since OpenGL's go bottom up
+		vector<unsigned char> rgb((size_t)3*width*height);
+		for(int y = 0; y < height; y++) {
+			const unsigned char *src = &(*rgba)[(size_t)4*width*(height - 1 - y)];
+			unsigned char *dst = &rgb[(size_t)3*width*y];
+			for(int x = 0; x < width; x++) {
+				dst[3*x] = src[4*x];
+				dst[3*x+1] = src[4*x+1];
+				dst[3*x+2] = src[4*x+2];
+			}
+		}
+		int rc = stbi_write_png(filename.c_str(), width, height, 3, rgb.data(), 3*width);
+		ostringstream msg;
+		msg << (rc ? "Wrote to " : "Couldn't write to ") << filename << endl;
+		cout << msg.str();
+		lock_guard<std::mutex> lock(mutex);
+		queued--;
+		if(!rc) {
+			failed++;
+		}
+		encoded.notify_all();
+	});
+}
+
+bool FrameWriter::finish()
+{
+	while(inFlight > 0) {
+		retire(ring[(next - inFlight + ring.size()) % ring.size()]);
+		inFlight--;
+	}
+	unique_lock<std::mutex> lock(mutex);
+	encoded.wait(lock, [this] { return queued == 0; });
+	return failed == 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+class ThreadPool;
+
+/**
+ * Writes rendered frames to PNG files without stalling the render loop.
+ * capture() starts an asynchronous glReadPixels into one of a ring of pixel
+ * pack buffers and puts a fence after it. The buffer is mapped once the
+ * fence has signaled, normally a few frames later, and the pixels are
+ * compressed and written by a pool of encoder threads.
+ * - Call poll() once per frame to hand finished readbacks to the encoders.
+ * - capture() only waits on the GPU when all buffers of the ring are still
+ *   in flight, and on the encoders when they fall maxQueued frames behind,
+ *   which bounds the memory held by queued frames.
+ * - Without sync objects, reads the pixels synchronously but still encodes
+ *   them in the background.
+ * - write() encodes pixels that are already on the CPU, and works without an
+ *   OpenGL context if init() was told not to read back.
+ */
+class FrameWriter
+{
+public:
+	FrameWriter();
+	virtual ~FrameWriter();
+	void setRingSize(int n) { ringSize = n; }
+	// Creates the pack buffers if readback is set, and nEncoders threads (one
+	// per core if 0)
+	void init(int nEncoders = 0, bool readback = true);
+	// Starts reading the current read buffer into filename
+	void capture(const std::string &filename, int width, int height);
+	// Queues RGBA pixels, bottom row first, to be written to filename. Takes
+	// the pixels, leaving rgba empty.
+	void write(const std::string &filename, int width, int height, std::vector<unsigned char> &rgba);
+	// Hands the readbacks that have finished to the encoders
+	void poll();
+	// Waits until every captured frame is written, and returns whether they
+	// all were
+	bool finish();
+
+private:
+	struct Slot
+	{
+		GLuint bufID;
+		size_t bufSize;
+		GLsync fence;
+		std::string filename;
+		int width;
+		int height;
+	};
+
+	// Waits until fewer than maxQueued frames are waiting for the encoders
+	void throttle();
+	// Maps the buffer of a slot, and queues its pixels for encoding
+	void retire(Slot &slot);
+	void encode(const std::string &filename, int width, int height, std::vector<unsigned char> &pixels);
+
+	int ringSize;
+	bool async;
+	int maxQueued;
+	std::vector<Slot> ring;
+	// Slots in flight are next - inFlight .. next - 1, modulo the ring size
+	int next;
+	int inFlight;
+	std::mutex mutex;
+	std::condition_variable encoded;
+	int queued;
+	int failed;
+	// Last, so that it is destroyed while the rest is still there
+	std::shared_ptr<ThreadPool> encoders;
+};
+
+#endif
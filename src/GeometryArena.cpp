@@ -0,0 +1,221 @@
+#include "GeometryArena.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GLSL.h"
+#include "Program.h"
+
+using namespace std;
+
+void GeometryArena::setAttributeLocations(const shared_ptr<Program> prog)
+{
+	prog->setAttributeLocation("aPos", POSITION_LOCATION);
+	prog->setAttributeLocation("aNor", NORMAL_LOCATION);
+	prog->setAttributeLocation("aTex", TEXCOORD_LOCATION);
+}
+
+int GeometryArena::floats(int format)
+{
+	const int floats[FORMATS] = {3, 6, 8};
+	return floats[format];
+}
+
+GLenum GeometryArena::glIndexType(int indexType)
+{
+	return indexType == SHORT_INDICES ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+GeometryArena::GeometryArena() :
+	vertexBufID(0),
+	boundFormat(-1),
+	boundIndexType(-1),
+	baseVertex(GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex)
+{
+	for(int f = 0; f < FORMATS; f++) {
+		vertexCounts[f] = 0;
+		for(int t = 0; t < INDEX_TYPES; t++) {
+			vertexArrayIDs[f][t] = 0;
+		}
+	}
+	for(int t = 0; t < INDEX_TYPES; t++) {
+		indexCounts[t] = 0;
+		indexBufIDs[t] = 0;
+	}
+}
+
+GeometryArena::~GeometryArena()
+{
+}
+
+// Copies n elements, to be kept by owners until upload()
+template <typename T>
+static const T *copyOf(const T *data, size_t n, vector< shared_ptr<const void> > &owners)
+{
+	auto copy = make_shared< vector<T> >(data, data + n);
+	owners.push_back(copy);
+	return copy->data();
+}
+
+// Converts n indices of one size to another, adding base to them
+template <typename To, typename From>
+static const To *convert(const From *indices, int n, int base, vector< shared_ptr<const void> > &owners)
+{
+	auto copy = make_shared< vector<To> >(n);
+	for(int i = 0; i < n; i++) {
+		(*copy)[i] = (To)(indices[i] + base);
+	}
+	owners.push_back(copy);
+	return copy->data();
+}
+
+GeometryArena::Mesh GeometryArena::add(int format, int vertexCount, const float *positions, const float *normals, const float *texcoords, const void *indices, int indexSize, int indexCount, const shared_ptr<const void> &owner)
+{
+	Mesh mesh;
+	mesh.format = format;
+	mesh.baseVertex = vertexCounts[format];
+	mesh.vertexCount = vertexCount;
+	mesh.indexCount = indexCount;
+	// Without base vertices, the indices are rebased here, and must still fit
+	int base = baseVertex ? 0 : mesh.baseVertex;
+	mesh.indexType = base + vertexCount <= 65536 ? SHORT_INDICES : INT_INDICES;
+	mesh.firstIndex = indexCounts[mesh.indexType];
+	mesh.boundsMin = glm::vec3(0.0f);
+	mesh.boundsMax = glm::vec3(0.0f);
+	for(int i = 0; i < vertexCount; i++) {
+		glm::vec3 p(positions[3*i], positions[3*i+1], positions[3*i+2]);
+		mesh.boundsMin = i == 0 ? p : glm::min(mesh.boundsMin, p);
+		mesh.boundsMax = i == 0 ? p : glm::max(mesh.boundsMax, p);
+	}
+	vertexCounts[format] += vertexCount;
+	indexCounts[mesh.indexType] += indexCount;
+
+	Arrays a;
+	a.positions = positions;
+	a.normals = format >= POSITION_NORMAL ? normals : NULL;
+	a.texcoords = format >= POSITION_NORMAL_TEXCOORD ? texcoords : NULL;
+	a.indices = indices;
+	if(owner) {
+		owners.push_back(owner);
+	} else {
+		a.positions = copyOf(a.positions, 3*vertexCount, owners);
+		a.normals = a.normals ? copyOf(a.normals, 3*vertexCount, owners) : NULL;
+		a.texcoords = a.texcoords ? copyOf(a.texcoords, 2*vertexCount, owners) : NULL;
+	}
+	if(indexSize != GeometryArena::indexSize(mesh.indexType) || base > 0) {
+		if(mesh.indexType == SHORT_INDICES) {
+			a.indices = indexSize == 2 ? convert<unsigned short>((const unsigned short *)indices, indexCount, base, owners) : convert<unsigned short>((const unsigned int *)indices, indexCount, base, owners);
+		} else {
+			a.indices = indexSize == 2 ? convert<unsigned int>((const unsigned short *)indices, indexCount, base, owners) : convert<unsigned int>((const unsigned int *)indices, indexCount, base, owners);
+		}
+	} else if(!owner) {
+		a.indices = copyOf((const char *)indices, (size_t)indexSize*indexCount, owners);
+	}
+	meshes.push_back(mesh);
+	arrays.push_back(a);
+	return mesh;
+}
+
+void GeometryArena::upload()
+{
+	if(!baseVertex) {
+		cout << "Base vertices not supported, rebasing the indices" << endl;
+	}
+
+	// The regions of the formats, one after the other, each with its arrays
+	// one after the other
+	size_t offsets[FORMATS];
+	size_t size = 0;
+	for(int f = 0; f < FORMATS; f++) {
+		offsets[f] = size;
+		size += (size_t)vertexCounts[f]*floats(f)*sizeof(float);
+	}
+	glGenBuffers(1, &vertexBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufID);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	// Not into the state of whichever vertex array is bound
+	glBindVertexArray(0);
+	glGenBuffers(INDEX_TYPES, indexBufIDs);
+	for(int t = 0; t < INDEX_TYPES; t++) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufIDs[t]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)indexCounts[t]*indexSize(t), NULL, GL_STATIC_DRAW);
+	}
+	// The first float of each array in a region, per vertex of the region.
+	// Format f has the first f + 1 arrays.
+	const int arrayStart[] = {0, 3, 6};
+	const int components[] = {3, 3, 2};
+	// For missing normals and texcoords
+	vector<float> zeros;
+	for(size_t m = 0; m < meshes.size(); m++) {
+		const Mesh &mesh = meshes[m];
+		const Arrays &a = arrays[m];
+		const float *sources[] = {a.positions, a.normals, a.texcoords};
+		for(int k = 0; k <= mesh.format; k++) {
+			size_t start = offsets[mesh.format] + ((size_t)arrayStart[k]*vertexCounts[mesh.format] + (size_t)components[k]*mesh.baseVertex)*sizeof(float);
+			size_t floatCount = (size_t)components[k]*mesh.vertexCount;
+			const float *source = sources[k];
+			if(!source) {
+				zeros.resize(max(zeros.size(), floatCount), 0.0f);
+				source = zeros.data();
+			}
+			glBufferSubData(GL_ARRAY_BUFFER, start, floatCount*sizeof(float), source);
+		}
+		int s = indexSize(mesh.indexType);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufIDs[mesh.indexType]);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (size_t)mesh.firstIndex*s, (size_t)mesh.indexCount*s, a.indices);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// The index buffer is part of the vertex array state
+	glGenVertexArrays(FORMATS*INDEX_TYPES, &vertexArrayIDs[0][0]);
+	for(int f = 0; f < FORMATS; f++) {
+		for(int t = 0; t < INDEX_TYPES; t++) {
+			glBindVertexArray(vertexArrayIDs[f][t]);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufIDs[t]);
+			const GLuint locations[] = {POSITION_LOCATION, NORMAL_LOCATION, TEXCOORD_LOCATION};
+			for(int k = 0; k <= f; k++) {
+				size_t start = offsets[f] + (size_t)arrayStart[k]*vertexCounts[f]*sizeof(float);
+				glEnableVertexAttribArray(locations[k]);
+				glVertexAttribPointer(locations[k], components[k], GL_FLOAT, GL_FALSE, 0, (const void *)start);
+			}
+		}
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	boundFormat = -1;
+	boundIndexType = -1;
+	size_t indexBytes = (size_t)indexCounts[SHORT_INDICES]*2 + (size_t)indexCounts[INT_INDICES]*4;
+	cout << "Geometry arena: " << meshes.size() << " meshes, " << size/1024 << " KB of vertices, " << indexBytes/1024 << " KB of indices (";
+	cout << indexCounts[SHORT_INDICES] << " 16-bit, " << indexCounts[INT_INDICES] << " 32-bit)" << endl;
+
+	vector<Arrays>().swap(arrays);
+	vector< shared_ptr<const void> >().swap(owners);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void GeometryArena::bind(int format, int indexType)
+{
+	if(format != boundFormat || indexType != boundIndexType) {
+		glBindVertexArray(vertexArrayIDs[format][indexType]);
+		boundFormat = format;
+		boundIndexType = indexType;
+	}
+}
+
+void GeometryArena::draw(const Mesh &mesh, int instances)
+{
+	bind(mesh);
+	GLenum type = glIndexType(mesh.indexType);
+	const void *first = (const void *)((size_t)mesh.firstIndex*indexSize(mesh.indexType));
+	if(!baseVertex) {
+		if(instances > 0) {
+			glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, type, first, instances);
+		} else {
+			glDrawElements(GL_TRIANGLES, mesh.indexCount, type, first);
+		}
+	} else if(instances > 0) {
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, type, first, instances, mesh.baseVertex);
+	} else {
+		glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, type, first, mesh.baseVertex);
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <memory>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Program;
+
+/**
+ * The static meshes, packed into one vertex buffer and two index buffers.
+ * - The vertices are grouped by format into one region of the vertex buffer
+ *   per format. A region holds the positions of all of its meshes, then
+ *   their normals, then their texcoords, so that the arrays of a mesh (e.g.
+ *   the sections of a MeshCache) are uploaded as they are, without being
+ *   interleaved.
+ * - The indices of a mesh with at most 65536 vertices are 16-bit, and the
+ *   others 32-bit, in their own index buffer. There is one vertex array
+ *   object per format and index type. A mesh is drawn with its base vertex
+ *   in its region and its first index, so switching meshes of the same
+ *   format and index type binds nothing.
+ * - add() the meshes, then upload() them once.
+ * - The vertex attributes have fixed locations, so every program drawing
+ *   meshes must be set up with setAttributeLocations() before Program::init().
+ * - The vertex array of the last draw stays bound. Per-instance attributes
+ *   (see Instances) must be bound after bind() and unbound before the next
+ *   vertex array is bound.
+ */
+class GeometryArena
+{
+public:
+	enum Format
+	{
+		POSITION,
+		POSITION_NORMAL,
+		POSITION_NORMAL_TEXCOORD,
+		FORMATS
+	};
+	enum IndexType
+	{
+		SHORT_INDICES,
+		INT_INDICES,
+		INDEX_TYPES
+	};
+	enum Location
+	{
+		POSITION_LOCATION = 0,
+		NORMAL_LOCATION = 1,
+		TEXCOORD_LOCATION = 2
+	};
+	// Where a mesh is in the arena
+	struct Mesh
+	{
+		int format;
+		int indexType;
+		// In the region of the format, and the index buffer of the index type
+		int baseVertex;
+		int vertexCount;
+		int firstIndex;
+		int indexCount;
+		// Bounding box of the positions, in object space
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+	};
+
+	// Binds aPos, aNor and aTex to their locations. Must come before init().
+	static void setAttributeLocations(const std::shared_ptr<Program> prog);
+
+	// Reads the GLEW extension flags, so must come after glewInit()
+	GeometryArena();
+	virtual ~GeometryArena();
+	// Adds a mesh. normals and texcoords are ignored if the format doesn't
+	// have them, and zeros if they are NULL. indexSize is 2 or 4. The arrays
+	// are copied, unless owner is given: then they are read by upload(), and
+	// owner is kept until then. Indices of the wrong size are copied anyway.
+	// Doesn't need an OpenGL context.
+	Mesh add(int format, int vertexCount, const float *positions, const float *normals, const float *texcoords, const void *indices, int indexSize, int indexCount, const std::shared_ptr<const void> &owner = nullptr);
+	// Uploads the meshes added so far, and lets go of their arrays
+	void upload();
+	// Binds the vertex array of a format and index type, unless it is bound
+	// already
+	void bind(int format, int indexType);
+	void bind(const Mesh &mesh) { bind(mesh.format, mesh.indexType); }
+	// If instances > 0, draws that many instances
+	void draw(const Mesh &mesh, int instances = 0);
+	GLuint getVertexBuffer() const { return vertexBufID; }
+	GLuint getIndexBuffer(int indexType) const { return indexBufIDs[indexType]; }
+	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	static GLenum glIndexType(int indexType);
+	static int indexSize(int indexType) { return indexType == SHORT_INDICES ? 2 : 4; }
+	// Floats per vertex of a format
+	static int floats(int format);
+
+private:
+	// The arrays of a mesh, until upload()
+	struct Arrays
+	{
+		const float *positions;
+		const float *normals;
+		const float *texcoords;
+		const void *indices;
+	};
+
+	std::vector<Mesh> meshes;
+	std::vector<Arrays> arrays;
+	// The copies, and the owners of the arrays that weren't copied
+	std::vector< std::shared_ptr<const void> > owners;
+	int vertexCounts[FORMATS];
+	int indexCounts[INDEX_TYPES];
+	GLuint vertexBufID;
+	GLuint indexBufIDs[INDEX_TYPES];
+	GLuint vertexArrayIDs[FORMATS][INDEX_TYPES];
+	int boundFormat;
+	int boundIndexType;
+	// Without glDrawElementsBaseVertex, the base vertices are added to the
+	// indices when they are added, and 16-bit indices are only used if they
+	// still fit
+	bool baseVertex;
+};
+
+#endif
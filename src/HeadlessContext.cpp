@@ -0,0 +1,144 @@
+#include "HeadlessContext.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace std;
+
+HeadlessContext::HeadlessContext() :
+	display(NULL),
+	context(NULL),
+	surface(NULL)
+{
+}
+
+HeadlessContext::~HeadlessContext()
+{
+	destroy();
+}
+
+#ifdef HAVE_EGL
+
+// Whether the space-separated list has the extension
+static bool hasExtension(const char *extensions, const char *name)
+{
+	if(!extensions) {
+		return false;
+	}
+	size_t len = strlen(name);
+	for(const char *p = strstr(extensions, name); p; p = strstr(p + len, name)) {
+		if((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HeadlessContext::init()
+{
+	// Client extensions are queried without a display
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	EGLDisplay dpy = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	if(hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if(getPlatformDisplay) {
+			dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		}
+	}
+#endif
+	if(dpy == EGL_NO_DISPLAY) {
+		dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if(dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+		cerr << "Failed to initialize EGL" << endl;
+		return false;
+	}
+	display = dpy;
+	cout << "EGL version: " << major << "." << minor << " (" << eglQueryString(dpy, EGL_VENDOR) << ")" << endl;
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		cerr << "EGL doesn't support desktop OpenGL" << endl;
+		return false;
+	}
+
+	// Prefer a config with pbuffers, in case surfaceless contexts aren't
+	// supported. The colors and depth are in framebuffer objects anyway.
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint nConfigs = 0;
+	if(!eglChooseConfig(dpy, configAttribs, &config, 1, &nConfigs) || nConfigs == 0) {
+		configAttribs[1] = 0;
+		if(!eglChooseConfig(dpy, configAttribs, &config, 1, &nConfigs) || nConfigs == 0) {
+			cerr << "No EGL config for OpenGL" << endl;
+			return false;
+		}
+	}
+
+	// Without a version, this is the highest compatibility profile version,
+	// like the contexts GLFW creates by default
+	EGLint contextAttribs[] = {EGL_NONE};
+	EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, contextAttribs);
+	if(ctx == EGL_NO_CONTEXT) {
+		cerr << "Failed to create an EGL context" << endl;
+		return false;
+	}
+	context = ctx;
+
+	EGLSurface surf = EGL_NO_SURFACE;
+	if(!hasExtension(eglQueryString(dpy, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+		EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+		surf = eglCreatePbufferSurface(dpy, config, pbufferAttribs);
+		if(surf == EGL_NO_SURFACE) {
+			cerr << "Failed to create an EGL pbuffer" << endl;
+			return false;
+		}
+		surface = surf;
+	}
+	if(!eglMakeCurrent(dpy, surf, surf, ctx)) {
+		cerr << "Failed to make the EGL context current" << endl;
+		return false;
+	}
+	return true;
+}
+
+void HeadlessContext::destroy()
+{
+	if(!display) {
+		return;
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if(surface) {
+		eglDestroySurface(display, surface);
+	}
+	if(context) {
+		eglDestroyContext(display, context);
+	}
+	eglTerminate(display);
+	display = NULL;
+	context = NULL;
+	surface = NULL;
+}
+
+#else
+
+bool HeadlessContext::init()
+{
+	cerr << "Headless rendering needs EGL, which this build doesn't have" << endl;
+	return false;
+}
+
+void HeadlessContext::destroy()
+{
+}
+
+#endif
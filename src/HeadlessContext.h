@@ -0,0 +1,31 @@
+#pragma once
+#ifndef HEADLESSCONTEXT_H
+#define HEADLESSCONTEXT_H
+
+/**
+ * An OpenGL context without a window or display server, through EGL.
+ * Mesa's surfaceless platform is used when available, so that the context
+ * also works on machines without a GPU (with llvmpipe), and the default
+ * display otherwise. The context has no framebuffer of its own, so
+ * everything must be rendered into framebuffer objects.
+ * - Only available when built with HAVE_EGL; init() fails otherwise.
+ */
+class HeadlessContext
+{
+public:
+	HeadlessContext();
+	virtual ~HeadlessContext();
+	// Creates the context and makes it current
+	bool init();
+	void destroy();
+
+private:
+	HeadlessContext(const HeadlessContext &) = delete;
+	HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+	void *display;
+	void *context;
+	void *surface;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "ImageDiff.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "stb_image.h"
+
+using namespace std;
+
+ImageDiff::ImageDiff() :
+	read(false),
+	pixels(0),
+	maxDiff(0),
+	meanDiff(0.0),
+	outliers(0),
+	perceptual(0)
+{
+}
+
+// Squared difference between two colors in the YIQ space, weighted by how
+// well they are perceived. It is 35215 between black and white.
+static float colorDelta(const unsigned char *a, const unsigned char *b)
+{
+	float dr = (float)a[0] - b[0];
+	float dg = (float)a[1] - b[1];
+	float db = (float)a[2] - b[2];
+	float y = dr*0.29889531f + dg*0.58662247f + db*0.11448223f;
+	float i = dr*0.59597799f - dg*0.27417610f - db*0.32180189f;
+	float q = dr*0.21147017f - dg*0.52261711f + db*0.31114694f;
+	return 0.5053f*y*y + 0.299f*i*i + 0.1957f*q*q;
+}
+
+ImageDiff ImageDiff::compare(const string &imageName, const string &referenceName, int tolerance, float threshold)
+{
+	ImageDiff d;
+	int w0, h0, w1, h1, c;
+	unsigned char *image = stbi_load(imageName.c_str(), &w0, &h0, &c, 3);
+	unsigned char *reference = stbi_load(referenceName.c_str(), &w1, &h1, &c, 3);
+	if(!image || !reference) {
+		cout << "Couldn't read " << (image ? referenceName : imageName) << endl;
+	} else if(w0 != w1 || h0 != h1) {
+		cout << "Image sizes differ: " << w0 << "x" << h0 << " and " << w1 << "x" << h1 << endl;
+	} else {
+		d.read = true;
+		d.pixels = w0*h0;
+		float maxDelta = 35215.0f*threshold*threshold;
+		double sumDiff = 0.0;
+		for(int i = 0; i < d.pixels; i++) {
+			int diff = 0;
+			for(int k = 0; k < 3; k++) {
+				diff = max(diff, abs((int)image[3*i+k] - (int)reference[3*i+k]));
+			}
+			d.maxDiff = max(d.maxDiff, diff);
+			sumDiff += diff;
+			d.outliers += diff > tolerance;
+			d.perceptual += colorDelta(&image[3*i], &reference[3*i]) > maxDelta;
+		}
+		d.meanDiff = sumDiff/d.pixels;
+	}
+	stbi_image_free(image);
+	stbi_image_free(reference);
+	return d;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef IMAGEDIFF_H
+#define IMAGEDIFF_H
+
+#include <string>
+
+/**
+ * How two images of the same size differ, pixel by pixel.
+ * - maxDiff and meanDiff are over the largest channel difference of each
+ *   pixel, and outliers counts the pixels where it is above a tolerance.
+ * - perceptual counts the pixels whose colors look different: those whose
+ *   difference in the YIQ space, weighted by how well it is perceived as in
+ *   pixelmatch, is above a threshold from 0 (any) to 1 (black and white).
+ */
+class ImageDiff
+{
+public:
+	ImageDiff();
+	// Compares two PNG files
+	static ImageDiff compare(const std::string &image, const std::string &reference, int tolerance, float threshold);
+
+	bool read; // Whether both images could be read, and have the same size
+	int pixels;
+	int maxDiff; // Largest channel difference
+	double meanDiff;
+	int outliers;
+	int perceptual;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "IndirectScene.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GLSL.h"
+#include "Instances.h"
+#include "Program.h"
+
+using namespace std;
+
+static_assert(sizeof(IndirectScene::Object) == 128, "Object doesn't match its std430 layout");
+static_assert(sizeof(IndirectScene::DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must be 5 integers");
+
+// Storage buffer bindings of scene_cull.glsl
+enum { OBJECT_BINDING = 0, BOUNDS_BINDING = 1, COMMAND_BINDING = 2, INSTANCE_BINDING = 3 };
+
+IndirectScene::IndirectScene() :
+	objectBufID(0),
+	boundsBufID(0),
+	commandBufID(0)
+{
+	for(int f = 0; f < GeometryArena::FORMATS; f++) {
+		for(int t = 0; t < GeometryArena::INDEX_TYPES; t++) {
+			firstCommand[f][t] = 0;
+			commandCount[f][t] = 0;
+		}
+	}
+}
+
+IndirectScene::~IndirectScene()
+{
+}
+
+bool IndirectScene::init(const string &resourceDir, const shared_ptr<GeometryArena> &arena)
+{
+	this->arena = arena;
+	if(!GLEW_VERSION_4_3) {
+		return false;
+	}
+	cullProg = make_shared<Program>();
+	cullProg->setComputeShaderName(resourceDir + "scene_cull.glsl");
+	cullProg->setVerbose(true);
+	if(!cullProg->init()) {
+		cullProg = nullptr;
+		return false;
+	}
+	U.num_objects = cullProg->addUniform("num_objects");
+	U.time = cullProg->addUniform("time");
+	U.view = cullProg->addUniform("view");
+	U.view_proj = cullProg->addUniform("view_proj");
+	cullProg->setVerbose(false);
+
+	instances = make_shared<Instances>();
+	instances->init();
+	glGenBuffers(1, &objectBufID);
+	glGenBuffers(1, &boundsBufID);
+	glGenBuffers(1, &commandBufID);
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
+
+void IndirectScene::clear()
+{
+	meshes.clear();
+	objects.clear();
+}
+
+int IndirectScene::addMesh(const GeometryArena::Mesh &mesh)
+{
+	meshes.push_back(mesh);
+	return (int)meshes.size() - 1;
+}
+
+void IndirectScene::addObject(int mesh, const glm::mat4 &local, const glm::vec3 &translation, int animation, const glm::vec3 &ka, const glm::vec3 &kd)
+{
+	Object object;
+	object.local = local;
+	object.translation = glm::vec4(translation, 1.0f);
+	object.ka = glm::vec4(ka, 0.0f);
+	object.kd = glm::vec4(kd, 0.0f);
+	object.info = glm::ivec4(mesh, animation, 0, 0);
+	objects.push_back(object);
+}
+
+void IndirectScene::upload()
+{
+	// One command per mesh, those of a format and index type next to each
+	// other
+	vector<int> order(meshes.size());
+	for(size_t i = 0; i < order.size(); i++) {
+		order[i] = (int)i;
+	}
+	stable_sort(order.begin(), order.end(), [this](int a, int b) {
+		const GeometryArena::Mesh &ma = meshes[a];
+		const GeometryArena::Mesh &mb = meshes[b];
+		return ma.format < mb.format || (ma.format == mb.format && ma.indexType < mb.indexType);
+	});
+	vector<int> commandOf(meshes.size());
+	for(size_t c = 0; c < order.size(); c++) {
+		commandOf[order[c]] = (int)c;
+	}
+	vector<int> objectsOf(meshes.size(), 0);
+	for(Object &object : objects) {
+		objectsOf[object.info.x]++;
+		object.info.x = commandOf[object.info.x];
+	}
+
+	// The instances of a mesh's visible objects go into its own range of the
+	// instance buffer, big enough for all of its objects
+	commands.resize(meshes.size());
+	vector<glm::vec4> bounds(2*meshes.size());
+	GLuint baseInstance = 0;
+	for(int f = 0; f < GeometryArena::FORMATS; f++) {
+		for(int t = 0; t < GeometryArena::INDEX_TYPES; t++) {
+			commandCount[f][t] = 0;
+		}
+	}
+	for(size_t c = 0; c < order.size(); c++) {
+		const GeometryArena::Mesh &mesh = meshes[order[c]];
+		DrawElementsIndirectCommand &cmd = commands[c];
+		cmd.count = mesh.indexCount;
+		cmd.instanceCount = 0;
+		cmd.firstIndex = mesh.firstIndex;
+		cmd.baseVertex = mesh.baseVertex;
+		cmd.baseInstance = baseInstance;
+		baseInstance += objectsOf[order[c]];
+		bounds[2*c] = glm::vec4(0.5f*(mesh.boundsMin + mesh.boundsMax), 1.0f);
+		bounds[2*c+1] = glm::vec4(0.5f*(mesh.boundsMax - mesh.boundsMin), 0.0f);
+		if(commandCount[mesh.format][mesh.indexType]++ == 0) {
+			firstCommand[mesh.format][mesh.indexType] = (int)c;
+		}
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBufID);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size()*sizeof(Object), objects.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBufID);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size()*sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufID);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size()*sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	instances->allocate((int)objects.size());
+	cout << "GPU-driven scene: " << objects.size() << " objects, " << commands.size() << " draw commands" << endl;
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void IndirectScene::cull(const glm::mat4 &P, const glm::mat4 &V, float time)
+{
+	if(objects.empty()) {
+		return;
+	}
+	// No instances until the shader counts them
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufID);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size()*sizeof(DrawElementsIndirectCommand), commands.data());
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	cullProg->bind();
+	glUniform1i(cullProg->getUniform(U.num_objects), (int)objects.size());
+	glUniform1f(cullProg->getUniform(U.time), time);
+	glUniformMatrix4fv(cullProg->getUniform(U.view), 1, GL_FALSE, glm::value_ptr(V));
+	glUniformMatrix4fv(cullProg->getUniform(U.view_proj), 1, GL_FALSE, glm::value_ptr(P*V));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_BINDING, objectBufID);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDS_BINDING, boundsBufID);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, commandBufID);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, instances->getBuffer());
+	glDispatchCompute(((GLuint)objects.size() + 63)/64, 1, 1);
+	cullProg->unbind();
+	// The draws read the commands and the instances the shader wrote
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void IndirectScene::draw(int format, const shared_ptr<Program> prog)
+{
+	for(int t = 0; t < GeometryArena::INDEX_TYPES; t++) {
+		if(commandCount[format][t] == 0) {
+			continue;
+		}
+		// The instance attributes go into the vertex array of the format and
+		// index type
+		arena->bind(format, t);
+		instances->bind(prog);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufID);
+		const void *first = (const void *)(firstCommand[format][t]*sizeof(DrawElementsIndirectCommand));
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GeometryArena::glIndexType(t), first, commandCount[format][t], 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		instances->unbind(prog);
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#ifndef INDIRECTSCENE_H
+#define INDIRECTSCENE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "GeometryArena.h"
+#include "Program.h"
+
+class Instances;
+
+/**
+ * The objects of the scene, drawn without the CPU touching them per frame.
+ * - The objects are uploaded once, with their placement, animation, mesh
+ *   and colors. Every frame, a compute shader (scene_cull.glsl) animates
+ *   them, culls their bounding boxes against the view frustum, and appends
+ *   the visible ones to the instances of their mesh, counting them in the
+ *   mesh's indirect draw command.
+ * - draw() then draws all meshes of a format with one
+ *   glMultiDrawElementsIndirect() per index type, reading the instances
+ *   through the same attributes as Instances.
+ * - The world matrix of an object is T(translation)*A(time)*local, with A
+ *   one of the animations of SceneStore.
+ * - Needs OpenGL 4.3, for compute shaders, storage buffers and multi-draw
+ *   indirect.
+ */
+class IndirectScene
+{
+public:
+	// std430 layout, see scene_cull.glsl
+	struct Object
+	{
+		glm::mat4 local;
+		glm::vec4 translation;
+		glm::vec4 ka;
+		glm::vec4 kd;
+		// Mesh and animation
+		glm::ivec4 info;
+	};
+	// The layout glMultiDrawElementsIndirect() reads
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	IndirectScene();
+	virtual ~IndirectScene();
+	// Returns false if the GPU can't do it
+	bool init(const std::string &resourceDir, const std::shared_ptr<GeometryArena> &arena);
+	// Returns the index of the mesh for addObject()
+	int addMesh(const GeometryArena::Mesh &mesh);
+	// Removes the meshes and objects, to add and upload them again
+	void clear();
+	// animation is a SceneStore::Animation
+	void addObject(int mesh, const glm::mat4 &local, const glm::vec3 &translation, int animation, const glm::vec3 &ka, const glm::vec3 &kd);
+	int getObjectCount() const { return (int)objects.size(); }
+	// Uploads the meshes and objects added so far
+	void upload();
+	// Animates and culls the objects, and writes the draw commands
+	void cull(const glm::mat4 &P, const glm::mat4 &V, float time);
+	// Draws the visible objects whose mesh has this format. prog must have the
+	// attributes of Instances, and be bound.
+	void draw(int format, const std::shared_ptr<Program> prog);
+
+private:
+	std::shared_ptr<GeometryArena> arena;
+	std::shared_ptr<Program> cullProg;
+	// Handles of the uniforms of cullProg
+	struct CullUniforms
+	{
+		Program::Uniform num_objects;
+		Program::Uniform time;
+		Program::Uniform view;
+		Program::Uniform view_proj;
+	};
+	CullUniforms U;
+	std::shared_ptr<Instances> instances;
+	std::vector<GeometryArena::Mesh> meshes;
+	std::vector<Object> objects;
+	// One per mesh, sorted by format and index type, with no instances
+	std::vector<DrawElementsIndirectCommand> commands;
+	// The commands of a format and index type are
+	// [firstCommand, firstCommand + commandCount)
+	int firstCommand[GeometryArena::FORMATS][GeometryArena::INDEX_TYPES];
+	int commandCount[GeometryArena::FORMATS][GeometryArena::INDEX_TYPES];
+	GLuint objectBufID;
+	GLuint boundsBufID;
+	GLuint commandBufID;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "Instances.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "GLSL.h"
+#include "Program.h"
+#include "Transform.h"
+
+using namespace std;
+
+// Handles of the per-instance attributes, see Program::attribute()
+static const Program::Attribute iMV = Program::attribute("iMV");
+static const Program::Attribute iIT = Program::attribute("iIT");
+static const Program::Attribute iKa = Program::attribute("iKa");
+static const Program::Attribute iKd = Program::attribute("iKd");
+static const Program::Attribute iKs = Program::attribute("iKs");
+static const Program::Attribute iS = Program::attribute("iS");
+
+Instances::Instances() :
+	bufID(0),
+	bufSize(0)
+{
+}
+
+Instances::~Instances()
+{
+}
+
+void Instances::init()
+{
+	glGenBuffers(1, &bufID);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void Instances::add(const glm::mat4 &MV, const glm::vec3 &ka, const glm::vec3 &kd, const glm::vec3 &ks, float s)
+{
+	add(MV, Transform::affineNormalMatrix(MV), ka, kd, ks, s);
+}
+
+void Instances::add(const glm::mat4 &MV, const glm::mat4 &IT, const glm::vec3 &ka, const glm::vec3 &kd, const glm::vec3 &ks, float s)
+{
+	InstanceData inst;
+	inst.MV = MV;
+	inst.IT = IT;
+	inst.ka = ka;
+	inst.kd = kd;
+	inst.ks = ks;
+	inst.s = s;
+	data.push_back(inst);
+}
+
+void Instances::upload()
+{
+	size_t size = data.size()*sizeof(InstanceData);
+	glBindBuffer(GL_ARRAY_BUFFER, bufID);
+	bufSize = max(bufSize, size);
+	// Orphan the previous frame's storage so that we don't wait on it
+	glBufferData(GL_ARRAY_BUFFER, bufSize, NULL, GL_STREAM_DRAW);
+	if(size > 0) {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, &data[0]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void Instances::allocate(int count)
+{
+	data.clear();
+	bufSize = count*sizeof(InstanceData);
+	glBindBuffer(GL_ARRAY_BUFFER, bufID);
+	glBufferData(GL_ARRAY_BUFFER, bufSize, NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+// Points the attribute (and the following ones for matrices) at a field of InstanceData
+static void bindAttribute(GLint h, int cols, int rows, size_t offset)
+{
+	if(h == -1) {
+		return;
+	}
+	for(int c = 0; c < cols; c++) {
+		glEnableVertexAttribArray(h+c);
+		glVertexAttribPointer(h+c, rows, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (const void *)(offset + c*rows*sizeof(float)));
+		glVertexAttribDivisor(h+c, 1);
+	}
+}
+
+static void unbindAttribute(GLint h, int cols)
+{
+	if(h == -1) {
+		return;
+	}
+	for(int c = 0; c < cols; c++) {
+		// The divisor is not part of the program, so reset it for other draws
+		glVertexAttribDivisor(h+c, 0);
+		glDisableVertexAttribArray(h+c);
+	}
+}
+
+void Instances::bind(const shared_ptr<Program> prog) const
+{
+	glBindBuffer(GL_ARRAY_BUFFER, bufID);
+	bindAttribute(prog->getAttribute(iMV), 4, 4, offsetof(InstanceData, MV));
+	bindAttribute(prog->getAttribute(iIT), 4, 4, offsetof(InstanceData, IT));
+	bindAttribute(prog->getAttribute(iKa), 1, 3, offsetof(InstanceData, ka));
+	bindAttribute(prog->getAttribute(iKd), 1, 3, offsetof(InstanceData, kd));
+	bindAttribute(prog->getAttribute(iKs), 1, 3, offsetof(InstanceData, ks));
+	bindAttribute(prog->getAttribute(iS), 1, 1, offsetof(InstanceData, s));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void Instances::unbind(const shared_ptr<Program> prog) const
+{
+	unbindAttribute(prog->getAttribute(iMV), 4);
+	unbindAttribute(prog->getAttribute(iIT), 4);
+	unbindAttribute(prog->getAttribute(iKa), 1);
+	unbindAttribute(prog->getAttribute(iKd), 1);
+	unbindAttribute(prog->getAttribute(iKs), 1);
+	unbindAttribute(prog->getAttribute(iS), 1);
+	GLSL::checkError(GET_FILE_LINE);
+}
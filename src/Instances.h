@@ -0,0 +1,61 @@
+#pragma once
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include <memory>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Program;
+
+/**
+ * Per-instance data of an instanced draw. The vertex shader reads these
+ * through attributes with a divisor of 1.
+ */
+struct InstanceData
+{
+	glm::mat4 MV;
+	glm::mat4 IT;
+	glm::vec3 ka;
+	glm::vec3 kd;
+	glm::vec3 ks;
+	float s;
+};
+
+/**
+ * A list of instances of one mesh, streamed to the GPU every frame.
+ * - add() the instances, upload(), then bind() before drawing the mesh with
+ *   the number of instances, and unbind() afterwards.
+ * - Or allocate() room for instances the GPU writes into getBuffer() (see
+ *   IndirectScene), and bind() it the same way.
+ * - The program must have the attributes iMV, iIT, iKa, iKd, iKs and iS
+ *   (any of them may be inactive).
+ */
+class Instances
+{
+public:
+	Instances();
+	virtual ~Instances();
+	void init();
+	void clear() { data.clear(); }
+	// MV must be affine
+	void add(const glm::mat4 &MV, const glm::vec3 &ka, const glm::vec3 &kd, const glm::vec3 &ks, float s);
+	// With the inverse transpose of MV already computed
+	void add(const glm::mat4 &MV, const glm::mat4 &IT, const glm::vec3 &ka, const glm::vec3 &kd, const glm::vec3 &ks, float s);
+	int size() const { return (int)data.size(); }
+	void upload();
+	// Makes room for count instances, without uploading any
+	void allocate(int count);
+	unsigned getBuffer() const { return bufID; }
+	void bind(const std::shared_ptr<Program> prog) const;
+	void unbind(const std::shared_ptr<Program> prog) const;
+
+private:
+	std::vector<InstanceData> data;
+	unsigned bufID;
+	size_t bufSize;
+};
+
+#endif
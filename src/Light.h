@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cmath>
+#include <algorithm>
 #include <glm/glm.hpp>
 
+// Attenuation of the lighting shaders: 1/(1 + ATTEN_LINEAR*d + ATTEN_QUADRATIC*d^2)
+#define ATTEN_LINEAR 0.0429f
+#define ATTEN_QUADRATIC 0.9857f
+
 class Light 
 {
 	public:
@@ -10,4 +16,16 @@ class Light
 		Light() : position(0.0), color(0.0) {};
 		Light(glm::vec3 pos, glm::vec3 col) : position(pos), color(col) {};
 		void setPos(glm::vec3 newPos) { position = newPos; };
+		// Distance beyond which the attenuated brightest channel of col is
+		// below threshold
+		static float cutoffRadius(const glm::vec3 &col, float threshold)
+		{
+			float c = std::max(col.r, std::max(col.g, col.b));
+			if(c <= threshold) {
+				return 0.0f;
+			}
+			// Solve ATTEN_QUADRATIC*d^2 + ATTEN_LINEAR*d + 1 - c/threshold = 0
+			float disc = ATTEN_LINEAR*ATTEN_LINEAR - 4.0f*ATTEN_QUADRATIC*(1.0f - c/threshold);
+			return (-ATTEN_LINEAR + std::sqrt(disc)) / (2.0f*ATTEN_QUADRATIC);
+		};
 };
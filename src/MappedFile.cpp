@@ -0,0 +1,113 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile() :
+	ptr(NULL),
+	len(0)
+#ifdef _WIN32
+	, file(INVALID_HANDLE_VALUE),
+	mapping(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const string &filename)
+{
+	close();
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	len = (size_t)size.QuadPart;
+	// Empty files can't be mapped
+	if(len > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping) {
+			ptr = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+		if(!ptr) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(ptr) {
+		UnmapViewOfFile(ptr);
+	}
+	if(mapping) {
+		CloseHandle(mapping);
+	}
+	if(file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+	ptr = NULL;
+	len = 0;
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+}
+
+#else
+
+bool MappedFile::open(const string &filename)
+{
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	len = (size_t)st.st_size;
+	// Empty files can't be mapped. The mapping stays valid after the file
+	// is closed.
+	if(len > 0) {
+		void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED) {
+			len = 0;
+			::close(fd);
+			return false;
+		}
+		ptr = (const char *)p;
+	}
+	::close(fd);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(ptr) {
+		munmap((void *)ptr, len);
+	}
+	ptr = NULL;
+	len = 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * A read-only memory mapping of a whole file.
+ */
+class MappedFile
+{
+public:
+	MappedFile();
+	virtual ~MappedFile();
+	// Maps the file, and returns whether it could be opened
+	bool open(const std::string &filename);
+	void close();
+	const char *data() const { return ptr; }
+	size_t size() const { return len; }
+
+private:
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const char *ptr;
+	size_t len;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+};
+
+#endif
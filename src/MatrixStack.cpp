@@ -8,43 +8,114 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "Simd.h"
+
 using namespace std;
 
+// The columns of the matrices, as SSE registers if Simd.h found SSE2 or AVX2,
+// or as glm vectors otherwise. The kernels below add the terms in the same
+// order as glm's products, so that they give the same bits, as long as the
+// compiler doesn't fuse products and sums into FMAs. With USE_AVX2, this file
+// and the check are built with -ffp-contract=off for that.
+#if SIMD_WIDTH >= 4
+typedef __m128 Column;
+static inline Column load(const glm::vec4 &v) { return _mm_loadu_ps(&v[0]); }
+static inline void store(glm::vec4 &v, Column c) { _mm_storeu_ps(&v[0], c); }
+static inline Column add(Column a, Column b) { return _mm_add_ps(a, b); }
+static inline Column sub(Column a, Column b) { return _mm_sub_ps(a, b); }
+static inline Column mul(Column a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+#else
+typedef glm::vec4 Column;
+static inline Column load(const glm::vec4 &v) { return v; }
+static inline void store(glm::vec4 &v, Column c) { v = c; }
+static inline Column add(Column a, Column b) { return a + b; }
+static inline Column sub(Column a, Column b) { return a - b; }
+static inline Column mul(Column a, float s) { return a*s; }
+#endif
+
+// r = a*b. r may be a or b.
+static void multiply(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &r)
+{
+#if SIMD_WIDTH == 8
+	// Two columns of r at a time, each half of a register computing one from
+	// the same columns of a
+	__m256 a0 = _mm256_broadcast_ps((const __m128 *)&a[0][0]);
+	__m256 a1 = _mm256_broadcast_ps((const __m128 *)&a[1][0]);
+	__m256 a2 = _mm256_broadcast_ps((const __m128 *)&a[2][0]);
+	__m256 a3 = _mm256_broadcast_ps((const __m128 *)&a[3][0]);
+	__m256 b01 = _mm256_loadu_ps(&b[0][0]);
+	__m256 b23 = _mm256_loadu_ps(&b[2][0]);
+	__m256 r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(a1, _mm256_permute_ps(b01, 0x55)));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(a2, _mm256_permute_ps(b01, 0xAA)));
+	r01 = _mm256_add_ps(r01, _mm256_mul_ps(a3, _mm256_permute_ps(b01, 0xFF)));
+	__m256 r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(a1, _mm256_permute_ps(b23, 0x55)));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(a2, _mm256_permute_ps(b23, 0xAA)));
+	r23 = _mm256_add_ps(r23, _mm256_mul_ps(a3, _mm256_permute_ps(b23, 0xFF)));
+	_mm256_storeu_ps(&r[0][0], r01);
+	_mm256_storeu_ps(&r[2][0], r23);
+#elif SIMD_WIDTH == 4
+	__m128 a0 = load(a[0]);
+	__m128 a1 = load(a[1]);
+	__m128 a2 = load(a[2]);
+	__m128 a3 = load(a[3]);
+	__m128 rc[4];
+	for(int c = 0; c < 4; c++) {
+		__m128 bc = load(b[c]);
+		__m128 x = _mm_mul_ps(a0, _mm_shuffle_ps(bc, bc, 0x00));
+		x = _mm_add_ps(x, _mm_mul_ps(a1, _mm_shuffle_ps(bc, bc, 0x55)));
+		x = _mm_add_ps(x, _mm_mul_ps(a2, _mm_shuffle_ps(bc, bc, 0xAA)));
+		x = _mm_add_ps(x, _mm_mul_ps(a3, _mm_shuffle_ps(bc, bc, 0xFF)));
+		rc[c] = x;
+	}
+	for(int c = 0; c < 4; c++) {
+		store(r[c], rc[c]);
+	}
+#else
+	r = a*b;
+#endif
+}
+
 MatrixStack::MatrixStack()
 {
-	mstack = make_shared< stack<glm::mat4> >();
-	mstack->push(glm::mat4(1.0));
+	clear();
 }
 
 MatrixStack::~MatrixStack()
 {
 }
 
+void MatrixStack::clear()
+{
+	top = 0;
+	mstack[0] = glm::mat4(1.0);
+}
+
 void MatrixStack::pushMatrix()
 {
-	const glm::mat4 &top = mstack->top();
-	mstack->push(top);
-	assert(mstack->size() < 100);
+	assert(top + 1 < CAPACITY);
+	mstack[top + 1] = mstack[top];
+	top++;
 }
 
 void MatrixStack::popMatrix()
 {
-	assert(!mstack->empty());
-	mstack->pop();
 	// There should always be one matrix left.
-	assert(!mstack->empty());
+	assert(top > 0);
+	top--;
 }
 
 void MatrixStack::loadIdentity()
 {
-	glm::mat4 &top = mstack->top();
-	top = glm::mat4(1.0);
+	mstack[top] = glm::mat4(1.0);
 }
 
 void MatrixStack::translate(const glm::vec3 &t)
 {
-	glm::mat4 &top = mstack->top();
-	top *= glm::translate(glm::mat4(1.0f), t);
+	// Only the last column changes
+	glm::mat4 &m = mstack[top];
+	store(m[3], add(add(add(mul(load(m[0]), t.x), mul(load(m[1]), t.y)), mul(load(m[2]), t.z)), load(m[3])));
 }
 
 void MatrixStack::translate(float x, float y, float z)
@@ -54,8 +125,10 @@ void MatrixStack::translate(float x, float y, float z)
 
 void MatrixStack::scale(const glm::vec3 &s)
 {
-	glm::mat4 &top = mstack->top();
-	top *= glm::scale(glm::mat4(1.0f), s);
+	glm::mat4 &m = mstack[top];
+	store(m[0], mul(load(m[0]), s.x));
+	store(m[1], mul(load(m[1]), s.y));
+	store(m[2], mul(load(m[2]), s.z));
 }
 
 void MatrixStack::scale(float x, float y, float z)
@@ -70,8 +143,33 @@ void MatrixStack::scale(float s)
 
 void MatrixStack::rotate(float angle, const glm::vec3 &axis)
 {
-	glm::mat4 &top = mstack->top();
-	top *= glm::rotate(glm::mat4(1.0f), angle, axis);
+	// Around x, y or z, two columns turn into each other, and the others
+	// stay. Around any other axis, it is a full product.
+	glm::mat4 &m = mstack[top];
+	int i, j;
+	float sign;
+	if(axis.y == 0.0f && axis.z == 0.0f && axis.x != 0.0f) {
+		i = 1;
+		j = 2;
+		sign = axis.x;
+	} else if(axis.z == 0.0f && axis.x == 0.0f && axis.y != 0.0f) {
+		i = 2;
+		j = 0;
+		sign = axis.y;
+	} else if(axis.x == 0.0f && axis.y == 0.0f && axis.z != 0.0f) {
+		i = 0;
+		j = 1;
+		sign = axis.z;
+	} else {
+		multiply(m, glm::rotate(glm::mat4(1.0f), angle, axis), m);
+		return;
+	}
+	float c = cos(angle);
+	float s = sign > 0.0f ? sin(angle) : -sin(angle);
+	Column mi = load(m[i]);
+	Column mj = load(m[j]);
+	store(m[i], add(mul(mi, c), mul(mj, s)));
+	store(m[j], sub(mul(mj, c), mul(mi, s)));
 }
 
 void MatrixStack::rotate(float angle, float x, float y, float z)
@@ -81,13 +179,12 @@ void MatrixStack::rotate(float angle, float x, float y, float z)
 
 void MatrixStack::multMatrix(const glm::mat4 &matrix)
 {
-	glm::mat4 &top = mstack->top();
-	top *= matrix;
+	multiply(mstack[top], matrix, mstack[top]);
 }
 
 const glm::mat4 &MatrixStack::topMatrix() const
 {
-	return mstack->top();
+	return mstack[top];
 }
 
 void MatrixStack::print(const glm::mat4 &mat, const char *name)
@@ -110,5 +207,5 @@ void MatrixStack::print(const glm::mat4 &mat, const char *name)
 
 void MatrixStack::print(const char *name) const
 {
-	print(mstack->top(), name);
+	print(mstack[top], name);
 }
@@ -2,16 +2,29 @@
 #ifndef MATRIXSTACK_H
 #define MATRIXSTACK_H
 
-#include <stack>
-#include <memory>
-#include <glm/fwd.hpp>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
 
+/**
+ * The matrix stack of fixed-function OpenGL.
+ * - The matrices live in an array inside the stack, so pushes never allocate.
+ *   The stack can be a local variable, or be kept and clear()ed every frame.
+ * - At most CAPACITY matrices can be pushed.
+ * - translate() and scale() update the columns they change instead of
+ *   multiplying by a full matrix, and so does rotate() around x, y or z. They
+ *   and multMatrix() use SSE, or AVX for the products, when Simd.h finds it.
+ */
 class MatrixStack
 {
 public:
+	static const int CAPACITY = 100;
+
 	MatrixStack();
 	virtual ~MatrixStack();
 	
+	// Back to a single identity matrix
+	void clear();
+	
 	// glPushMatrix(): Copies the current matrix and adds it to the top of the stack
 	void pushMatrix();
 	// glPopMatrix(): Removes the top of the stack and sets the current matrix to be the matrix that is now on top
@@ -43,8 +56,9 @@ public:
 	void print(const char *name = 0) const;
 	
 private:
-	std::shared_ptr< std::stack<glm::mat4> > mstack;
-	
+	alignas(16) glm::mat4 mstack[CAPACITY];
+	// The index of the top matrix
+	int top;
 };
 
 #endif
@@ -0,0 +1,208 @@
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Size and modification time of a source file
+static bool sourceStamp(const string &name, uint64_t &size, int64_t &time)
+{
+	error_code ec;
+	size = (uint64_t)filesystem::file_size(name, ec);
+	if(ec) {
+		return false;
+	}
+	time = (int64_t)filesystem::last_write_time(name, ec).time_since_epoch().count();
+	return !ec;
+}
+
+static bool sourceHash(const string &name, uint64_t &hash)
+{
+	MappedFile source;
+	if(!source.open(name)) {
+		return false;
+	}
+	hash = 14695981039346656037ull;
+	for(size_t i = 0; i < source.size(); i++) {
+		hash = (hash ^ (unsigned char)source.data()[i])*1099511628211ull;
+	}
+	return true;
+}
+
+// A temporary file next to name, of this process only, so that processes
+// writing the same cache at once don't write to the same file
+static string tempName(const string &name)
+{
+	return name + "." + to_string(getpid()) + ".tmp";
+}
+
+static uint64_t align16(uint64_t offset)
+{
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+MeshCache::MeshCache() :
+	header(NULL)
+{
+}
+
+MeshCache::~MeshCache()
+{
+}
+
+bool MeshCache::valid() const
+{
+	if(file.size() < sizeof(MeshCacheHeader) || memcmp(header->magic, "MESH", 4) != 0 || header->version != MESH_CACHE_VERSION) {
+		return false;
+	}
+	uint64_t n = header->vertexCount;
+	uint64_t ends[] = {
+		header->positions + 12*n,
+		(header->layout & MESH_NORMALS) ? header->normals + 12*n : 0,
+		(header->layout & MESH_TEXCOORDS) ? header->texcoords + 8*n : 0,
+		header->indices + (uint64_t)header->indexCount*header->indexSize,
+	};
+	for(uint64_t end : ends) {
+		if(end > file.size()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MeshCache::map(const string &name)
+{
+	if(!file.open(name)) {
+		return false;
+	}
+	header = (const MeshCacheHeader *)file.data();
+	if(!valid()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MeshCache::open(const string &meshName)
+{
+	string name = cacheName(meshName);
+	if(!map(name)) {
+		return false;
+	}
+	uint64_t size;
+	int64_t time;
+	if(!sourceStamp(meshName, size, time)) {
+		// Only the cache was shipped
+		return true;
+	}
+	if(size == header->sourceSize && time == header->sourceTime) {
+		return true;
+	}
+	// The source was touched. If its contents are the same, keep the cache
+	// and record the new stamp.
+	uint64_t hash;
+	if(size != header->sourceSize || !sourceHash(meshName, hash) || hash != header->sourceHash) {
+		close();
+		return false;
+	}
+	MeshCacheHeader stamped = *header;
+	stamped.sourceTime = time;
+	// In a copy that replaces the cache, as the mapped file mustn't change
+	// (and can't be written on Windows)
+	string tmpName = tempName(name);
+	{
+		ofstream out(tmpName, ios::binary);
+		out.write((const char *)&stamped, sizeof(stamped));
+		out.write(file.data() + sizeof(stamped), file.size() - sizeof(stamped));
+		if(!out) {
+			out.close();
+			error_code ec;
+			filesystem::remove(tmpName, ec);
+			// Stamped next time
+			return true;
+		}
+	}
+	close();
+	error_code ec;
+	filesystem::rename(tmpName, name, ec);
+	if(ec) {
+		// E.g. mapped by another process on Windows
+		filesystem::remove(tmpName, ec);
+	}
+	return map(name);
+}
+
+void MeshCache::close()
+{
+	file.close();
+	header = NULL;
+}
+
+bool MeshCache::write(const string &meshName, const vector<float> &posBuf, const vector<float> &norBuf, const vector<float> &texBuf, const void *indices, int indexCount, int indexSize, float lowestY)
+{
+	MeshCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "MESH", 4);
+	h.version = MESH_CACHE_VERSION;
+	if(!sourceStamp(meshName, h.sourceSize, h.sourceTime) || !sourceHash(meshName, h.sourceHash)) {
+		return false;
+	}
+	h.vertexCount = (uint32_t)(posBuf.size()/3);
+	h.layout = (norBuf.empty() ? 0 : MESH_NORMALS) | (texBuf.empty() ? 0 : MESH_TEXCOORDS);
+	h.indexCount = indexSize ? indexCount : 0;
+	h.indexSize = indexSize;
+	for(int k = 0; k < 3; k++) {
+		h.boundsMin[k] = posBuf.empty() ? 0.0f : posBuf[k];
+		h.boundsMax[k] = h.boundsMin[k];
+	}
+	for(size_t i = 0; i < posBuf.size(); i++) {
+		h.boundsMin[i%3] = min(h.boundsMin[i%3], posBuf[i]);
+		h.boundsMax[i%3] = max(h.boundsMax[i%3], posBuf[i]);
+	}
+	h.lowestY = lowestY;
+	h.positions = align16(sizeof(h));
+	h.normals = align16(h.positions + posBuf.size()*sizeof(float));
+	h.texcoords = align16(h.normals + norBuf.size()*sizeof(float));
+	h.indices = align16(h.texcoords + texBuf.size()*sizeof(float));
+
+	// Written under another name first, so that a partial file is never
+	// mistaken for a cache
+	string name = cacheName(meshName);
+	string tmpName = tempName(name);
+	{
+		ofstream out(tmpName, ios::binary);
+		auto section = [&out](uint64_t offset, const void *data, size_t size) {
+			static const char zeros[16] = {0};
+			out.write(zeros, offset - (uint64_t)out.tellp());
+			out.write((const char *)data, size);
+		};
+		out.write((const char *)&h, sizeof(h));
+		section(h.positions, posBuf.data(), posBuf.size()*sizeof(float));
+		section(h.normals, norBuf.data(), norBuf.size()*sizeof(float));
+		section(h.texcoords, texBuf.data(), texBuf.size()*sizeof(float));
+		section(h.indices, indices, (size_t)h.indexCount*h.indexSize);
+		if(!out) {
+			cerr << "Couldn't write " << tmpName << endl;
+			return false;
+		}
+	}
+	error_code ec;
+	filesystem::rename(tmpName, name, ec);
+	if(ec) {
+		cerr << "Couldn't write " << name << ": " << ec.message() << endl;
+		filesystem::remove(tmpName, ec);
+		return false;
+	}
+	return true;
+}
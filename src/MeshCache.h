@@ -0,0 +1,86 @@
+#pragma once
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "MappedFile.h"
+
+/**
+ * Binary cache of a mesh, written next to its source file (e.g. bunny.obj
+ * is cached in bunny.obj.cache) and memory-mapped when loaded.
+ * The file is a MeshCacheHeader followed by the sections it points to, each
+ * 16-byte aligned:
+ * - positions: 3 floats per vertex
+ * - normals: 3 floats per vertex (if MESH_NORMALS)
+ * - texcoords: 2 floats per vertex (if MESH_TEXCOORDS)
+ * - indices: indexCount indices of indexSize bytes (none if indexSize is 0)
+ * The cache is out of date when its version differs, or when the source's
+ * contents have changed. The source's size and modification time are
+ * checked first, and the source is only hashed when they have changed.
+ */
+#define MESH_CACHE_VERSION 3
+#define MESH_NORMALS 1
+#define MESH_TEXCOORDS 2
+
+struct MeshCacheHeader
+{
+	char magic[4]; // "MESH"
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t sourceHash; // FNV-1a of the source
+	uint32_t vertexCount;
+	uint32_t layout; // MESH_NORMALS | MESH_TEXCOORDS
+	uint32_t indexCount;
+	uint32_t indexSize;
+	float boundsMin[3];
+	float boundsMax[3];
+	float lowestY;
+	uint32_t padding;
+	uint64_t positions;
+	uint64_t normals;
+	uint64_t texcoords;
+	uint64_t indices;
+};
+
+class MeshCache
+{
+public:
+	MeshCache();
+	virtual ~MeshCache();
+	static std::string cacheName(const std::string &meshName) { return meshName + ".cache"; }
+	// Maps the cache of meshName, and returns whether it is up to date
+	bool open(const std::string &meshName);
+	void close();
+	// Writes the cache of meshName. indexSize is 0, 2 or 4.
+	static bool write(const std::string &meshName, const std::vector<float> &posBuf, const std::vector<float> &norBuf, const std::vector<float> &texBuf, const void *indices, int indexCount, int indexSize, float lowestY);
+
+	int getVertexCount() const { return header->vertexCount; }
+	// NULL if the mesh has no normals or texcoords
+	const float *getPositions() const { return section<float>(header->positions); }
+	const float *getNormals() const { return (header->layout & MESH_NORMALS) ? section<float>(header->normals) : NULL; }
+	const float *getTexcoords() const { return (header->layout & MESH_TEXCOORDS) ? section<float>(header->texcoords) : NULL; }
+	int getIndexCount() const { return header->indexCount; }
+	int getIndexSize() const { return header->indexSize; }
+	const void *getIndices() const { return header->indexSize ? section<char>(header->indices) : NULL; }
+	float getLowestY() const { return header->lowestY; }
+	glm::vec3 getBoundsMin() const { return glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]); }
+	glm::vec3 getBoundsMax() const { return glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]); }
+
+private:
+	template <typename T> const T *section(uint64_t offset) const { return (const T *)(file.data() + offset); }
+	bool valid() const;
+	// Maps the cache file name, and returns whether it is a cache
+	bool map(const std::string &name);
+
+	MappedFile file;
+	const MeshCacheHeader *header;
+};
+
+#endif
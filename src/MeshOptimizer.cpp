@@ -0,0 +1,311 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// Size of the LRU cache modeled by optimizeVertexCache()
+#define FORSYTH_CACHE_SIZE 32
+
+// Score of a vertex for Forsyth's algorithm, from its position in the cache
+// (-1 if not in it) and its number of triangles not yet emitted
+static float vertexScore(int cachePos, int remaining)
+{
+	if(remaining == 0) {
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if(cachePos >= 0) {
+		// The last triangle's vertices get a fixed score, so that the next
+		// triangle doesn't depend on the order they were emitted in
+		if(cachePos < 3) {
+			score = 0.75f;
+		} else {
+			score = pow(1.0f - (cachePos - 3)/(float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+		}
+	}
+	// Favor vertices with few triangles left, to avoid leaving lone ones
+	return score + 2.0f/sqrt((float)remaining);
+}
+
+void MeshOptimizer::optimizeVertexCache(vector<unsigned int> &indices, int vertexCount)
+{
+	int nTris = (int)indices.size()/3;
+	if(nTris == 0) {
+		return;
+	}
+	// Triangles of each vertex. The first remaining[v] of them are not yet
+	// emitted.
+	vector<int> offsets(vertexCount + 1, 0);
+	for(unsigned int v : indices) {
+		offsets[v + 1]++;
+	}
+	for(int v = 0; v < vertexCount; v++) {
+		offsets[v + 1] += offsets[v];
+	}
+	vector<int> remaining(vertexCount, 0);
+	vector<int> adjacency(indices.size());
+	for(int t = 0; t < nTris; t++) {
+		for(int k = 0; k < 3; k++) {
+			unsigned int v = indices[3*t + k];
+			adjacency[offsets[v] + remaining[v]++] = t;
+		}
+	}
+
+	vector<int> cachePos(vertexCount, -1);
+	vector<float> vScore(vertexCount);
+	for(int v = 0; v < vertexCount; v++) {
+		vScore[v] = vertexScore(-1, remaining[v]);
+	}
+	vector<float> tScore(nTris);
+	vector<bool> emitted(nTris, false);
+	int best = 0;
+	for(int t = 0; t < nTris; t++) {
+		tScore[t] = vScore[indices[3*t]] + vScore[indices[3*t+1]] + vScore[indices[3*t+2]];
+		if(tScore[t] > tScore[best]) {
+			best = t;
+		}
+	}
+
+	vector<unsigned int> out;
+	out.reserve(indices.size());
+	vector<unsigned int> cache;
+	vector<unsigned int> newCache;
+	int nextUnemitted = 0;
+	for(int n = 0; n < nTris; n++) {
+		if(best < 0) {
+			// Nothing in the cache has triangles left, so start anywhere
+			while(emitted[nextUnemitted]) {
+				nextUnemitted++;
+			}
+			best = nextUnemitted;
+		}
+		emitted[best] = true;
+		const unsigned int *tri = &indices[3*best];
+		out.insert(out.end(), tri, tri + 3);
+
+		// Remove the triangle from its vertices' lists, and move them to the
+		// front of the cache
+		newCache.assign(tri, tri + 3);
+		for(int k = 0; k < 3; k++) {
+			unsigned int v = tri[k];
+			int *list = &adjacency[offsets[v]];
+			int i = (int)(find(list, list + remaining[v], best) - list);
+			swap(list[i], list[--remaining[v]]);
+		}
+		for(unsigned int v : cache) {
+			if(v != tri[0] && v != tri[1] && v != tri[2]) {
+				newCache.push_back(v);
+			}
+		}
+
+		// Rescore the vertices in the new cache, and those evicted from it,
+		// and then their triangles
+		for(int i = 0; i < (int)newCache.size(); i++) {
+			unsigned int v = newCache[i];
+			cachePos[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+			vScore[v] = vertexScore(cachePos[v], remaining[v]);
+		}
+		best = -1;
+		for(int i = 0; i < (int)newCache.size(); i++) {
+			unsigned int v = newCache[i];
+			for(int j = 0; j < remaining[v]; j++) {
+				int t = adjacency[offsets[v] + j];
+				tScore[t] = vScore[indices[3*t]] + vScore[indices[3*t+1]] + vScore[indices[3*t+2]];
+				if(best < 0 || tScore[t] > tScore[best]) {
+					best = t;
+				}
+			}
+		}
+		if(newCache.size() > FORSYTH_CACHE_SIZE) {
+			newCache.resize(FORSYTH_CACHE_SIZE);
+		}
+		swap(cache, newCache);
+	}
+	indices.swap(out);
+}
+
+void MeshOptimizer::optimizeOverdraw(vector<unsigned int> &indices, const vector<float> &positions)
+{
+	int nTris = (int)indices.size()/3;
+	int vertexCount = (int)positions.size()/3;
+	if(nTris == 0) {
+		return;
+	}
+	auto position = [&positions](unsigned int v) {
+		return glm::vec3(positions[3*v], positions[3*v+1], positions[3*v+2]);
+	};
+
+	// Split where a triangle misses the cache for all its vertices, since
+	// reordering there can't cost more misses
+	const int cacheSize = 32;
+	vector<int> clusterStart;
+	vector<int> stamp(vertexCount, -cacheSize - 1);
+	int time = 0;
+	for(int t = 0; t < nTris; t++) {
+		int misses = 0;
+		for(int k = 0; k < 3; k++) {
+			unsigned int v = indices[3*t + k];
+			if(time - stamp[v] > cacheSize) {
+				stamp[v] = ++time;
+				misses++;
+			}
+		}
+		if(misses == 3) {
+			clusterStart.push_back(t);
+		}
+	}
+	clusterStart.push_back(nTris);
+
+	// Each cluster is sorted by how far out it faces from the mesh's center
+	int nClusters = (int)clusterStart.size() - 1;
+	vector<glm::vec3> centroids(nClusters, glm::vec3(0.0f));
+	vector<glm::vec3> normals(nClusters, glm::vec3(0.0f));
+	vector<float> areas(nClusters, 0.0f);
+	glm::vec3 center(0.0f);
+	float area = 0.0f;
+	for(int c = 0; c < nClusters; c++) {
+		for(int t = clusterStart[c]; t < clusterStart[c + 1]; t++) {
+			glm::vec3 p0 = position(indices[3*t]);
+			glm::vec3 p1 = position(indices[3*t+1]);
+			glm::vec3 p2 = position(indices[3*t+2]);
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			centroids[c] += a*(p0 + p1 + p2)/3.0f;
+			normals[c] += n;
+			areas[c] += a;
+		}
+		center += centroids[c];
+		area += areas[c];
+	}
+	if(area > 0.0f) {
+		center = center/area;
+	}
+	vector<float> keys(nClusters, 0.0f);
+	for(int c = 0; c < nClusters; c++) {
+		float len = glm::length(normals[c]);
+		if(areas[c] > 0.0f && len > 0.0f) {
+			keys[c] = glm::dot(centroids[c]/areas[c] - center, normals[c]/len);
+		}
+	}
+	vector<int> order(nClusters);
+	for(int c = 0; c < nClusters; c++) {
+		order[c] = c;
+	}
+	stable_sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] > keys[b]; });
+
+	vector<unsigned int> out;
+	out.reserve(indices.size());
+	for(int c : order) {
+		out.insert(out.end(), indices.begin() + 3*clusterStart[c], indices.begin() + 3*clusterStart[c + 1]);
+	}
+	indices.swap(out);
+}
+
+vector<unsigned int> MeshOptimizer::optimizeVertexFetch(vector<unsigned int> &indices, int vertexCount)
+{
+	const unsigned int unused = ~0u;
+	vector<unsigned int> remap(vertexCount, unused);
+	unsigned int next = 0;
+	for(unsigned int &v : indices) {
+		if(remap[v] == unused) {
+			remap[v] = next++;
+		}
+		v = remap[v];
+	}
+	for(unsigned int &r : remap) {
+		if(r == unused) {
+			r = next++;
+		}
+	}
+	return remap;
+}
+
+void MeshOptimizer::remapVertices(vector<float> &buf, int components, const vector<unsigned int> &remap)
+{
+	if(buf.empty()) {
+		return;
+	}
+	vector<float> old(buf);
+	for(size_t v = 0; v < remap.size(); v++) {
+		copy(&old[v*components], &old[v*components] + components, &buf[remap[v]*components]);
+	}
+}
+
+void MeshOptimizer::optimize(vector<unsigned int> &indices, vector<float> &posBuf, vector<float> &norBuf, vector<float> &texBuf)
+{
+	int vertexCount = (int)posBuf.size()/3;
+	optimizeVertexCache(indices, vertexCount);
+	optimizeOverdraw(indices, posBuf);
+	vector<unsigned int> remap = optimizeVertexFetch(indices, vertexCount);
+	remapVertices(posBuf, 3, remap);
+	remapVertices(norBuf, 3, remap);
+	remapVertices(texBuf, 2, remap);
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::simulateCache(const vector<unsigned int> &indices, int vertexCount, int cacheSize)
+{
+	// A vertex is in the FIFO cache if fewer than cacheSize misses happened
+	// since it was loaded
+	vector<int> stamp(vertexCount, -1);
+	int misses = 0;
+	int used = 0;
+	for(unsigned int v : indices) {
+		if(stamp[v] < 0) {
+			used++;
+		}
+		if(stamp[v] < 0 || misses - stamp[v] >= cacheSize) {
+			stamp[v] = misses++;
+		}
+	}
+	CacheStats stats;
+	stats.acmr = indices.empty() ? 0.0f : misses/(indices.size()/3.0f);
+	stats.atvr = used == 0 ? 0.0f : misses/(float)used;
+	return stats;
+}
+
+// Triangles rotated to start with their smallest index, in sorted order
+static vector< array<unsigned int, 3> > canonicalTriangles(const vector<unsigned int> &indices)
+{
+	vector< array<unsigned int, 3> > tris(indices.size()/3);
+	for(size_t t = 0; t < tris.size(); t++) {
+		const unsigned int *tri = &indices[3*t];
+		int first = (int)(min_element(tri, tri + 3) - tri);
+		tris[t] = {tri[first], tri[(first + 1)%3], tri[(first + 2)%3]};
+	}
+	sort(tris.begin(), tris.end());
+	return tris;
+}
+
+bool MeshOptimizer::check(const string &name, const vector<unsigned int> &indices, const vector<float> &positions)
+{
+	int vertexCount = (int)positions.size()/3;
+	vector<unsigned int> optimized(indices);
+	optimizeVertexCache(optimized, vertexCount);
+	optimizeOverdraw(optimized, positions);
+	vector<unsigned int> remap = optimizeVertexFetch(optimized, vertexCount);
+
+	// The same triangles, in terms of the original vertices
+	vector<unsigned int> inverse(vertexCount);
+	for(int v = 0; v < vertexCount; v++) {
+		inverse[remap[v]] = v;
+	}
+	vector<unsigned int> back(optimized.size());
+	for(size_t i = 0; i < optimized.size(); i++) {
+		back[i] = inverse[optimized[i]];
+	}
+	bool same = canonicalTriangles(back) == canonicalTriangles(indices);
+
+	CacheStats before = simulateCache(indices, vertexCount);
+	CacheStats after = simulateCache(optimized, vertexCount);
+	bool ok = same && after.acmr <= before.acmr;
+	cout << name << ": " << indices.size()/3 << " triangles, ACMR " << before.acmr << " -> " << after.acmr;
+	cout << ", ATVR " << before.atvr << " -> " << after.atvr << ", " << (ok ? "ok" : "FAILED") << endl;
+	return ok;
+}
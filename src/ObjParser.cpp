@@ -0,0 +1,303 @@
+#include "ObjParser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Flags of the corner indices that are relative to the chunk's first record
+#define RELATIVE_V 1
+#define RELATIVE_N 2
+#define RELATIVE_T 4
+
+// Records of one chunk. Negative OBJ indices count back from the last
+// record, so they are stored relative to the chunk and offset when merging.
+struct ObjChunk
+{
+	const char *begin;
+	const char *end;
+	vector<float> positions;
+	vector<float> normals;
+	vector<float> texcoords;
+	vector<ObjParser::Corner> corners;
+	vector<unsigned char> relative;
+};
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skipSpaces(const char *p, const char *end)
+{
+	while(p < end && isSpace(*p)) {
+		p++;
+	}
+	return p;
+}
+
+// Parses a decimal float with an optional exponent. Returns p if there is
+// none.
+static const char *parseFloat(const char *p, const char *end, float &out)
+{
+	static const double powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const char *start = p;
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	// Up to 19 significant digits fit in the mantissa
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for(; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+		if(digits < 19) {
+			mantissa = mantissa*10 + (*p - '0');
+			digits += mantissa != 0;
+		} else {
+			exponent++;
+		}
+	}
+	if(p < end && *p == '.') {
+		for(p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+			if(digits < 19) {
+				mantissa = mantissa*10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if(!any) {
+		return start;
+	}
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool negativeExp = false;
+		if(q < end && (*q == '-' || *q == '+')) {
+			negativeExp = *q == '-';
+			q++;
+		}
+		if(q < end && *q >= '0' && *q <= '9') {
+			int e = 0;
+			for(; q < end && *q >= '0' && *q <= '9'; q++) {
+				e = min(e*10 + (*q - '0'), 1000);
+			}
+			exponent += negativeExp ? -e : e;
+			p = q;
+		}
+	}
+	double value = (double)mantissa;
+	while(exponent > 22) {
+		value *= 1e22;
+		exponent -= 22;
+	}
+	while(exponent < -22) {
+		value /= 1e22;
+		exponent += 22;
+	}
+	value = exponent >= 0 ? value*powers[exponent] : value/powers[-exponent];
+	out = (float)(negative ? -value : value);
+	return p;
+}
+
+static const char *parseInt(const char *p, const char *end, int &out)
+{
+	const char *start = p;
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	int value = 0;
+	const char *digits = p;
+	for(; p < end && *p >= '0' && *p <= '9'; p++) {
+		value = value*10 + (*p - '0');
+	}
+	if(p == digits) {
+		return start;
+	}
+	out = negative ? -value : value;
+	return p;
+}
+
+// Index of the record referred to by an OBJ index, which is 1-based, or
+// counts back from the count records of the chunk so far if negative
+static inline int resolve(int index, int count, unsigned char flag, unsigned char &relative)
+{
+	if(index < 0) {
+		relative |= flag;
+		return count + index;
+	}
+	return index - 1;
+}
+
+static void parseChunk(ObjChunk &chunk)
+{
+	const char *end = chunk.end;
+	vector<ObjParser::Corner> face;
+	vector<unsigned char> faceRelative;
+	for(const char *p = chunk.begin; p < end; ) {
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if(!eol) {
+			eol = end;
+		}
+		p = skipSpaces(p, eol);
+		if(eol - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+			float xyz[3] = {0.0f, 0.0f, 0.0f};
+			const char *q = p + 1;
+			for(int k = 0; k < 3; k++) {
+				q = parseFloat(skipSpaces(q, eol), eol, xyz[k]);
+			}
+			chunk.positions.insert(chunk.positions.end(), xyz, xyz + 3);
+		} else if(eol - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+			float xyz[3] = {0.0f, 0.0f, 0.0f};
+			const char *q = p + 2;
+			for(int k = 0; k < 3; k++) {
+				q = parseFloat(skipSpaces(q, eol), eol, xyz[k]);
+			}
+			chunk.normals.insert(chunk.normals.end(), xyz, xyz + 3);
+		} else if(eol - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+			float uv[2] = {0.0f, 0.0f};
+			const char *q = p + 2;
+			for(int k = 0; k < 2; k++) {
+				q = parseFloat(skipSpaces(q, eol), eol, uv[k]);
+			}
+			chunk.texcoords.insert(chunk.texcoords.end(), uv, uv + 2);
+		} else if(eol - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+			// Corners are v, v/t, v//n or v/t/n
+			int nv = (int)chunk.positions.size()/3;
+			int nn = (int)chunk.normals.size()/3;
+			int nt = (int)chunk.texcoords.size()/2;
+			face.clear();
+			faceRelative.clear();
+			const char *q = skipSpaces(p + 1, eol);
+			while(q < eol) {
+				int v = 0, t = 0, n = 0;
+				const char *r = parseInt(q, eol, v);
+				if(r == q) {
+					break;
+				}
+				if(r < eol && *r == '/') {
+					r = parseInt(r + 1, eol, t);
+					if(r < eol && *r == '/') {
+						r = parseInt(r + 1, eol, n);
+					}
+				}
+				ObjParser::Corner c;
+				unsigned char relative = 0;
+				c.v = resolve(v, nv, RELATIVE_V, relative);
+				c.n = resolve(n, nn, RELATIVE_N, relative);
+				c.t = resolve(t, nt, RELATIVE_T, relative);
+				face.push_back(c);
+				faceRelative.push_back(relative);
+				while(r < eol && !isSpace(*r)) {
+					r++;
+				}
+				q = skipSpaces(r, eol);
+			}
+			for(size_t k = 2; k < face.size(); k++) {
+				size_t fan[3] = {0, k - 1, k};
+				for(size_t i : fan) {
+					chunk.corners.push_back(face[i]);
+					chunk.relative.push_back(faceRelative[i]);
+				}
+			}
+		}
+		p = eol + 1;
+	}
+}
+
+ObjParser::ObjParser() :
+	bytes(0)
+{
+}
+
+ObjParser::~ObjParser()
+{
+}
+
+bool ObjParser::parse(const string &filename, const shared_ptr<ThreadPool> &pool)
+{
+	positions.clear();
+	normals.clear();
+	texcoords.clear();
+	corners.clear();
+	MappedFile file;
+	if(!file.open(filename)) {
+		cerr << "Couldn't read " << filename << endl;
+		return false;
+	}
+	bytes = file.size();
+	auto parallelFor = [&pool](int n, const function<void(int, int)> &body) {
+		if(pool) {
+			pool->parallelFor(n, body);
+		} else {
+			body(0, n);
+		}
+	};
+
+	// Chunks of at least 256 KB, starting after a newline
+	const size_t minChunk = 256*1024;
+	int nChunks = (int)min(bytes/minChunk + 1, (size_t)(pool ? 4*(pool->size() + 1) : 1));
+	vector<ObjChunk> chunks(nChunks);
+	const char *data = file.data();
+	const char *end = data + bytes;
+	for(int c = 0; c < nChunks; c++) {
+		const char *p = data + bytes*c/nChunks;
+		if(c > 0) {
+			const char *eol = (const char *)memchr(p, '\n', end - p);
+			p = eol ? eol + 1 : end;
+			p = max(p, chunks[c-1].begin);
+		}
+		chunks[c].begin = p;
+	}
+	for(int c = 0; c < nChunks; c++) {
+		chunks[c].end = c + 1 < nChunks ? chunks[c+1].begin : end;
+	}
+	parallelFor(nChunks, [&chunks](int begin, int end) {
+		for(int c = begin; c < end; c++) {
+			parseChunk(chunks[c]);
+		}
+	});
+
+	// Offsets of each chunk's records, then copy them in place
+	vector<size_t> pos(nChunks + 1, 0), nor(nChunks + 1, 0), tex(nChunks + 1, 0), cor(nChunks + 1, 0);
+	for(int c = 0; c < nChunks; c++) {
+		pos[c+1] = pos[c] + chunks[c].positions.size();
+		nor[c+1] = nor[c] + chunks[c].normals.size();
+		tex[c+1] = tex[c] + chunks[c].texcoords.size();
+		cor[c+1] = cor[c] + chunks[c].corners.size();
+	}
+	positions.resize(pos[nChunks]);
+	normals.resize(nor[nChunks]);
+	texcoords.resize(tex[nChunks]);
+	corners.resize(cor[nChunks]);
+	parallelFor(nChunks, [&](int begin, int end) {
+		for(int c = begin; c < end; c++) {
+			const ObjChunk &chunk = chunks[c];
+			copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + pos[c]);
+			copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + nor[c]);
+			copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + tex[c]);
+			int v0 = (int)(pos[c]/3), n0 = (int)(nor[c]/3), t0 = (int)(tex[c]/2);
+			for(size_t i = 0; i < chunk.corners.size(); i++) {
+				Corner k = chunk.corners[i];
+				unsigned char relative = chunk.relative[i];
+				k.v += (relative & RELATIVE_V) ? v0 : 0;
+				k.n += (relative & RELATIVE_N) ? n0 : 0;
+				k.t += (relative & RELATIVE_T) ? t0 : 0;
+				corners[cor[c] + i] = k;
+			}
+		}
+	});
+	return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * Parser for the geometry of OBJ files (v, vn, vt and f records; everything
+ * else is skipped). The file is memory-mapped and split into line-aligned
+ * chunks, which are parsed in parallel and then merged.
+ * Faces are triangulated as fans. Each corner has 0-based indices into
+ * positions, normals and texcoords, or -1 if the face doesn't have them.
+ */
+class ObjParser
+{
+public:
+	struct Corner
+	{
+		int v;
+		int n;
+		int t;
+	};
+
+	ObjParser();
+	virtual ~ObjParser();
+	// Parses on the pool if there is one, and returns whether the file
+	// could be read
+	bool parse(const std::string &filename, const std::shared_ptr<ThreadPool> &pool = nullptr);
+
+	std::vector<float> positions; // 3 floats per position
+	std::vector<float> normals; // 3 floats per normal
+	std::vector<float> texcoords; // 2 floats per texcoord
+	std::vector<Corner> corners; // 3 per triangle
+	size_t bytes; // Size of the last parsed file
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "GLSL.h"
+
+using namespace std;
+
+void Profiler::Samples::add(float ms, int window)
+{
+	if((int)ring.size() < window) {
+		ring.push_back(ms);
+	} else {
+		ring[next] = ms;
+		next = (next + 1) % window;
+	}
+	count++;
+}
+
+Profiler::Profiler() :
+	enabled(false),
+	gpuTimers(false),
+	window(240),
+	frames(0),
+	dropped(0)
+{
+}
+
+Profiler::~Profiler()
+{
+}
+
+void Profiler::init()
+{
+	enabled = true;
+	gpuTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if(!gpuTimers) {
+		cout << "Timer queries not supported, profiling on the CPU only" << endl;
+	}
+	started = Clock::now();
+}
+
+void Profiler::beginFrame()
+{
+	if(!enabled) {
+		return;
+	}
+	// The queries of two frames ago used the same slot
+	if(gpuTimers) {
+		resolve(pending[frames % 2], false);
+	}
+	for(auto &stage : stages) {
+		stage.cpuFrame = 0.0;
+		stage.ran = false;
+	}
+	for(auto &counter : counters) {
+		counter.cpuFrame = 0.0;
+		counter.ran = false;
+	}
+	frameStart = Clock::now();
+}
+
+void Profiler::endFrame()
+{
+	if(!enabled) {
+		return;
+	}
+	Clock::time_point now = Clock::now();
+	while(!open.empty()) {
+		end();
+	}
+	frameCPU.add(chrono::duration<float, milli>(now - frameStart).count(), window);
+	for(auto &stage : stages) {
+		if(stage.ran) {
+			stage.cpu.add((float)stage.cpuFrame, window);
+		}
+	}
+	for(auto &counter : counters) {
+		if(counter.ran) {
+			counter.cpu.add((float)counter.cpuFrame, window);
+		}
+	}
+	frames++;
+}
+
+int Profiler::findStage(vector<Stage> &list, const char *name)
+{
+	for(int i = 0; i < (int)list.size(); i++) {
+		if(list[i].name == name) {
+			return i;
+		}
+	}
+	Stage stage;
+	stage.name = name;
+	stage.cpuFrame = 0.0;
+	stage.ran = false;
+	list.push_back(stage);
+	return (int)list.size() - 1;
+}
+
+void Profiler::begin(const char *name)
+{
+	if(!enabled) {
+		return;
+	}
+	Open o;
+	o.stage = findStage(stages, name);
+	o.gpu = gpuTimers && open.empty();
+	if(o.gpu) {
+		Query q;
+		q.stage = o.stage;
+		if(freeQueries.empty()) {
+			glGenQueries(1, &q.id);
+		} else {
+			q.id = freeQueries.back();
+			freeQueries.pop_back();
+		}
+		glBeginQuery(GL_TIME_ELAPSED, q.id);
+		pending[frames % 2].push_back(q);
+	}
+	open.push_back(o);
+	// Start the clock last, so that it doesn't include the setup
+	open.back().start = Clock::now();
+}
+
+void Profiler::end()
+{
+	if(!enabled || open.empty()) {
+		return;
+	}
+	Clock::time_point now = Clock::now();
+	Open &o = open.back();
+	if(o.gpu) {
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+	Stage &stage = stages[o.stage];
+	stage.cpuFrame += chrono::duration<double, milli>(now - o.start).count();
+	stage.ran = true;
+	open.pop_back();
+}
+
+void Profiler::count(const char *name, double value)
+{
+	if(!enabled) {
+		return;
+	}
+	Stage &counter = counters[findStage(counters, name)];
+	counter.cpuFrame += value;
+	counter.ran = true;
+}
+
+void Profiler::resolve(vector<Query> &queries, bool wait)
+{
+	// Sum the queries of each stage, and drop the stages with missing
+	// results. Some drivers (e.g. llvmpipe) return nonsense for the first
+	// query of a framebuffer, so times longer than the whole run are dropped
+	// too.
+	double limit = chrono::duration<double, milli>(Clock::now() - started).count();
+	vector<double> sums(stages.size(), 0.0);
+	vector<int> state(stages.size(), 0); // 0: not run, 1: ok, 2: dropped
+	for(const auto &q : queries) {
+		GLint available = 1;
+		if(!wait) {
+			glGetQueryObjectiv(q.id, GL_QUERY_RESULT_AVAILABLE, &available);
+		}
+		if(available) {
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(q.id, GL_QUERY_RESULT, &ns);
+			sums[q.stage] += ns*1e-6;
+			state[q.stage] = max(state[q.stage], 1);
+		} else {
+			state[q.stage] = 2;
+		}
+		// An unfinished query may be reused, which discards its result
+		freeQueries.push_back(q.id);
+	}
+	queries.clear();
+	for(size_t i = 0; i < stages.size(); i++) {
+		if(state[i] == 1 && sums[i] > limit) {
+			state[i] = 2;
+		}
+		if(state[i] == 1) {
+			stages[i].gpu.add((float)sums[i], window);
+		} else if(state[i] == 2) {
+			dropped++;
+		}
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+// Minimum, average, 95th percentile and maximum
+static void getStats(const vector<float> &samples, float stats[4])
+{
+	vector<float> sorted(samples);
+	sort(sorted.begin(), sorted.end());
+	double sum = 0.0;
+	for(float s : sorted) {
+		sum += s;
+	}
+	int n = (int)sorted.size();
+	stats[0] = sorted[0];
+	stats[1] = (float)(sum/n);
+	stats[2] = sorted[max(0, (int)ceil(0.95*n) - 1)];
+	stats[3] = sorted[n - 1];
+}
+
+bool Profiler::report(const string &filename)
+{
+	if(!enabled) {
+		return true;
+	}
+	if(gpuTimers) {
+		// The older of the last two frames is in the slot of the next one
+		resolve(pending[frames % 2], true);
+		resolve(pending[(frames + 1) % 2], true);
+		for(GLuint id : freeQueries) {
+			glDeleteQueries(1, &id);
+		}
+		freeQueries.clear();
+	}
+
+	// One row per stage and clock, with the frame total first and the
+	// counters last
+	struct Row
+	{
+		string name;
+		const char *clock;
+		const Samples *samples;
+	};
+	vector<Row> rows;
+	rows.push_back({"frame", "cpu", &frameCPU});
+	for(const auto &stage : stages) {
+		rows.push_back({stage.name, "cpu", &stage.cpu});
+		if(gpuTimers) {
+			rows.push_back({stage.name, "gpu", &stage.gpu});
+		}
+	}
+	for(const auto &counter : counters) {
+		rows.push_back({counter.name, "count", &counter.cpu});
+	}
+
+	if(filename.empty()) {
+		cout << "Profile of " << frames << " frames, over the last " << window << " (ms, or counts for the counters):" << endl;
+		cout << left << setw(16) << "stage" << setw(6) << "clock" << right;
+		cout << setw(10) << "min" << setw(10) << "avg" << setw(10) << "p95" << setw(10) << "max" << setw(10) << "samples" << endl;
+		for(const auto &row : rows) {
+			if(row.samples->ring.empty()) {
+				continue;
+			}
+			float stats[4];
+			getStats(row.samples->ring, stats);
+			cout << left << setw(16) << row.name << setw(6) << row.clock << right << fixed << setprecision(3);
+			for(int i = 0; i < 4; i++) {
+				cout << setw(10) << stats[i];
+			}
+			cout << setw(10) << row.samples->count << endl;
+		}
+		cout.unsetf(ios::fixed);
+		cout << setprecision(6);
+		if(dropped > 0) {
+			cout << dropped << " GPU samples dropped because they were not ready in time, or invalid" << endl;
+		}
+		return true;
+	}
+
+	ofstream out(filename);
+	if(!out) {
+		cerr << "Cannot write " << filename << endl;
+		return false;
+	}
+	out << "stage,clock,min_ms,avg_ms,p95_ms,max_ms,samples" << endl;
+	for(const auto &row : rows) {
+		if(row.samples->ring.empty()) {
+			continue;
+		}
+		float stats[4];
+		getStats(row.samples->ring, stats);
+		out << row.name << "," << row.clock;
+		for(int i = 0; i < 4; i++) {
+			out << "," << stats[i];
+		}
+		out << "," << row.samples->count << endl;
+	}
+	cout << "Wrote the profile of " << frames << " frames to " << filename << endl;
+	return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+/**
+ * Per-stage frame timings. Every stage is timed on the CPU, and top-level
+ * stages also on the GPU with GL_TIME_ELAPSED queries. The queries of a
+ * frame are read back two frames later, when they have normally finished, so
+ * that the CPU doesn't wait for the GPU; results that are still not
+ * available are dropped.
+ * - Call beginFrame() and endFrame() around a frame, and begin() and end()
+ *   (or a Scope) around its stages. Stages may nest, but only the outermost
+ *   one is timed on the GPU, since time queries can't be nested.
+ * - The statistics are over the last window frames in which a stage ran.
+ * - count() adds to a per-frame counter, such as a number of objects, which
+ *   is reported like a stage with "count" as its clock.
+ * - Does nothing until init() is called, so the calls can stay in place when
+ *   profiling is off.
+ */
+class Profiler
+{
+public:
+	// Times a stage for the lifetime of the object
+	class Scope
+	{
+	public:
+		Scope(const std::shared_ptr<Profiler> &p, const char *name) : profiler(p) { profiler->begin(name); }
+		~Scope() { profiler->end(); }
+	private:
+		std::shared_ptr<Profiler> profiler;
+	};
+
+	Profiler();
+	virtual ~Profiler();
+	void setWindow(int frames) { window = frames; }
+	// Starts profiling, with GPU timers if the context supports them
+	void init();
+	bool isEnabled() const { return enabled; }
+	void beginFrame();
+	void endFrame();
+	void begin(const char *name);
+	void end();
+	void count(const char *name, double value);
+	// Waits for the outstanding queries, and prints the statistics to stdout,
+	// or writes them to a CSV file if filename is not empty
+	bool report(const std::string &filename);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// A ring of the last samples, in milliseconds
+	struct Samples
+	{
+		std::vector<float> ring;
+		int next;
+		long long count;
+		Samples() : next(0), count(0) {}
+		void add(float ms, int window);
+	};
+	struct Stage
+	{
+		std::string name;
+		Samples cpu;
+		Samples gpu;
+		// Accumulated over the current frame, since a stage may run more than once
+		double cpuFrame;
+		bool ran;
+	};
+	struct Open
+	{
+		int stage;
+		Clock::time_point start;
+		bool gpu;
+	};
+	struct Query
+	{
+		int stage;
+		GLuint id;
+	};
+
+	int findStage(std::vector<Stage> &list, const char *name);
+	// Reads the queries of one frame, waiting for them if wait is set
+	void resolve(std::vector<Query> &queries, bool wait);
+
+	bool enabled;
+	bool gpuTimers;
+	int window;
+	long long frames;
+	long long dropped;
+	Clock::time_point started;
+	Clock::time_point frameStart;
+	Samples frameCPU;
+	std::vector<Stage> stages;
+	// Counters accumulate into cpuFrame, and their samples are in cpu
+	std::vector<Stage> counters;
+	std::vector<Open> open;
+	// Queries issued in the last two frames, and unused query objects
+	std::vector<Query> pending[2];
+	std::vector<GLuint> freeQueries;
+};
+
+#endif
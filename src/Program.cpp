@@ -2,14 +2,44 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstring>
 
 #include "GLSL.h"
 
 using namespace std;
 
+// The handles of the names seen so far, by name
+static map<string,int> &attributeHandles()
+{
+	static map<string,int> handles;
+	return handles;
+}
+
+static map<string,int> &uniformHandles()
+{
+	static map<string,int> handles;
+	return handles;
+}
+
+Program::Attribute Program::attribute(const string &name)
+{
+	map<string,int> &handles = attributeHandles();
+	auto inserted = handles.insert(make_pair(name, (int)handles.size()));
+	return Attribute{inserted.first->second};
+}
+
+Program::Uniform Program::uniform(const string &name)
+{
+	map<string,int> &handles = uniformHandles();
+	auto inserted = handles.insert(make_pair(name, (int)handles.size()));
+	return Uniform{inserted.first->second};
+}
+
 Program::Program() :
 	vShaderName(""),
 	fShaderName(""),
+	cShaderName(""),
+	prelude(""),
 	pid(0),
 	verbose(true)
 {
@@ -27,10 +57,19 @@ void Program::setShaderNames(const string &v, const string &f)
 	fShaderName = f;
 }
 
+void Program::setComputeShaderName(const string &c)
+{
+	cShaderName = c;
+}
+
 bool Program::init()
 {
 	GLint rc;
 	
+	if(!cShaderName.empty()) {
+		return initCompute();
+	}
+	
 	// Create shader handles
 	GLuint VS = glCreateShader(GL_VERTEX_SHADER);
 	GLuint FS = glCreateShader(GL_FRAGMENT_SHADER);
@@ -39,7 +78,7 @@ bool Program::init()
 	const char *vshader = GLSL::textFileRead(vShaderName.c_str());
 	const char *fshader = GLSL::textFileRead(fShaderName.c_str());
 	glShaderSource(VS, 1, &vshader, NULL);
-	glShaderSource(FS, 1, &fshader, NULL);
+	shaderSource(FS, fshader);
 	
 	// Compile vertex shader
 	glCompileShader(VS);
@@ -67,6 +106,9 @@ bool Program::init()
 	pid = glCreateProgram();
 	glAttachShader(pid, VS);
 	glAttachShader(pid, FS);
+	for(const auto &binding : attributeBindings) {
+		glBindAttribLocation(pid, binding.second, binding.first.c_str());
+	}
 	glLinkProgram(pid);
 	glGetProgramiv(pid, GL_LINK_STATUS, &rc);
 	if(!rc) {
@@ -81,6 +123,63 @@ bool Program::init()
 	return true;
 }
 
+bool Program::initCompute()
+{
+	GLint rc;
+	
+	// Create shader handle
+	GLuint CS = glCreateShader(GL_COMPUTE_SHADER);
+	
+	// Read shader source
+	const char *cshader = GLSL::textFileRead(cShaderName.c_str());
+	shaderSource(CS, cshader);
+	
+	// Compile compute shader
+	glCompileShader(CS);
+	glGetShaderiv(CS, GL_COMPILE_STATUS, &rc);
+	if(!rc) {
+		if(isVerbose()) {
+			GLSL::printShaderInfoLog(CS);
+			cout << "Error compiling compute shader " << cShaderName << endl;
+		}
+		return false;
+	}
+	
+	// Create the program and link
+	pid = glCreateProgram();
+	glAttachShader(pid, CS);
+	glLinkProgram(pid);
+	glGetProgramiv(pid, GL_LINK_STATUS, &rc);
+	if(!rc) {
+		if(isVerbose()) {
+			GLSL::printProgramInfoLog(pid);
+			cout << "Error linking shader " << cShaderName << endl;
+		}
+		return false;
+	}
+	
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
+
+void Program::shaderSource(GLuint shader, const char *source) const
+{
+	if(prelude.empty() || source == NULL) {
+		glShaderSource(shader, 1, &source, NULL);
+		return;
+	}
+	// The #version line, and the #extension lines right after it, have to
+	// stay first
+	const char *body = source;
+	do {
+		const char *end = strchr(body, '\n');
+		body = end ? end + 1 : body + strlen(body);
+	} while(strncmp(body, "#extension", 10) == 0);
+	string version(source, body);
+	const char *sources[3] = {version.c_str(), prelude.c_str(), body};
+	glShaderSource(shader, 3, sources, NULL);
+}
+
 void Program::bind()
 {
 	glUseProgram(pid);
@@ -91,14 +190,40 @@ void Program::unbind()
 	glUseProgram(0);
 }
 
-void Program::addAttribute(const string &name)
+Program::Attribute Program::addAttribute(const string &name)
+{
+	GLint location = glGetAttribLocation(pid, name.c_str());
+	attributes[name] = location;
+	Attribute a = attribute(name);
+	if(a.index >= (int)attributeLocations.size()) {
+		attributeLocations.resize(a.index + 1, -1);
+	}
+	attributeLocations[a.index] = location;
+	return a;
+}
+
+Program::Uniform Program::addUniform(const string &name)
 {
-	attributes[name] = glGetAttribLocation(pid, name.c_str());
+	GLint location = glGetUniformLocation(pid, name.c_str());
+	uniforms[name] = location;
+	Uniform u = uniform(name);
+	if(u.index >= (int)uniformLocations.size()) {
+		uniformLocations.resize(u.index + 1, -1);
+	}
+	uniformLocations[u.index] = location;
+	return u;
 }
 
-void Program::addUniform(const string &name)
+void Program::addUniformBlock(const string &name, GLuint binding)
 {
-	uniforms[name] = glGetUniformLocation(pid, name.c_str());
+	GLuint index = glGetUniformBlockIndex(pid, name.c_str());
+	if(index == GL_INVALID_INDEX) {
+		if(isVerbose()) {
+			cout << name << " is not a uniform block" << endl;
+		}
+		return;
+	}
+	glUniformBlockBinding(pid, index, binding);
 }
 
 GLint Program::getAttribute(const string &name) const
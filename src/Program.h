@@ -4,16 +4,29 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
 
 /**
  * An OpenGL Program (vertex and fragment shaders)
+ * - Variables can be looked up by name, or through the handles returned by
+ *   addAttribute() and addUniform(), which is a single array access. A name
+ *   has the same handle in every program, so handles can be made once with
+ *   attribute() and uniform() and used with any program.
+ * - Uniform blocks are read from the buffer bound to their binding point.
  */
 class Program
 {
 public:
+	struct Attribute { int index; };
+	struct Uniform { int index; };
+
+	// The handle of a name, whether or not a program has it
+	static Attribute attribute(const std::string &name);
+	static Uniform uniform(const std::string &name);
+
 	Program();
 	virtual ~Program();
 	
@@ -21,23 +34,45 @@ public:
 	bool isVerbose() const { return verbose; }
 	
 	void setShaderNames(const std::string &v, const std::string &f);
+	// Makes this a compute program instead of a vertex/fragment program
+	void setComputeShaderName(const std::string &c);
+	// Source inserted after the #version and #extension lines of the fragment
+	// or compute shader, e.g. defines and functions shared by several shaders
+	void setPrelude(const std::string &p) { prelude = p; }
+	// Fixes the location of an attribute, instead of letting the linker pick
+	// it. Must come before init().
+	void setAttributeLocation(const std::string &name, GLuint location) { attributeBindings[name] = location; }
 	virtual bool init();
 	virtual void bind();
 	virtual void unbind();
 
-	void addAttribute(const std::string &name);
-	void addUniform(const std::string &name);
+	Attribute addAttribute(const std::string &name);
+	Uniform addUniform(const std::string &name);
+	// Connects a uniform block to a binding point, see UniformBlocks
+	void addUniformBlock(const std::string &name, GLuint binding);
 	GLint getAttribute(const std::string &name) const;
 	GLint getUniform(const std::string &name) const;
+	// -1 if the variable wasn't added, like an inactive one
+	GLint getAttribute(Attribute a) const { return a.index < (int)attributeLocations.size() ? attributeLocations[a.index] : -1; }
+	GLint getUniform(Uniform u) const { return u.index < (int)uniformLocations.size() ? uniformLocations[u.index] : -1; }
 	
 protected:
 	std::string vShaderName;
 	std::string fShaderName;
+	std::string cShaderName;
+	std::string prelude;
+	std::map<std::string,GLuint> attributeBindings;
 	
 private:
+	bool initCompute();
+	void shaderSource(GLuint shader, const char *source) const;
+	
 	GLuint pid;
 	std::map<std::string,GLint> attributes;
 	std::map<std::string,GLint> uniforms;
+	// Indexed by handle
+	std::vector<GLint> attributeLocations;
+	std::vector<GLint> uniformLocations;
 	bool verbose;
 };
 
@@ -2,15 +2,16 @@
 
 #include <cmath>
 #include "GLSL.h"
+#include "MeshOptimizer.h"
 #include <glm/glm.hpp>
 
 using namespace std;
 
-Revo::Revo() : posBufID(0), norBufID(0), texBufID(0), indBufID(0) {}
+Revo::Revo() : mesh() {}
 
 Revo::~Revo() {}
 
-void Revo::init() {
+void Revo::generate() {
 
 	vector<vector<unsigned int>> indStore;
 
@@ -47,60 +48,34 @@ void Revo::init() {
 		}
 	}
 
-
-	// Send the position array to the GPU
-	glGenBuffers(1, &posBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_STATIC_DRAW);
-	
-	// Send the normal array to the GPU
-	glGenBuffers(1, &norBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_STATIC_DRAW);
-	
-	// Send the texture array to the GPU
-	glGenBuffers(1, &texBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-	glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &indBufID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indBufID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indBuf.size()*sizeof(unsigned int), &indBuf[0], GL_STATIC_DRAW);
-	
-	// Unbind the arrays
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	GLSL::checkError(GET_FILE_LINE);
+	// The positions are (x, theta) parameters, deformed in the vertex
+	// shader, so sort for overdraw on the surface at time 0
+	int vertexCount = (int)posBuf.size()/3;
+	vector<float> surface(posBuf.size());
+	for(int v = 0; v < vertexCount; v++) {
+		float x = posBuf[3*v];
+		float theta = posBuf[3*v+1];
+		surface[3*v] = x;
+		surface[3*v+1] = (cos(x) + 2)*cos(theta);
+		surface[3*v+2] = (cos(x) + 2)*sin(theta);
+	}
+	MeshOptimizer::optimizeVertexCache(indBuf, vertexCount);
+	MeshOptimizer::optimizeOverdraw(indBuf, surface);
+	vector<unsigned int> remap = MeshOptimizer::optimizeVertexFetch(indBuf, vertexCount);
+	MeshOptimizer::remapVertices(posBuf, 3, remap);
+	MeshOptimizer::remapVertices(norBuf, 3, remap);
+	MeshOptimizer::remapVertices(texBuf, 2, remap);
 }
 
-void Revo::draw(const std::shared_ptr<Program> prog) const {
-	// Bind position buffer
-	int h_pos = prog->getAttribute("aPos");
-	GLSL::checkError(GET_FILE_LINE);
-	glEnableVertexAttribArray(h_pos);
-	GLSL::checkError(GET_FILE_LINE);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	GLSL::checkError(GET_FILE_LINE);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-
-	GLSL::checkError(GET_FILE_LINE);
-	
-	GLSL::checkError(GET_FILE_LINE);
-	
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indBufID);
-
-	int indCount = (int)indBuf.size();
-	// Draw
-	// int count = posBuf.size()/3; // number of indices to be rendered
-	glDrawElements(GL_TRIANGLES, indCount, GL_UNSIGNED_INT, (const void* )0);
+void Revo::init(const shared_ptr<GeometryArena> &arena) {
+	this->arena = arena;
+	mesh = arena->add(GeometryArena::POSITION, getVertexCount(), posBuf.data(), NULL, NULL, indBuf.data(), sizeof(unsigned int), (int)indBuf.size());
+	// The positions are (x, theta) parameters. vert.glsl puts the surface at
+	// a radius of cos(x + time) + 2 around the x axis, which is at most 3.
+	mesh.boundsMin = glm::vec3(mesh.boundsMin.x, -3.0f, -3.0f);
+	mesh.boundsMax = glm::vec3(mesh.boundsMax.x, 3.0f, 3.0f);
+}
 
-	GLSL::checkError(GET_FILE_LINE);
-	
-	// Disable and unbind
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDisableVertexAttribArray(h_pos);
-	
-	GLSL::checkError(GET_FILE_LINE);
+void Revo::draw(int instances) const {
+	arena->draw(mesh, instances);
 }
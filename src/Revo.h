@@ -1,6 +1,6 @@
 #pragma once
 
-#include "Program.h"
+#include "GeometryArena.h"
 #include <memory>
 #include <vector>
 #include <string>
@@ -10,16 +10,25 @@ class Revo
 	public:
 		Revo();
 		virtual ~Revo();
-		void init();
-		void draw(const std::shared_ptr<Program> prog) const;
+		// Builds the (x, theta) grid deformed by vert.glsl, without an OpenGL
+		// context
+		void generate();
+		// Adds the generated mesh to the arena, to be uploaded with the others
+		void init(const std::shared_ptr<GeometryArena> &arena);
+		int getVertexCount() const { return (int)posBuf.size()/3; }
+		const float *getPositions() const { return posBuf.data(); }
+		const float *getNormals() const { return norBuf.data(); }
+		const std::vector<unsigned int> &getIndices() const { return indBuf; }
+		// If instances > 0, draws that many instances (see Shape::draw)
+		void draw(int instances = 0) const;
+		// The bounds are those of the surface at any time
+		const GeometryArena::Mesh &getMesh() const { return mesh; }
 		float lowest_y = 0.0;
 	private:
 		std::vector<float> posBuf;
 		std::vector<float> norBuf;
 		std::vector<float> texBuf;
 		std::vector<unsigned int> indBuf;
-		unsigned posBufID;
-		unsigned norBufID;
-		unsigned texBufID;
-		unsigned indBufID;
+		std::shared_ptr<GeometryArena> arena;
+		GeometryArena::Mesh mesh;
 };
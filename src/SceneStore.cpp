@@ -0,0 +1,237 @@
+#include "SceneStore.h"
+
+#include <cassert>
+#include <cmath>
+
+#define GLM_FORCE_RADIANS
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "ThreadPool.h"
+#include "Transform.h"
+
+using namespace std;
+
+// Moves the last element of a field into the hole of a removed object
+template <typename T>
+static void moveLast(vector<T> &field, int index)
+{
+	field[index] = field.back();
+	field.pop_back();
+}
+
+glm::mat4 SceneStore::animation(int kind, double t)
+{
+	glm::mat4 A(1.0f);
+	if(kind == SPIN) {
+		A = glm::rotate(A, (float)t, glm::vec3(0.0f, 1.0f, 0.0f));
+	} else if(kind == SHEAR) {
+		A[1][2] = 0.5f*cos(t);
+	} else if(kind == BOUNCE) {
+		double sv = -0.5*(0.5*cos((4.0*M_PI)/(1.7)*(t+0.9))+0.5)+1.0;
+		A[0][0] = (float)sv;
+		A[2][2] = (float)sv;
+		A[3][1] = (float)(0.4*(0.5*sin((2.0*M_PI)/(1.7)*(t+0.9)) + 0.5));
+	}
+	return A;
+}
+
+SceneStore::SceneStore() :
+	version(0)
+{
+}
+
+SceneStore::~SceneStore()
+{
+}
+
+void SceneStore::reserve(int n)
+{
+	indices.reserve(n);
+	generations.reserve(n);
+	handles.reserve(n);
+	translations.reserve(n);
+	rotations.reserve(n);
+	scales.reserve(n);
+	locals.reserve(n);
+	meshes.reserve(n);
+	animations.reserve(n);
+	ambients.reserve(n);
+	diffuses.reserve(n);
+	speculars.reserve(n);
+	shininesses.reserve(n);
+}
+
+SceneStore::Handle SceneStore::add(int mesh, int animation, const glm::vec3 &translation, const glm::vec3 &rotation, const glm::vec3 &scale, const glm::vec3 &ka, const glm::vec3 &kd, const glm::vec3 &ks, float s)
+{
+	uint32_t slot;
+	if(freeSlots.empty()) {
+		slot = (uint32_t)indices.size();
+		indices.push_back(0);
+		generations.push_back(0);
+	} else {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	version++;
+	indices[slot] = size();
+	Handle handle = (Handle)generations[slot] << 32 | slot;
+	handles.push_back(handle);
+	translations.push_back(translation);
+	rotations.push_back(rotation);
+	scales.push_back(scale);
+	locals.push_back(glm::mat4(1.0f));
+	meshes.push_back(mesh);
+	animations.push_back(animation);
+	ambients.push_back(ka);
+	diffuses.push_back(kd);
+	speculars.push_back(ks);
+	shininesses.push_back(s);
+	updateLocal(size() - 1);
+	return handle;
+}
+
+bool SceneStore::contains(Handle handle) const
+{
+	uint32_t slot = slotOf(handle);
+	return slot < indices.size() && indices[slot] >= 0 && generations[slot] == generationOf(handle);
+}
+
+int SceneStore::getIndex(Handle handle) const
+{
+	assert(contains(handle));
+	return indices[slotOf(handle)];
+}
+
+void SceneStore::remove(Handle handle)
+{
+	assert(contains(handle));
+	uint32_t slot = slotOf(handle);
+	int index = indices[slot];
+	indices[slotOf(handles.back())] = index;
+	indices[slot] = -1;
+	// The handle, and any copies of it, no longer name an object
+	generations[slot]++;
+	version++;
+	freeSlots.push_back(slot);
+	moveLast(handles, index);
+	moveLast(translations, index);
+	moveLast(rotations, index);
+	moveLast(scales, index);
+	moveLast(locals, index);
+	moveLast(meshes, index);
+	moveLast(animations, index);
+	moveLast(ambients, index);
+	moveLast(diffuses, index);
+	moveLast(speculars, index);
+	moveLast(shininesses, index);
+}
+
+void SceneStore::setTranslation(Handle handle, const glm::vec3 &translation)
+{
+	translations[getIndex(handle)] = translation;
+	version++;
+}
+
+void SceneStore::setRotation(Handle handle, const glm::vec3 &rotation)
+{
+	int index = getIndex(handle);
+	rotations[index] = rotation;
+	updateLocal(index);
+	version++;
+}
+
+void SceneStore::setScale(Handle handle, const glm::vec3 &scale)
+{
+	int index = getIndex(handle);
+	scales[index] = scale;
+	updateLocal(index);
+	version++;
+}
+
+void SceneStore::updateLocal(int index)
+{
+	glm::mat4 L(1.0f);
+	const glm::vec3 &r = rotations[index];
+	if(r.z != 0.0f) {
+		L = glm::rotate(L, r.z, glm::vec3(0.0f, 0.0f, 1.0f));
+	}
+	if(r.y != 0.0f) {
+		L = glm::rotate(L, r.y, glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+	if(r.x != 0.0f) {
+		L = glm::rotate(L, r.x, glm::vec3(1.0f, 0.0f, 0.0f));
+	}
+	locals[index] = glm::scale(L, scales[index]);
+}
+
+void SceneStore::update(double t, const glm::mat4 &V)
+{
+	update(t, V, nullptr);
+}
+
+void SceneStore::update(double t, const glm::mat4 &V, const vector<int> &list)
+{
+	update(t, V, &list);
+}
+
+void SceneStore::update(double t, const glm::mat4 &V, const vector<int> *list)
+{
+	// V*T*A*L is V*A*L with V*translation added to its last column, and V*A
+	// is the same for all objects with the same animation
+	glm::mat4 VA[ANIMATIONS];
+	for(int k = 0; k < ANIMATIONS; k++) {
+		VA[k] = V*animation(k, t);
+	}
+	int n = list ? (int)list->size() : size();
+	modelViews.resize(n);
+	normalMatrices.resize(n);
+	if(n == 0) {
+		return;
+	}
+	// The objects are independent, and each writes its own entries
+	auto body = [&](int begin, int end) {
+		for(int j = begin; j < end; j++) {
+			int i = list ? (*list)[j] : j;
+			glm::mat4 MV = VA[animations[i]]*locals[i];
+			MV[3] += V*glm::vec4(translations[i], 0.0f);
+			modelViews[j] = MV;
+		}
+		Transform::normalMatrices(&modelViews[begin], &normalMatrices[begin], end - begin);
+	};
+	if(pool) {
+		pool->parallelFor(n, body);
+	} else {
+		body(0, n);
+	}
+}
+
+Bvh::Box SceneStore::getBounds(int index, const Bvh::Box &meshBounds) const
+{
+	// The animations are affine in their parameters, except for the spin,
+	// so the boxes at the extremes of the parameters bound the ones in
+	// between
+	Bvh::Box box = meshBounds.transformed(locals[index]);
+	int kind = animations[index];
+	if(kind == SPIN) {
+		// Any turn around y stays within the circle through the farthest corner
+		glm::vec3 far = glm::max(glm::abs(box.min), glm::abs(box.max));
+		float r = sqrt(far.x*far.x + far.z*far.z);
+		box = Bvh::Box(glm::vec3(-r, box.min.y, -r), glm::vec3(r, box.max.y, r));
+	} else if(kind == SHEAR) {
+		glm::mat4 S(1.0f);
+		S[1][2] = 0.5f;
+		Bvh::Box sheared = box.transformed(S);
+		S[1][2] = -0.5f;
+		box = sheared.united(box.transformed(S));
+	} else if(kind == BOUNCE) {
+		// Squashed to half on the ground, or full size at the top of the hop
+		glm::mat4 A(1.0f);
+		A[0][0] = A[2][2] = 0.5f;
+		Bvh::Box squashed = box.transformed(A);
+		A[0][0] = A[2][2] = 1.0f;
+		A[3][1] = 0.4f;
+		box = squashed.united(box.transformed(A));
+	}
+	const glm::vec3 &t = translations[index];
+	return Bvh::Box(box.min + t, box.max + t);
+}
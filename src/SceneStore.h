@@ -0,0 +1,122 @@
+#pragma once
+#ifndef SCENESTORE_H
+#define SCENESTORE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Bvh.h"
+
+class ThreadPool;
+
+/**
+ * The world objects, as one array per field instead of one struct per object.
+ * - An object's world matrix is T(translation)*A(time)*R(rotation)*S(scale),
+ *   with A its animation and R the rotations around x, then y, then z. The
+ *   R*S part only changes with the object, so it is kept with the object.
+ * - The arrays are dense: objects are numbered from 0 to size() - 1, and
+ *   remove() moves the last object into the hole. add() returns a handle
+ *   that keeps naming the object through removals. A handle is a slot, which
+ *   is reused after its object is removed, and the generation of the slot,
+ *   which counts its removals, so that the handles of removed objects are
+ *   never taken for the objects that reuse their slots. remove(), getIndex()
+ *   and the set*() methods assert that the handle is contained.
+ * - update() computes the modelview and normal matrices of some or all
+ *   objects in one pass over the arrays, without a branch per object. With a
+ *   thread pool, the pass is split over the threads.
+ * - The mesh of an object is an index into the caller's list of meshes.
+ * - getVersion() changes with every add(), remove() and set*(), so that
+ *   what is built from the objects (e.g. a Bvh of their bounds) can tell
+ *   when it is out of date.
+ */
+class SceneStore
+{
+public:
+	enum Animation
+	{
+		STATIC,
+		SPIN,   // Turns around y by time radians
+		SHEAR,  // Shears y into z by 0.5*cos(time)
+		BOUNCE, // Hops and squashes, see animation()
+		ANIMATIONS
+	};
+	// The generation in the high 32 bits, and the slot in the low ones
+	typedef uint64_t Handle;
+
+	// The matrix of an animation at time t
+	static glm::mat4 animation(int kind, double t);
+
+	SceneStore();
+	virtual ~SceneStore();
+	void reserve(int n);
+	Handle add(int mesh, int animation, const glm::vec3 &translation, const glm::vec3 &rotation, const glm::vec3 &scale, const glm::vec3 &ka, const glm::vec3 &kd, const glm::vec3 &ks, float s);
+	void remove(Handle handle);
+	bool contains(Handle handle) const;
+	int size() const { return (int)handles.size(); }
+	unsigned getVersion() const { return version; }
+	// Between handles and the current numbers of the objects
+	int getIndex(Handle handle) const;
+	Handle getHandle(int index) const { return handles[index]; }
+	void setTranslation(Handle handle, const glm::vec3 &translation);
+	void setRotation(Handle handle, const glm::vec3 &rotation);
+	void setScale(Handle handle, const glm::vec3 &scale);
+	void setThreadPool(const std::shared_ptr<ThreadPool> &pool) { this->pool = pool; }
+
+	// The fields, by object number
+	const std::vector<glm::vec3> &getTranslations() const { return translations; }
+	const std::vector<glm::vec3> &getRotations() const { return rotations; }
+	const std::vector<glm::vec3> &getScales() const { return scales; }
+	const std::vector<glm::mat4> &getLocals() const { return locals; }
+	const std::vector<int> &getMeshes() const { return meshes; }
+	const std::vector<int> &getAnimations() const { return animations; }
+	const std::vector<glm::vec3> &getAmbients() const { return ambients; }
+	const std::vector<glm::vec3> &getDiffuses() const { return diffuses; }
+	const std::vector<glm::vec3> &getSpeculars() const { return speculars; }
+	const std::vector<float> &getShininesses() const { return shininesses; }
+
+	// Computes the modelview and normal matrices of all objects at time t, by
+	// number
+	void update(double t, const glm::mat4 &V);
+	// Or only those of some objects, in the order of the list
+	void update(double t, const glm::mat4 &V, const std::vector<int> &list);
+	const std::vector<glm::mat4> &getModelViews() const { return modelViews; }
+	// The inverse transposes of the modelview matrices
+	const std::vector<glm::mat4> &getNormalMatrices() const { return normalMatrices; }
+	// The world box of an object at any time, from the box of its mesh
+	Bvh::Box getBounds(int index, const Bvh::Box &meshBounds) const;
+
+private:
+	static uint32_t slotOf(Handle handle) { return (uint32_t)handle; }
+	static uint32_t generationOf(Handle handle) { return (uint32_t)(handle >> 32); }
+	void updateLocal(int index);
+	// Updates the objects of the list, or all of them if list is null
+	void update(double t, const glm::mat4 &V, const std::vector<int> *list);
+
+	// Object numbers and generations by slot, with -1 for unused slots
+	std::vector<int> indices;
+	std::vector<uint32_t> generations;
+	std::vector<uint32_t> freeSlots;
+	// The objects
+	std::vector<Handle> handles;
+	std::vector<glm::vec3> translations;
+	std::vector<glm::vec3> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::mat4> locals;
+	std::vector<int> meshes;
+	std::vector<int> animations;
+	std::vector<glm::vec3> ambients;
+	std::vector<glm::vec3> diffuses;
+	std::vector<glm::vec3> speculars;
+	std::vector<float> shininesses;
+	// Output of update()
+	std::vector<glm::mat4> modelViews;
+	std::vector<glm::mat4> normalMatrices;
+	std::shared_ptr<ThreadPool> pool;
+	unsigned version;
+};
+
+#endif
@@ -1,22 +1,61 @@
 #include "Shape.h"
 #include <algorithm>
 #include <iostream>
+#include <sstream>
 
 #include "GLSL.h"
-#include "Program.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "ObjParser.h"
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
 
 using namespace std;
 
+// Hash map from the position, normal and texcoord indices of a face corner
+// to its vertex, with open addressing
+struct CornerMap
+{
+	CornerMap(size_t corners) :
+		mask(1)
+	{
+		while(mask < 2*corners) {
+			mask <<= 1;
+		}
+		slots.assign(mask, -1);
+		mask--;
+		keys.reserve(corners);
+	}
+
+	// Returns the vertex of the corner, adding it as vertex next if it is new
+	unsigned int insert(const ObjParser::Corner &idx, unsigned int next)
+	{
+		uint64_t h = (uint64_t)idx.v*73856093u ^ (uint64_t)idx.n*19349663u ^ (uint64_t)idx.t*83492791u;
+		for(size_t i = (h*0x9E3779B97F4A7C15ull) >> 20 & mask; ; i = (i + 1) & mask) {
+			int v = slots[i];
+			if(v == -1) {
+				slots[i] = (int)next;
+				keys.push_back(idx);
+				return next;
+			}
+			const ObjParser::Corner &key = keys[v];
+			if(key.v == idx.v && key.n == idx.n && key.t == idx.t) {
+				return (unsigned int)v;
+			}
+		}
+	}
+
+	size_t mask;
+	std::vector<int> slots;
+	std::vector<ObjParser::Corner> keys;
+};
+
 Shape::Shape() :
-	posBufID(0),
-	norBufID(0),
-	texBufID(0)
+	vertexCount(0),
+	indexCount(0),
+	mesh()
 {
 }
 
@@ -24,57 +63,126 @@ Shape::~Shape()
 {
 }
 
-void Shape::loadMesh(const string &meshName)
+void Shape::loadMesh(const string &meshName, const shared_ptr<ThreadPool> &pool)
+{
+	cache = make_shared<MeshCache>();
+	if(cache->open(meshName)) {
+		vertexCount = cache->getVertexCount();
+		indexCount = cache->getIndexCount();
+		lowest_y = cache->getLowestY();
+		// Meshes may be loaded concurrently, so print whole lines
+		ostringstream log;
+		log << meshName << ": " << indexCount << " vertices, " << vertexCount << " after removing duplicates (cached)\n";
+		cout << log.str() << flush;
+		return;
+	}
+	cache = nullptr;
+	if(!parseMesh(meshName, posBuf, norBuf, texBuf, indBuf, lowest_y, pool)) {
+		return;
+	}
+	vertexCount = (int)posBuf.size()/3;
+	indexCount = (int)indBuf.size();
+	MeshOptimizer::CacheStats before = MeshOptimizer::simulateCache(indBuf, vertexCount);
+	MeshOptimizer::optimize(indBuf, posBuf, norBuf, texBuf);
+	MeshOptimizer::CacheStats after = MeshOptimizer::simulateCache(indBuf, vertexCount);
+	vector<unsigned short> indBuf16 = shortIndices();
+	const void *indices = indBuf16.empty() ? (const void *)indBuf.data() : indBuf16.data();
+	ostringstream log;
+	if(MeshCache::write(meshName, posBuf, norBuf, texBuf, indices, indexCount, indexSize(), lowest_y)) {
+		log << "Wrote " << MeshCache::cacheName(meshName) << "\n";
+	}
+	log << meshName << ": " << indexCount << " vertices, " << vertexCount << " after removing duplicates, ";
+	log << "ACMR " << before.acmr << " -> " << after.acmr << "\n";
+	cout << log.str() << flush;
+}
+
+bool Shape::parseMesh(const string &meshName, vector<float> &posBuf, vector<float> &norBuf, vector<float> &texBuf, vector<unsigned int> &indBuf, float &lowest_y, const shared_ptr<ThreadPool> &pool)
 {
 	// Load geometry
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	string errStr;
-	bool rc = tinyobj::LoadObj(&attrib, &shapes, &materials, &errStr, meshName.c_str());
-	if(!rc) {
-		cerr << errStr << endl;
-	} else {
-		// Some OBJ files have different indices for vertex positions, normals,
-		// and texture coordinates. For example, a cube corner vertex may have
-		// three different normals. Here, we are going to duplicate all such
-		// vertices.
-		// Loop over shapes
-		lowest_y = 2000000000;
-		for(size_t s = 0; s < shapes.size(); s++) {
-			// Loop over faces (polygons)
-			size_t index_offset = 0;
-			for(size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-				size_t fv = shapes[s].mesh.num_face_vertices[f];
-				// Loop over vertices in the face.
-				for(size_t v = 0; v < fv; v++) {
-					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-					posBuf.push_back(attrib.vertices[3*idx.vertex_index+0]);
-					lowest_y = min(lowest_y, attrib.vertices[3*idx.vertex_index+1]);
-					posBuf.push_back(attrib.vertices[3*idx.vertex_index+1]);
-					posBuf.push_back(attrib.vertices[3*idx.vertex_index+2]);
-					if(!attrib.normals.empty()) {
-						norBuf.push_back(attrib.normals[3*idx.normal_index+0]);
-						norBuf.push_back(attrib.normals[3*idx.normal_index+1]);
-						norBuf.push_back(attrib.normals[3*idx.normal_index+2]);
-					}
-					if(!attrib.texcoords.empty()) {
-						texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+0]);
-						texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+1]);
-					}
-				}
-				index_offset += fv;
-				// per-face material (IGNORE)
-				shapes[s].mesh.material_ids[f];
+	ObjParser obj;
+	if(!obj.parse(meshName, pool)) {
+		return false;
+	}
+	int nv = (int)obj.positions.size()/3;
+	int nn = (int)obj.normals.size()/3;
+	int nt = (int)obj.texcoords.size()/2;
+	// Some OBJ files have different indices for vertex positions, normals,
+	// and texture coordinates. For example, a cube corner vertex may have
+	// three different normals. Here, we make one vertex per distinct
+	// combination of indices, and index it from every face using it.
+	CornerMap vertices(obj.corners.size());
+	indBuf.reserve(obj.corners.size());
+	lowest_y = 2000000000;
+	for(const ObjParser::Corner &idx : obj.corners) {
+		if(idx.v < 0 || idx.v >= nv || idx.n >= nn || idx.t >= nt) {
+			cerr << "Bad face index in " << meshName << endl;
+			return false;
+		}
+		unsigned int next = (unsigned int)posBuf.size()/3;
+		unsigned int vertex = vertices.insert(idx, next);
+		indBuf.push_back(vertex);
+		if(vertex != next) {
+			continue;
+		}
+		posBuf.push_back(obj.positions[3*idx.v+0]);
+		lowest_y = min(lowest_y, obj.positions[3*idx.v+1]);
+		posBuf.push_back(obj.positions[3*idx.v+1]);
+		posBuf.push_back(obj.positions[3*idx.v+2]);
+		// Corners without a normal or texcoord get zeros
+		if(nn > 0) {
+			for(int k = 0; k < 3; k++) {
+				norBuf.push_back(idx.n >= 0 ? obj.normals[3*idx.n+k] : 0.0f);
+			}
+		}
+		if(nt > 0) {
+			for(int k = 0; k < 2; k++) {
+				texBuf.push_back(idx.t >= 0 ? obj.texcoords[2*idx.t+k] : 0.0f);
 			}
 		}
 	}
+	return true;
+}
+
+int Shape::indexSize() const
+{
+	return vertexCount <= 0xFFFF ? 2 : 4;
+}
+
+vector<unsigned short> Shape::shortIndices() const
+{
+	if(indexSize() != 2) {
+		return vector<unsigned short>();
+	}
+	return vector<unsigned short>(indBuf.begin(), indBuf.end());
+}
+
+void Shape::readCache()
+{
+	if(!cache) {
+		return;
+	}
+	int n = cache->getVertexCount();
+	posBuf.assign(cache->getPositions(), cache->getPositions() + 3*n);
+	if(cache->getNormals()) {
+		norBuf.assign(cache->getNormals(), cache->getNormals() + 3*n);
+	}
+	if(cache->getTexcoords()) {
+		texBuf.assign(cache->getTexcoords(), cache->getTexcoords() + 2*n);
+	}
+	if(cache->getIndexSize() == 2) {
+		const unsigned short *indices = (const unsigned short *)cache->getIndices();
+		indBuf.assign(indices, indices + indexCount);
+	} else {
+		const unsigned int *indices = (const unsigned int *)cache->getIndices();
+		indBuf.assign(indices, indices + indexCount);
+	}
+	cache = nullptr;
 }
 
 void Shape::fitToUnitBox()
 {
 	// Scale the vertex positions so that they fit within [-1, +1] in all three dimensions.
+	readCache();
 	glm::vec3 vmin(posBuf[0], posBuf[1], posBuf[2]);
 	glm::vec3 vmax(posBuf[0], posBuf[1], posBuf[2]);
 	for(int i = 0; i < (int)posBuf.size(); i += 3) {
@@ -99,75 +207,50 @@ void Shape::fitToUnitBox()
 	}
 }
 
-void Shape::init()
+const float *Shape::getPositions() const
 {
-	// Send the position array to the GPU
-	glGenBuffers(1, &posBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_STATIC_DRAW);
-	
-	// Send the normal array to the GPU
-	if(!norBuf.empty()) {
-		glGenBuffers(1, &norBufID);
-		glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-		glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_STATIC_DRAW);
-	}
-	
-	// Send the texture array to the GPU
-	if(!texBuf.empty()) {
-		glGenBuffers(1, &texBufID);
-		glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-		glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
-	}
-	
-	// Unbind the arrays
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	GLSL::checkError(GET_FILE_LINE);
+	return cache ? cache->getPositions() : posBuf.data();
+}
+
+const float *Shape::getNormals() const
+{
+	if(cache) {
+		return cache->getNormals();
+	}
+	return norBuf.empty() ? NULL : norBuf.data();
+}
+
+vector<unsigned int> Shape::getIndices() const
+{
+	if(!cache) {
+		return indBuf;
+	}
+	if(cache->getIndexSize() == 2) {
+		const unsigned short *indices = (const unsigned short *)cache->getIndices();
+		return vector<unsigned int>(indices, indices + indexCount);
+	}
+	const unsigned int *indices = (const unsigned int *)cache->getIndices();
+	return vector<unsigned int>(indices, indices + indexCount);
+}
+
+void Shape::init(const shared_ptr<GeometryArena> &arena)
+{
+	// The arena uploads the cached buffers straight from the mapping, which
+	// it keeps until then
+	const float *pos = getPositions();
+	const float *nor = getNormals();
+	const float *tex = cache ? cache->getTexcoords() : (texBuf.empty() ? NULL : texBuf.data());
+	int format = tex ? GeometryArena::POSITION_NORMAL_TEXCOORD : GeometryArena::POSITION_NORMAL;
+	this->arena = arena;
+	if(cache) {
+		mesh = arena->add(format, vertexCount, pos, nor, tex, cache->getIndices(), cache->getIndexSize(), indexCount, cache);
+	} else {
+		mesh = arena->add(format, vertexCount, pos, nor, tex, indBuf.data(), sizeof(unsigned int), indexCount);
+	}
+	cache = nullptr;
 }
 
-void Shape::draw(const shared_ptr<Program> prog) const
+void Shape::draw(int instances) const
 {
-	// Bind position buffer
-	int h_pos = prog->getAttribute("aPos");
-	GLSL::checkError(GET_FILE_LINE);
-	glEnableVertexAttribArray(h_pos);
-	GLSL::checkError(GET_FILE_LINE);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	
-	GLSL::checkError(GET_FILE_LINE);
-
-	// Bind normal buffer
-	int h_nor = prog->getAttribute("aNor");
-	if(h_nor != -1 && norBufID != 0) {
-		glEnableVertexAttribArray(h_nor);
-		glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-		glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	}
-	
-	// Bind texcoords buffer
-	int h_tex = prog->getAttribute("aTex");
-	if(h_tex != -1 && texBufID != 0) {
-		glEnableVertexAttribArray(h_tex);
-		glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-		glVertexAttribPointer(h_tex, 2, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	}
-	GLSL::checkError(GET_FILE_LINE);
-	
-	// Draw
-	int count = posBuf.size()/3; // number of indices to be rendered
-	glDrawArrays(GL_TRIANGLES, 0, count);
-	
-	// Disable and unbind
-	if(h_tex != -1) {
-		glDisableVertexAttribArray(h_tex);
-	}
-	if(h_nor != -1) {
-		glDisableVertexAttribArray(h_nor);
-	}
-	glDisableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	GLSL::checkError(GET_FILE_LINE);
+	arena->draw(mesh, instances);
 }
@@ -6,33 +6,68 @@
 #include <vector>
 #include <memory>
 
-class Program;
+#include "GeometryArena.h"
+
+class MeshCache;
+class ThreadPool;
 
 /**
- * A shape defined by a list of triangles
- * - posBuf should be of length 3*ntris
- * - norBuf should be of length 3*ntris (if normals are available)
- * - texBuf should be of length 2*ntris (if texture coords are available)
- * posBufID, norBufID, and texBufID are OpenGL buffer identifiers.
+ * A shape defined by a list of indexed triangles
+ * - posBuf should be of length 3*nverts
+ * - norBuf should be of length 3*nverts (if normals are available)
+ * - texBuf should be of length 2*nverts (if texture coords are available)
+ * - indBuf should be of length 3*ntris
+ * init() adds the buffers to a GeometryArena, which draws them.
+ * The cache stores 16-bit indices when there are few enough vertices, as
+ * does the arena.
+ * If the mesh was loaded from its cache (see MeshCache), the buffers are
+ * read from the mapped cache instead, and the arena uploads them straight
+ * from the mapping.
  */
 class Shape
 {
 public:
 	Shape();
 	virtual ~Shape();
-	void loadMesh(const std::string &meshName);
+	// Loads the mesh from its cache if it is up to date, and otherwise
+	// parses (on the pool, if any) and optimizes the OBJ file and writes the
+	// cache. Doesn't need an OpenGL context.
+	void loadMesh(const std::string &meshName, const std::shared_ptr<ThreadPool> &pool = nullptr);
+	// Parses an OBJ file into indexed buffers, without optimizing them (see
+	// MeshOptimizer)
+	static bool parseMesh(const std::string &meshName, std::vector<float> &posBuf, std::vector<float> &norBuf, std::vector<float> &texBuf, std::vector<unsigned int> &indBuf, float &lowest_y, const std::shared_ptr<ThreadPool> &pool = nullptr);
 	void fitToUnitBox();
-	void init();
-	void draw(const std::shared_ptr<Program> prog) const;
+	// The mesh on the CPU, e.g. for SoftwareRenderer. A cached mesh is only
+	// there until init().
+	int getVertexCount() const { return vertexCount; }
+	const float *getPositions() const;
+	const float *getNormals() const;
+	std::vector<unsigned int> getIndices() const;
+	// Adds the mesh to the arena, to be uploaded with the others
+	void init(const std::shared_ptr<GeometryArena> &arena);
+	// Draws the shape. If instances > 0, draws that many instances, and the
+	// caller must have bound the per-instance attributes (see GeometryArena).
+	void draw(int instances = 0) const;
+	const GeometryArena::Mesh &getMesh() const { return mesh; }
 	float lowest_y;
 	
 private:
+	// Copies the cached buffers, so that they can be modified
+	void readCache();
+	// Size in bytes of the cached indices
+	int indexSize() const;
+	// The indices as 16-bit, or empty if they don't fit
+	std::vector<unsigned short> shortIndices() const;
+
+	std::shared_ptr<MeshCache> cache;
+	int vertexCount;
+	int indexCount;
 	std::vector<float> posBuf;
 	std::vector<float> norBuf;
 	std::vector<float> texBuf;
-	unsigned posBufID;
-	unsigned norBufID;
-	unsigned texBufID;
+	std::vector<unsigned int> indBuf;
+	std::shared_ptr<GeometryArena> arena;
+	GeometryArena::Mesh mesh;
 };
 
 #endif
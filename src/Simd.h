@@ -0,0 +1,96 @@
+#pragma once
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
+
+/**
+ * SIMD_WIDTH floats processed together: AVX2 (and FMA if enabled) or SSE2,
+ * whichever the compiler targets, and a single float otherwise.
+ * Comparisons return masks with all bits set in the lanes where they hold,
+ * to be used with select() and any().
+ */
+struct Floats
+{
+#if SIMD_WIDTH == 8
+	__m256 v;
+	Floats() {}
+	Floats(__m256 x) : v(x) {}
+	Floats(float x) : v(_mm256_set1_ps(x)) {}
+	static Floats load(const float *p) { return _mm256_loadu_ps(p); }
+	void store(float *p) const { _mm256_storeu_ps(p, v); }
+	friend Floats operator+(Floats a, Floats b) { return _mm256_add_ps(a.v, b.v); }
+	friend Floats operator-(Floats a, Floats b) { return _mm256_sub_ps(a.v, b.v); }
+	friend Floats operator*(Floats a, Floats b) { return _mm256_mul_ps(a.v, b.v); }
+	friend Floats operator/(Floats a, Floats b) { return _mm256_div_ps(a.v, b.v); }
+	friend Floats operator&(Floats a, Floats b) { return _mm256_and_ps(a.v, b.v); }
+	friend Floats operator==(Floats a, Floats b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+	friend Floats operator<(Floats a, Floats b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	friend Floats min(Floats a, Floats b) { return _mm256_min_ps(a.v, b.v); }
+	friend Floats max(Floats a, Floats b) { return _mm256_max_ps(a.v, b.v); }
+	friend Floats sqrt(Floats a) { return _mm256_sqrt_ps(a.v); }
+#ifdef __FMA__
+	friend Floats fmadd(Floats a, Floats b, Floats c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+#else
+	friend Floats fmadd(Floats a, Floats b, Floats c) { return _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v); }
+#endif
+	// a where mask is set, b elsewhere
+	friend Floats select(Floats mask, Floats a, Floats b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+	friend bool any(Floats mask) { return _mm256_movemask_ps(mask.v) != 0; }
+#elif SIMD_WIDTH == 4
+	__m128 v;
+	Floats() {}
+	Floats(__m128 x) : v(x) {}
+	Floats(float x) : v(_mm_set1_ps(x)) {}
+	static Floats load(const float *p) { return _mm_loadu_ps(p); }
+	void store(float *p) const { _mm_storeu_ps(p, v); }
+	friend Floats operator+(Floats a, Floats b) { return _mm_add_ps(a.v, b.v); }
+	friend Floats operator-(Floats a, Floats b) { return _mm_sub_ps(a.v, b.v); }
+	friend Floats operator*(Floats a, Floats b) { return _mm_mul_ps(a.v, b.v); }
+	friend Floats operator/(Floats a, Floats b) { return _mm_div_ps(a.v, b.v); }
+	friend Floats operator&(Floats a, Floats b) { return _mm_and_ps(a.v, b.v); }
+	friend Floats operator==(Floats a, Floats b) { return _mm_cmpeq_ps(a.v, b.v); }
+	friend Floats operator<(Floats a, Floats b) { return _mm_cmplt_ps(a.v, b.v); }
+	friend Floats min(Floats a, Floats b) { return _mm_min_ps(a.v, b.v); }
+	friend Floats max(Floats a, Floats b) { return _mm_max_ps(a.v, b.v); }
+	friend Floats sqrt(Floats a) { return _mm_sqrt_ps(a.v); }
+	friend Floats fmadd(Floats a, Floats b, Floats c) { return _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v); }
+	friend Floats select(Floats mask, Floats a, Floats b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+	friend bool any(Floats mask) { return _mm_movemask_ps(mask.v) != 0; }
+#else
+	float v;
+	Floats() {}
+	Floats(float x) : v(x) {}
+	static Floats load(const float *p) { return *p; }
+	void store(float *p) const { *p = v; }
+	friend Floats operator+(Floats a, Floats b) { return a.v + b.v; }
+	friend Floats operator-(Floats a, Floats b) { return a.v - b.v; }
+	friend Floats operator*(Floats a, Floats b) { return a.v * b.v; }
+	friend Floats operator/(Floats a, Floats b) { return a.v / b.v; }
+	friend Floats operator&(Floats a, Floats b) { return fromBits(bits(a) & bits(b)); }
+	friend Floats operator==(Floats a, Floats b) { return fromBits(a.v == b.v ? ~0u : 0u); }
+	friend Floats operator<(Floats a, Floats b) { return fromBits(a.v < b.v ? ~0u : 0u); }
+	friend Floats min(Floats a, Floats b) { return a.v < b.v ? a.v : b.v; }
+	friend Floats max(Floats a, Floats b) { return a.v > b.v ? a.v : b.v; }
+	friend Floats sqrt(Floats a) { return std::sqrt(a.v); }
+	friend Floats fmadd(Floats a, Floats b, Floats c) { return a.v*b.v + c.v; }
+	friend Floats select(Floats mask, Floats a, Floats b) { return bits(mask) ? a : b; }
+	friend bool any(Floats mask) { return bits(mask) != 0; }
+	static uint32_t bits(Floats a) { uint32_t u; memcpy(&u, &a.v, 4); return u; }
+	static Floats fromBits(uint32_t u) { float f; memcpy(&f, &u, 4); return f; }
+#endif
+};
+
+#endif
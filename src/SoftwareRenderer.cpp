@@ -0,0 +1,492 @@
+#include "SoftwareRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Transform.h"
+
+using namespace std;
+
+SoftwareRenderer::SoftwareRenderer() :
+	tileSize(32),
+	width(0),
+	height(0),
+	stride(0),
+	rows(0),
+	tilesX(0),
+	tilesY(0),
+	triangleCount(0)
+{
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+}
+
+int SoftwareRenderer::addMesh(int vertexCount, const float *positions, const float *normals, const vector<unsigned int> &indices, bool revo)
+{
+	Mesh mesh;
+	mesh.positions.assign(positions, positions + 3*vertexCount);
+	if(normals) {
+		mesh.normals.assign(normals, normals + 3*vertexCount);
+	} else {
+		mesh.normals.assign(3*vertexCount, 0.0f);
+	}
+	mesh.indices = indices;
+	mesh.revo = revo;
+	meshes.push_back(move(mesh));
+	return (int)meshes.size() - 1;
+}
+
+void SoftwareRenderer::begin(int w, int h)
+{
+	width = w;
+	height = h;
+	tileSize = max(SIMD_WIDTH, tileSize - tileSize % SIMD_WIDTH);
+	tilesX = (width + tileSize - 1)/tileSize;
+	tilesY = (height + tileSize - 1)/tileSize;
+	stride = tilesX*tileSize;
+	rows = tilesY*tileSize;
+	size_t size = (size_t)stride*rows;
+	// Each tile clears its own pixels when it is rasterized
+	depth.resize(size);
+	for(int k = 0; k < 3; k++) {
+		position[k].resize(size);
+		normal[k].resize(size);
+		ke[k].resize(size);
+		kd[k].resize(size);
+		color[k].resize(size);
+	}
+	draws.clear();
+}
+
+void SoftwareRenderer::draw(int mesh, const glm::mat4 &P, const glm::mat4 &MV, const glm::vec3 &ka, const glm::vec3 &kd, float time)
+{
+	Draw d;
+	d.mesh = mesh;
+	d.P = P;
+	d.MV = MV;
+	d.ka = ka;
+	d.kd = kd;
+	d.time = time;
+	d.firstVertex = 0;
+	d.firstTriangle = 0;
+	draws.push_back(d);
+}
+
+void SoftwareRenderer::parallelFor(int n, const function<void(int, int)> &body) const
+{
+	if(pool) {
+		pool->parallelFor(n, body);
+	} else if(n > 0) {
+		body(0, n);
+	}
+}
+
+void SoftwareRenderer::transformVertices(const Draw &d)
+{
+	const Mesh &mesh = meshes[d.mesh];
+	glm::mat3 IT(Transform::affineNormalMatrix(d.MV));
+	int n = (int)mesh.positions.size()/3;
+	for(int i = 0; i < n; i++) {
+		glm::vec3 p(mesh.positions[3*i], mesh.positions[3*i+1], mesh.positions[3*i+2]);
+		glm::vec3 nor(mesh.normals[3*i], mesh.normals[3*i+1], mesh.normals[3*i+2]);
+		if(mesh.revo) {
+			// The surface of revolution of vert.glsl, with p = (x, theta)
+			float r = cos(p.x + d.time) + 2.0f;
+			float dr = -sin(p.x + d.time);
+			glm::vec3 dpdx(1.0f, dr*cos(p.y), dr*sin(p.y));
+			glm::vec3 dpdt(0.0f, -r*sin(p.y), r*cos(p.y));
+			nor = glm::normalize(glm::cross(dpdt, dpdx));
+			p = glm::vec3(p.x, r*cos(p.y), r*sin(p.y));
+		}
+		Vertex &v = vertices[d.firstVertex + i];
+		glm::vec4 cam = d.MV*glm::vec4(p, 1.0f);
+		v.clip = d.P*cam;
+		v.position = glm::vec3(cam);
+		glm::vec3 n1 = IT*nor;
+		float len = glm::length(n1);
+		v.normal = len > 0.0f ? n1/len : n1;
+	}
+}
+
+void SoftwareRenderer::setupTriangle(const Vertex *v[3], int draw, Chunk &chunk) const
+{
+	// Clip against the near plane, z >= -w, which leaves 0, 3 or 4 corners
+	Vertex poly[4];
+	int n = 0;
+	for(int i = 0; i < 3; i++) {
+		const Vertex &a = *v[i];
+		const Vertex &b = *v[(i + 1) % 3];
+		float da = a.clip.z + a.clip.w;
+		float db = b.clip.z + b.clip.w;
+		if(da >= 0.0f) {
+			poly[n++] = a;
+		}
+		if((da >= 0.0f) != (db >= 0.0f)) {
+			float t = da/(da - db);
+			Vertex &c = poly[n++];
+			c.clip = glm::mix(a.clip, b.clip, t);
+			c.position = glm::mix(a.position, b.position, t);
+			c.normal = glm::mix(a.normal, b.normal, t);
+		}
+	}
+
+	// Fan out the polygon
+	for(int i = 1; i + 1 < n; i++) {
+		const Vertex *corners[3] = {&poly[0], &poly[i], &poly[i + 1]};
+		Triangle tri;
+		for(int k = 0; k < 3; k++) {
+			const Vertex &c = *corners[k];
+			float invW = 1.0f/c.clip.w;
+			tri.x[k] = (c.clip.x*invW*0.5f + 0.5f)*width;
+			tri.y[k] = (c.clip.y*invW*0.5f + 0.5f)*height;
+			tri.z[k] = c.clip.z*invW*0.5f + 0.5f;
+			tri.invW[k] = invW;
+			tri.position[k] = c.position*invW;
+			tri.normal[k] = c.normal*invW;
+		}
+		tri.draw = draw;
+		// Both windings are drawn, so make every triangle counterclockwise
+		float area = (tri.x[1] - tri.x[0])*(tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0])*(tri.y[1] - tri.y[0]);
+		if(!(area != 0.0f) || !isfinite(area)) {
+			continue;
+		}
+		if(area < 0.0f) {
+			swap(tri.x[1], tri.x[2]);
+			swap(tri.y[1], tri.y[2]);
+			swap(tri.z[1], tri.z[2]);
+			swap(tri.invW[1], tri.invW[2]);
+			swap(tri.position[1], tri.position[2]);
+			swap(tri.normal[1], tri.normal[2]);
+		}
+
+		// Bin into the tiles the bounding box overlaps
+		float xmin = min(tri.x[0], min(tri.x[1], tri.x[2]));
+		float xmax = max(tri.x[0], max(tri.x[1], tri.x[2]));
+		float ymin = min(tri.y[0], min(tri.y[1], tri.y[2]));
+		float ymax = max(tri.y[0], max(tri.y[1], tri.y[2]));
+		// The pixels whose centers are in the box, clamped to the screen before
+		// the conversion since clipped corners can be far off screen
+		float px0 = max(0.0f, ceil(xmin - 0.5f));
+		float px1 = min(width - 1.0f, floor(xmax - 0.5f));
+		float py0 = max(0.0f, ceil(ymin - 0.5f));
+		float py1 = min(height - 1.0f, floor(ymax - 0.5f));
+		if(px0 > px1 || py0 > py1) {
+			continue;
+		}
+		tri.box[0] = (int)px0;
+		tri.box[1] = (int)px1;
+		tri.box[2] = (int)py0;
+		tri.box[3] = (int)py1;
+		int tx0 = tri.box[0]/tileSize;
+		int tx1 = tri.box[1]/tileSize;
+		int ty0 = tri.box[2]/tileSize;
+		int ty1 = tri.box[3]/tileSize;
+		int index = (int)chunk.triangles.size();
+		chunk.triangles.push_back(tri);
+		for(int ty = ty0; ty <= ty1; ty++) {
+			for(int tx = tx0; tx <= tx1; tx++) {
+				chunk.bins[ty*tilesX + tx].push_back(index);
+			}
+		}
+	}
+}
+
+void SoftwareRenderer::rasterize()
+{
+	int nVertices = 0;
+	triangleCount = 0;
+	for(auto &d : draws) {
+		d.firstVertex = nVertices;
+		d.firstTriangle = triangleCount;
+		nVertices += (int)meshes[d.mesh].positions.size()/3;
+		triangleCount += (int)meshes[d.mesh].indices.size()/3;
+	}
+	vertices.resize(nVertices);
+	parallelFor((int)draws.size(), [this](int begin, int end) {
+		for(int i = begin; i < end; i++) {
+			transformVertices(draws[i]);
+		}
+	});
+
+	// Each chunk sets up a contiguous range of triangles, so the chunks are
+	// in draw order
+	int nChunks = min(max(1, triangleCount), pool ? 4*(pool->size() + 1) : 1);
+	chunks.resize(nChunks);
+	int nTiles = tilesX*tilesY;
+	parallelFor(nChunks, [this, nChunks, nTiles](int begin, int end) {
+		for(int c = begin; c < end; c++) {
+			Chunk &chunk = chunks[c];
+			chunk.triangles.clear();
+			chunk.bins.resize(nTiles);
+			for(auto &bin : chunk.bins) {
+				bin.clear();
+			}
+			int first = (int)((long long)triangleCount*c/nChunks);
+			int last = (int)((long long)triangleCount*(c + 1)/nChunks);
+			// The draw of the first triangle
+			int d = (int)(upper_bound(draws.begin(), draws.end(), first, [](int t, const Draw &draw) {
+				return t < draw.firstTriangle;
+			}) - draws.begin()) - 1;
+			for(int t = first; t < last; t++) {
+				while(d + 1 < (int)draws.size() && draws[d + 1].firstTriangle <= t) {
+					d++;
+				}
+				const Draw &draw = draws[d];
+				const vector<unsigned int> &indices = meshes[draw.mesh].indices;
+				int i = 3*(t - draw.firstTriangle);
+				const Vertex *v[3] = {
+					&vertices[draw.firstVertex + indices[i]],
+					&vertices[draw.firstVertex + indices[i+1]],
+					&vertices[draw.firstVertex + indices[i+2]]
+				};
+				setupTriangle(v, d, chunk);
+			}
+		}
+	});
+
+	parallelFor(nTiles, [this](int begin, int end) {
+		for(int tile = begin; tile < end; tile++) {
+			rasterizeTile(tile);
+		}
+	});
+}
+
+void SoftwareRenderer::rasterizeTile(int tile)
+{
+	int x0 = (tile % tilesX)*tileSize;
+	int y0 = (tile/tilesX)*tileSize;
+	int x1 = min(x0 + tileSize, width);
+	int y1 = min(y0 + tileSize, height);
+	for(int y = y0; y < y0 + tileSize; y++) {
+		size_t row = (size_t)y*stride;
+		fill(depth.begin() + row + x0, depth.begin() + row + x0 + tileSize, 1.0f);
+		for(int k = 0; k < 3; k++) {
+			fill(position[k].begin() + row + x0, position[k].begin() + row + x0 + tileSize, 0.0f);
+			fill(normal[k].begin() + row + x0, normal[k].begin() + row + x0 + tileSize, 0.0f);
+			fill(ke[k].begin() + row + x0, ke[k].begin() + row + x0 + tileSize, 0.0f);
+			fill(kd[k].begin() + row + x0, kd[k].begin() + row + x0 + tileSize, 0.0f);
+		}
+	}
+
+	for(const Chunk &chunk : chunks) {
+		for(int index : chunk.bins[tile]) {
+			const Triangle &tri = chunk.triangles[index];
+			const Draw &d = draws[tri.draw];
+			int px0 = max(x0, tri.box[0]);
+			int px1 = min(x1 - 1, tri.box[1]);
+			int py0 = max(y0, tri.box[2]);
+			int py1 = min(y1 - 1, tri.box[3]);
+
+			// Edge k is opposite corner k, and is positive inside. Pixels on
+			// an edge belong to the triangle only if it is a top or left edge.
+			double a[3], b[3], c[3];
+			bool topLeft[3];
+			for(int k = 0; k < 3; k++) {
+				int i = (k + 1) % 3;
+				int j = (k + 2) % 3;
+				double dx = (double)tri.x[j] - tri.x[i];
+				double dy = (double)tri.y[j] - tri.y[i];
+				a[k] = -dy;
+				b[k] = dx;
+				c[k] = dy*tri.x[i] - dx*tri.y[i];
+				topLeft[k] = dy < 0.0 || (dy == 0.0 && dx < 0.0);
+			}
+			double area = c[0] + c[1] + c[2];
+			for(int y = py0; y <= py1; y++) {
+				double sy = y + 0.5;
+				double sx = px0 + 0.5;
+				double e[3];
+				for(int k = 0; k < 3; k++) {
+					e[k] = a[k]*sx + b[k]*sy + c[k];
+				}
+				size_t row = (size_t)y*stride;
+				for(int x = px0; x <= px1; x++, e[0] += a[0], e[1] += a[1], e[2] += a[2]) {
+					bool inside = true;
+					for(int k = 0; k < 3; k++) {
+						inside = inside && (e[k] > 0.0 || (e[k] == 0.0 && topLeft[k]));
+					}
+					if(!inside) {
+						continue;
+					}
+					float l0 = (float)(e[0]/area);
+					float l1 = (float)(e[1]/area);
+					float l2 = (float)(e[2]/area);
+					float z = l0*tri.z[0] + l1*tri.z[1] + l2*tri.z[2];
+					size_t p = row + x;
+					if(!(z < depth[p])) {
+						continue;
+					}
+					depth[p] = z;
+					// Perspective-correct attributes
+					float w = 1.0f/(l0*tri.invW[0] + l1*tri.invW[1] + l2*tri.invW[2]);
+					glm::vec3 pos = (l0*tri.position[0] + l1*tri.position[1] + l2*tri.position[2])*w;
+					glm::vec3 nor = l0*tri.normal[0] + l1*tri.normal[1] + l2*tri.normal[2];
+					float len = glm::length(nor);
+					nor = len > 0.0f ? nor/len : nor;
+					for(int k = 0; k < 3; k++) {
+						position[k][p] = pos[k];
+						normal[k][p] = nor[k];
+						ke[k][p] = d.ka[k];
+						kd[k][p] = d.kd[k];
+					}
+				}
+			}
+		}
+	}
+}
+
+void SoftwareRenderer::shade(const vector<glm::vec3> &positions, const vector<glm::vec3> &colors, const vector<float> &radii, const glm::vec3 &ks, float s)
+{
+	parallelFor(tilesX*tilesY, [&](int begin, int end) {
+		for(int tile = begin; tile < end; tile++) {
+			shadeTile(tile, positions, colors, radii, ks, s);
+		}
+	});
+}
+
+// x^s for a whole exponent, by squaring
+static Floats powInt(Floats x, int s)
+{
+	Floats result(1.0f);
+	while(s > 0) {
+		if(s & 1) {
+			result = result*x;
+		}
+		x = x*x;
+		s >>= 1;
+	}
+	return result;
+}
+
+void SoftwareRenderer::shadeTile(int tile, const vector<glm::vec3> &positions, const vector<glm::vec3> &colors, const vector<float> &radii, const glm::vec3 &ks, float s)
+{
+	int x0 = (tile % tilesX)*tileSize;
+	int y0 = (tile/tilesX)*tileSize;
+	int y1 = min(y0 + tileSize, height);
+
+	// The lights reaching the bounding box of the tile's surfaces
+	vector<int> lights;
+	if(radii.empty()) {
+		for(int i = 0; i < (int)positions.size(); i++) {
+			lights.push_back(i);
+		}
+	} else {
+		glm::vec3 bmin(INFINITY);
+		glm::vec3 bmax(-INFINITY);
+		for(int y = y0; y < y1; y++) {
+			for(int x = x0; x < x0 + tileSize; x++) {
+				size_t p = (size_t)y*stride + x;
+				if(depth[p] < 1.0f) {
+					glm::vec3 pos(position[0][p], position[1][p], position[2][p]);
+					bmin = glm::min(bmin, pos);
+					bmax = glm::max(bmax, pos);
+				}
+			}
+		}
+		for(int i = 0; i < (int)positions.size(); i++) {
+			glm::vec3 nearest = glm::clamp(positions[i], bmin, bmax);
+			glm::vec3 diff = positions[i] - nearest;
+			if(radii[i] > 0.0f && glm::dot(diff, diff) <= radii[i]*radii[i]) {
+				lights.push_back(i);
+			}
+		}
+	}
+
+	bool wholeExponent = s >= 0.0f && s <= 64.0f && s == floor(s);
+	Floats zero(0.0f);
+	Floats one(1.0f);
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x0 + tileSize; x += SIMD_WIDTH) {
+			size_t p = (size_t)y*stride + x;
+			Floats ker = Floats::load(&ke[0][p]);
+			Floats keg = Floats::load(&ke[1][p]);
+			Floats keb = Floats::load(&ke[2][p]);
+			// Lit if covered and not emissive, like bp_frag.glsl
+			Floats lit = (Floats::load(&depth[p]) < one) & (ker == zero) & (keg == zero) & (keb == zero);
+			Floats r = ker;
+			Floats g = keg;
+			Floats b = keb;
+			if(any(lit) && !lights.empty()) {
+				Floats px = Floats::load(&position[0][p]);
+				Floats py = Floats::load(&position[1][p]);
+				Floats pz = Floats::load(&position[2][p]);
+				Floats nx = Floats::load(&normal[0][p]);
+				Floats ny = Floats::load(&normal[1][p]);
+				Floats nz = Floats::load(&normal[2][p]);
+				Floats kdr = Floats::load(&kd[0][p]);
+				Floats kdg = Floats::load(&kd[1][p]);
+				Floats kdb = Floats::load(&kd[2][p]);
+				// The direction to the eye, with a safe length where unlit
+				Floats eyeLen = select(lit, sqrt(px*px + py*py + pz*pz), one);
+				Floats vx = zero - px/eyeLen;
+				Floats vy = zero - py/eyeLen;
+				Floats vz = zero - pz/eyeLen;
+				Floats cr = zero;
+				Floats cg = zero;
+				Floats cb = zero;
+				for(int i : lights) {
+					Floats lx = Floats(positions[i].x) - px;
+					Floats ly = Floats(positions[i].y) - py;
+					Floats lz = Floats(positions[i].z) - pz;
+					Floats dist2 = fmadd(lx, lx, fmadd(ly, ly, lz*lz));
+					Floats dist = sqrt(dist2);
+					Floats invDist = one/select(lit, dist, one);
+					lx = lx*invDist;
+					ly = ly*invDist;
+					lz = lz*invDist;
+					Floats hx = vx + lx;
+					Floats hy = vy + ly;
+					Floats hz = vz + lz;
+					Floats hLen = sqrt(fmadd(hx, hx, fmadd(hy, hy, hz*hz)));
+					Floats invH = one/select(hLen < Floats(1e-20f), one, hLen);
+					Floats diffuse = max(zero, fmadd(lx, nx, fmadd(ly, ny, lz*nz)));
+					Floats cosH = max(zero, fmadd(hx, nx, fmadd(hy, ny, hz*nz))*invH);
+					Floats specular;
+					if(wholeExponent) {
+						specular = powInt(cosH, (int)s);
+					} else {
+						float lanes[SIMD_WIDTH];
+						cosH.store(lanes);
+						for(float &lane : lanes) {
+							lane = pow(lane, s);
+						}
+						specular = Floats::load(lanes);
+					}
+					Floats atten = one/fmadd(Floats(0.9857f), dist2, fmadd(Floats(0.0429f), dist, one));
+					Floats sr = specular*Floats(ks.x);
+					Floats sg = specular*Floats(ks.y);
+					Floats sb = specular*Floats(ks.z);
+					cr = fmadd(Floats(colors[i].x)*fmadd(kdr, diffuse, sr), atten, cr);
+					cg = fmadd(Floats(colors[i].y)*fmadd(kdg, diffuse, sg), atten, cg);
+					cb = fmadd(Floats(colors[i].z)*fmadd(kdb, diffuse, sb), atten, cb);
+				}
+				r = select(lit, r + cr, r);
+				g = select(lit, g + cg, g);
+				b = select(lit, b + cb, b);
+			}
+			r.store(&color[0][p]);
+			g.store(&color[1][p]);
+			b.store(&color[2][p]);
+		}
+	}
+}
+
+void SoftwareRenderer::getImage(vector<unsigned char> &rgba) const
+{
+	rgba.resize((size_t)4*width*height);
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			size_t p = (size_t)y*stride + x;
+			unsigned char *dst = &rgba[(size_t)4*(y*width + x)];
+			for(int k = 0; k < 3; k++) {
+				float c = min(max(color[k][p], 0.0f), 1.0f);
+				dst[k] = (unsigned char)(c*255.0f + 0.5f);
+			}
+			dst[3] = 255;
+		}
+	}
+}
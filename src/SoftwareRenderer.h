@@ -0,0 +1,133 @@
+#pragma once
+#ifndef SOFTWARERENDERER_H
+#define SOFTWARERENDERER_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class ThreadPool;
+
+/**
+ * A CPU implementation of the deferred pipeline, for reference images and
+ * machines without a GPU. It doesn't need an OpenGL context.
+ * - draw() queues a mesh, and rasterize() draws the queued meshes into the
+ *   G-buffer the way bp_vert.glsl (or vert.glsl for Revo meshes) and
+ *   dr_frag.glsl do, with a depth test.
+ * - shade() lights the G-buffer the way bp_frag.glsl does, with the
+ *   Blinn-Phong and attenuation loop over SIMD_WIDTH pixels at a time (see
+ *   Simd.h).
+ * The screen is split into tileSize x tileSize tiles, processed on the pool.
+ * The triangles are set up and clipped against the near plane in chunks, and
+ * each chunk bins its triangles into the tiles it overlaps. A tile then
+ * rasterizes the bins of every chunk in order, so that the result doesn't
+ * depend on the number of threads.
+ * Images are stored bottom row first, like OpenGL's.
+ */
+class SoftwareRenderer
+{
+public:
+	SoftwareRenderer();
+	virtual ~SoftwareRenderer();
+	void setThreadPool(std::shared_ptr<ThreadPool> p) { pool = p; }
+	// Must be a multiple of SIMD_WIDTH
+	void setTileSize(int size) { tileSize = size; }
+	// Copies a mesh, and returns its index. If revo is set, the positions are
+	// the (x, theta) parameters of a Revo surface.
+	int addMesh(int vertexCount, const float *positions, const float *normals, const std::vector<unsigned int> &indices, bool revo = false);
+	// Clears the G-buffer and the queued draws
+	void begin(int width, int height);
+	// Queues a draw. time is the Revo animation time.
+	void draw(int mesh, const glm::mat4 &P, const glm::mat4 &MV, const glm::vec3 &ka, const glm::vec3 &kd, float time = 0.0f);
+	void rasterize();
+	// Shades the G-buffer. The lights are in camera space. If there are radii,
+	// lights are skipped in the tiles whose surfaces are all beyond them, as
+	// in the tiled pass.
+	void shade(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &colors, const std::vector<float> &radii, const glm::vec3 &ks, float s);
+	// The shaded image as RGBA8
+	void getImage(std::vector<unsigned char> &rgba) const;
+	int getTriangleCount() const { return triangleCount; }
+
+private:
+	struct Mesh
+	{
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<unsigned int> indices;
+		bool revo;
+	};
+	struct Draw
+	{
+		int mesh;
+		glm::mat4 P;
+		glm::mat4 MV;
+		glm::vec3 ka;
+		glm::vec3 kd;
+		float time;
+		// Offsets into vertices, and into the triangles of all draws
+		int firstVertex;
+		int firstTriangle;
+	};
+	struct Vertex
+	{
+		glm::vec4 clip;
+		glm::vec3 position; // In camera space
+		glm::vec3 normal;
+	};
+	// A triangle ready for rasterization
+	struct Triangle
+	{
+		// Window coordinates, depth and 1/w of the corners
+		float x[3];
+		float y[3];
+		float z[3];
+		float invW[3];
+		// Camera-space position and normal of the corners, divided by w
+		glm::vec3 position[3];
+		glm::vec3 normal[3];
+		// The pixels with their centers in the bounding box: x0, x1, y0, y1
+		int box[4];
+		int draw;
+	};
+	// The triangles set up by one task, and their indices per tile
+	struct Chunk
+	{
+		std::vector<Triangle> triangles;
+		std::vector< std::vector<int> > bins;
+	};
+
+	void transformVertices(const Draw &d);
+	// Clips a triangle against the near plane, and adds the pieces to chunk
+	void setupTriangle(const Vertex *v[3], int draw, Chunk &chunk) const;
+	void rasterizeTile(int tile);
+	void shadeTile(int tile, const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &colors, const std::vector<float> &radii, const glm::vec3 &ks, float s);
+	// Calls body(begin, end) over [0, n), on the pool if there is one
+	void parallelFor(int n, const std::function<void(int, int)> &body) const;
+
+	std::shared_ptr<ThreadPool> pool;
+	int tileSize;
+	int width;
+	int height;
+	// Padded to whole tiles
+	int stride;
+	int rows;
+	int tilesX;
+	int tilesY;
+	int triangleCount;
+	std::vector<Mesh> meshes;
+	std::vector<Draw> draws;
+	std::vector<Vertex> vertices;
+	std::vector<Chunk> chunks;
+	// The G-buffer and the shaded colors, one plane per component
+	std::vector<float> depth;
+	std::vector<float> position[3];
+	std::vector<float> normal[3];
+	std::vector<float> ke[3];
+	std::vector<float> kd[3];
+	std::vector<float> color[3];
+};
+
+#endif
@@ -2,15 +2,16 @@
 
 #include <cmath>
 #include "GLSL.h"
+#include "MeshOptimizer.h"
 #include <glm/glm.hpp>
 
 using namespace std;
 
-Sphere::Sphere() : posBufID(0), norBufID(0), texBufID(0), indBufID(0) {}
+Sphere::Sphere() : mesh() {}
 
 Sphere::~Sphere() {}
 
-void Sphere::init(double radius) {
+void Sphere::generate(double radius) {
 
 	lowest_y = -radius;
 
@@ -52,63 +53,14 @@ void Sphere::init(double radius) {
 			indBuf.push_back(indStore[i+1][j]);
 		}
 	}
-
-	// Send the position array to the GPU
-	glGenBuffers(1, &posBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_STATIC_DRAW);
-	
-	// Send the normal array to the GPU
-	glGenBuffers(1, &norBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_STATIC_DRAW);
-	
-	// Send the texture array to the GPU
-	glGenBuffers(1, &texBufID);
-	glBindBuffer(GL_ARRAY_BUFFER, texBufID);
-	glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &indBufID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indBufID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indBuf.size()*sizeof(unsigned int), &indBuf[0], GL_STATIC_DRAW);
-	
-	// Unbind the arrays
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-	GLSL::checkError(GET_FILE_LINE);
+	MeshOptimizer::optimize(indBuf, posBuf, norBuf, texBuf);
 }
 
-void Sphere::draw(const std::shared_ptr<Program> prog) const {
-	// Bind position buffer
-	int h_pos = prog->getAttribute("aPos");
-	glEnableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-	
-	// Bind normal buffer
-	int h_nor = prog->getAttribute("aNor");
-	glEnableVertexAttribArray(h_nor);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-
-	GLSL::checkError(GET_FILE_LINE);
-	
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indBufID);
-
-	int indCount = (int)indBuf.size();
-	// Draw
-	// int count = posBuf.size()/3; // number of indices to be rendered
-	glDrawElements(GL_TRIANGLES, indCount, GL_UNSIGNED_INT, (const void* )0);
+void Sphere::init(const shared_ptr<GeometryArena> &arena) {
+	this->arena = arena;
+	mesh = arena->add(GeometryArena::POSITION_NORMAL_TEXCOORD, getVertexCount(), posBuf.data(), norBuf.data(), texBuf.data(), indBuf.data(), sizeof(unsigned int), (int)indBuf.size());
+}
 
-	GLSL::checkError(GET_FILE_LINE);
-	
-	// Disable and unbind
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDisableVertexAttribArray(h_nor);
-	glDisableVertexAttribArray(h_pos);
-	
-	GLSL::checkError(GET_FILE_LINE);
+void Sphere::draw(int instances) const {
+	arena->draw(mesh, instances);
 }
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "Program.h"
+#include "GeometryArena.h"
 #include <memory>
 #include <vector>
 #include <string>
@@ -10,16 +10,23 @@ class Sphere
 	public:
 		Sphere();
 		virtual ~Sphere();
-		void init(double radius);
-		void draw(const std::shared_ptr<Program> prog) const;
+		// Builds the mesh on the CPU, without an OpenGL context
+		void generate(double radius);
+		// Adds the generated mesh to the arena, to be uploaded with the others
+		void init(const std::shared_ptr<GeometryArena> &arena);
+		int getVertexCount() const { return (int)posBuf.size()/3; }
+		const float *getPositions() const { return posBuf.data(); }
+		const float *getNormals() const { return norBuf.data(); }
+		const std::vector<unsigned int> &getIndices() const { return indBuf; }
+		// If instances > 0, draws that many instances (see Shape::draw)
+		void draw(int instances = 0) const;
+		const GeometryArena::Mesh &getMesh() const { return mesh; }
 		float lowest_y = -1.0;
 	private:
 		std::vector<float> posBuf;
 		std::vector<float> norBuf;
 		std::vector<float> texBuf;
 		std::vector<unsigned int> indBuf;
-		unsigned posBufID;
-		unsigned norBufID;
-		unsigned texBufID;
-		unsigned indBufID;
+		std::shared_ptr<GeometryArena> arena;
+		GeometryArena::Mesh mesh;
 };
@@ -0,0 +1,154 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// The pool and queue of the calling thread, if it is a worker
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local int currentQueue = -1;
+
+ThreadPool::ThreadPool(int n) :
+	pending(0),
+	nextQueue(0),
+	stop(false)
+{
+	if(n <= 0) {
+		n = max(1, (int)thread::hardware_concurrency());
+	}
+	for(int i = 0; i < n; i++) {
+		queues.emplace_back(new Queue());
+	}
+	for(int i = 0; i < n; i++) {
+		workers.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	taskReady.notify_all();
+	for(auto &worker : workers) {
+		worker.join();
+	}
+}
+
+int ThreadPool::self() const
+{
+	return currentPool == this ? currentQueue : -1;
+}
+
+void ThreadPool::push(int queue, const function<void()> &task)
+{
+	// Counted first, so that pending never drops below the tasks in the queues
+	pending++;
+	{
+		lock_guard<std::mutex> lock(queues[queue]->mutex);
+		queues[queue]->tasks.push_back(task);
+	}
+	{
+		// A worker checks pending under the lock before sleeping
+		lock_guard<std::mutex> lock(mutex);
+	}
+	taskReady.notify_one();
+}
+
+void ThreadPool::submit(const function<void()> &task)
+{
+	int queue = self();
+	if(queue < 0) {
+		queue = (int)(nextQueue++ % queues.size());
+	}
+	push(queue, task);
+}
+
+bool ThreadPool::runOne(int self)
+{
+	int n = (int)queues.size();
+	int start = self >= 0 ? self : (int)(nextQueue % n);
+	for(int k = 0; k < n; k++) {
+		Queue &queue = *queues[(start + k) % n];
+		function<void()> task;
+		{
+			lock_guard<std::mutex> lock(queue.mutex);
+			if(queue.tasks.empty()) {
+				continue;
+			}
+			// The newest of our own tasks, or the oldest of someone else's
+			if(k == 0 && self >= 0) {
+				task = move(queue.tasks.back());
+				queue.tasks.pop_back();
+			} else {
+				task = move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+		}
+		pending--;
+		task();
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::work(int index)
+{
+	currentPool = this;
+	currentQueue = index;
+	while(true) {
+		if(runOne(index)) {
+			continue;
+		}
+		unique_lock<std::mutex> lock(mutex);
+		taskReady.wait(lock, [this] { return stop || pending > 0; });
+		if(stop && pending == 0) {
+			return;
+		}
+	}
+}
+
+void ThreadPool::parallelFor(int n, const function<void(int, int)> &body)
+{
+	if(n <= 0) {
+		return;
+	}
+	// The state is shared with the chunk tasks, which may still be finishing
+	// (or, for a stolen chunk, unwinding) after we have returned
+	struct Job
+	{
+		atomic<int> remaining;
+		int n;
+		int chunks;
+		const function<void(int, int)> *body;
+		std::mutex mutex;
+		condition_variable finished;
+	};
+	auto job = make_shared<Job>();
+	job->n = n;
+	job->chunks = min(n, 4*(size() + 1));
+	job->remaining = job->chunks;
+	job->body = &body;
+	// Each queue gets a contiguous run of chunks. The workers that run out
+	// steal from the others, and so do we while we wait.
+	for(int c = 0; c < job->chunks; c++) {
+		push((int)((long long)c*size()/job->chunks), [job, c]() {
+			int begin = (int)((long long)job->n*c/job->chunks);
+			int end = (int)((long long)job->n*(c + 1)/job->chunks);
+			(*job->body)(begin, end);
+			if(--job->remaining == 0) {
+				lock_guard<std::mutex> lock(job->mutex);
+				job->finished.notify_all();
+			}
+		});
+	}
+	int me = self();
+	while(job->remaining > 0) {
+		if(!runOne(me)) {
+			// Our chunks have all been taken, so wait for them
+			unique_lock<std::mutex> lock(job->mutex);
+			job->finished.wait(lock, [&job] { return job->remaining == 0; });
+		}
+	}
+}
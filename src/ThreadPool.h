@@ -0,0 +1,65 @@
+#pragma once
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads running submitted tasks, with work stealing.
+ * - Each worker has its own queue of tasks. A worker takes the newest task of
+ *   its own queue, and when that is empty steals the oldest task of another
+ *   queue, so that busy workers keep the tasks they spawned close at hand and
+ *   idle ones take the bigger, older pieces of work.
+ * - Tasks submitted by a worker go into its own queue, and those submitted
+ *   from other threads are dealt out to the queues in turn.
+ * - A thread waiting in parallelFor() runs queued tasks until its own are
+ *   done, so parallelFor() may be called from within tasks.
+ * - The destructor runs the queued tasks before stopping the workers.
+ */
+class ThreadPool
+{
+public:
+	// Starts n workers, or one per core if n <= 0
+	ThreadPool(int n = 0);
+	virtual ~ThreadPool();
+	int size() const { return (int)workers.size(); }
+	// Queues a task to be run by one of the workers
+	void submit(const std::function<void()> &task);
+	// Calls body(begin, end) on contiguous chunks covering [0, n), on the
+	// workers and the calling thread, and returns when all chunks are done
+	void parallelFor(int n, const std::function<void(int, int)> &body);
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque< std::function<void()> > tasks;
+	};
+
+	void work(int index);
+	// The index of the calling thread's queue, or -1 if it isn't a worker
+	int self() const;
+	void push(int queue, const std::function<void()> &task);
+	// Runs one queued task, preferring the queue of worker self. Returns false
+	// if there was none.
+	bool runOne(int self);
+
+	std::vector<std::thread> workers;
+	std::vector< std::unique_ptr<Queue> > queues;
+	// Tasks queued and not yet taken
+	std::atomic<int> pending;
+	std::atomic<unsigned> nextQueue;
+	// For sleeping workers
+	std::mutex mutex;
+	std::condition_variable taskReady;
+	bool stop;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "TiledLighting.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GLSL.h"
+#include "Program.h"
+
+using namespace std;
+
+TiledLighting::TiledLighting() :
+	tileSize(16),
+	maxLightsPerTile(256),
+	tilesX(0),
+	tilesY(0),
+	nLights(0),
+	overflowTiles(0),
+	overflowBuf(0),
+	lightBufID(0),
+	lightTexID(0),
+	tileBufID(0),
+	tileTexID(0)
+{
+	for(int k = 0; k < OVERFLOW_RING; k++) {
+		overflowBufIDs[k] = 0;
+		overflowFences[k] = 0;
+	}
+}
+
+TiledLighting::~TiledLighting()
+{
+}
+
+void TiledLighting::init(const string &resourceDir, const string &prelude)
+{
+	glGenBuffers(1, &lightBufID);
+	glGenTextures(1, &lightTexID);
+	glGenBuffers(1, &tileBufID);
+	glGenTextures(1, &tileTexID);
+
+	// The culling shader needs compute shaders and image stores
+	if(GLEW_VERSION_4_3) {
+		cullProg = make_shared<Program>();
+		cullProg->setComputeShaderName(resourceDir + "tiled_cull.glsl");
+		cullProg->setPrelude(prelude);
+		cullProg->setVerbose(true);
+		if(cullProg->init()) {
+			cullProg->addUniform("pos_tex");
+			cullProg->addUniform("lights");
+			cullProg->addUniform("num_lights");
+			cullProg->addUniform("tile_size");
+			cullProg->addUniform("max_lights");
+			cullProg->addUniform("window_size");
+			cullProg->addUniform("proj");
+			cullProg->addUniform("inv_proj");
+			cullProg->setVerbose(false);
+			cullProg->bind();
+			glUniform1i(cullProg->getUniform("pos_tex"), 0);
+			glUniform1i(cullProg->getUniform("lights"), 1);
+			cullProg->unbind();
+			glGenBuffers(OVERFLOW_RING, overflowBufIDs);
+			GLuint zero = 0;
+			for(GLuint bufID : overflowBufIDs) {
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufID);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_READ);
+			}
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		} else {
+			cullProg = nullptr;
+		}
+	}
+	if(!cullProg) {
+		cout << "Compute shaders not supported, building the light tiles on the CPU" << endl;
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void TiledLighting::setLights(const vector<glm::vec3> &positions, const vector<glm::vec3> &colors, const vector<float> &radii)
+{
+	nLights = (int)positions.size();
+	lightBuf.resize(8*nLights);
+	for(int i = 0; i < nLights; i++) {
+		float *l = &lightBuf[8*i];
+		l[0] = positions[i].x;
+		l[1] = positions[i].y;
+		l[2] = positions[i].z;
+		l[3] = radii[i];
+		l[4] = colors[i].r;
+		l[5] = colors[i].g;
+		l[6] = colors[i].b;
+		l[7] = 0.0f;
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, lightBufID);
+	glBufferData(GL_TEXTURE_BUFFER, max((size_t)1, lightBuf.size())*sizeof(float), lightBuf.empty() ? NULL : &lightBuf[0], GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, lightTexID);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBufID);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void TiledLighting::resize(int width, int height)
+{
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+	size_t size = (size_t)tilesX*tilesY*(maxLightsPerTile + 1);
+	if(size == tileBuf.size()) {
+		return;
+	}
+	tileBuf.resize(size);
+	glBindBuffer(GL_TEXTURE_BUFFER, tileBufID);
+	glBufferData(GL_TEXTURE_BUFFER, size*sizeof(int), NULL, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, tileTexID);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, tileBufID);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void TiledLighting::cullCPU(const glm::mat4 &P, int width, int height)
+{
+	resize(width, height);
+	int stride = maxLightsPerTile + 1;
+	fill(tileBuf.begin(), tileBuf.end(), 0);
+	vector<bool> overflowed(tilesX*tilesY, false);
+	overflowTiles = 0;
+	for(int i = 0; i < nLights; i++) {
+		glm::vec3 c(lightBuf[8*i], lightBuf[8*i+1], lightBuf[8*i+2]);
+		float r = lightBuf[8*i+3];
+		if(r <= 0.0f || c.z - r >= 0.0f) {
+			// No influence, or behind the camera
+			continue;
+		}
+		// Screen bounds of the light's bounding box, or the whole screen if
+		// the box reaches behind the camera
+		float lo[2] = {-1.0f, -1.0f};
+		float hi[2] = {1.0f, 1.0f};
+		if(c.z + r < 0.0f) {
+			lo[0] = lo[1] = 1.0f;
+			hi[0] = hi[1] = -1.0f;
+			for(int k = 0; k < 8; k++) {
+				glm::vec4 corner(c.x + ((k & 1) ? r : -r), c.y + ((k & 2) ? r : -r), c.z + ((k & 4) ? r : -r), 1.0f);
+				glm::vec4 clip = P * corner;
+				for(int j = 0; j < 2; j++) {
+					float ndc = min(max(clip[j]/clip.w, -1.0f), 1.0f);
+					lo[j] = min(lo[j], ndc);
+					hi[j] = max(hi[j], ndc);
+				}
+			}
+		}
+		int tx0 = max(0, (int)((lo[0]*0.5f + 0.5f)*width) / tileSize);
+		int ty0 = max(0, (int)((lo[1]*0.5f + 0.5f)*height) / tileSize);
+		int tx1 = min(tilesX - 1, (int)((hi[0]*0.5f + 0.5f)*width) / tileSize);
+		int ty1 = min(tilesY - 1, (int)((hi[1]*0.5f + 0.5f)*height) / tileSize);
+		for(int ty = ty0; ty <= ty1; ty++) {
+			for(int tx = tx0; tx <= tx1; tx++) {
+				int *tile = &tileBuf[(ty*tilesX + tx)*stride];
+				if(tile[0] < maxLightsPerTile) {
+					tile[1 + tile[0]++] = i;
+				} else if(!overflowed[ty*tilesX + tx]) {
+					overflowed[ty*tilesX + tx] = true;
+					overflowTiles++;
+				}
+			}
+		}
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, tileBufID);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, tileBuf.size()*sizeof(int), &tileBuf[0]);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void TiledLighting::cullGPU(const glm::mat4 &P, int width, int height, GLuint pos_tex)
+{
+	resize(width, height);
+	cullProg->bind();
+	glUniform1i(cullProg->getUniform("num_lights"), nLights);
+	glUniform1i(cullProg->getUniform("tile_size"), tileSize);
+	glUniform1i(cullProg->getUniform("max_lights"), maxLightsPerTile);
+	glUniform2i(cullProg->getUniform("window_size"), width, height);
+	glUniform2f(cullProg->getUniform("proj"), P[0][0], P[1][1]);
+	glm::mat4 invP = glm::inverse(P);
+	glUniformMatrix4fv(cullProg->getUniform("inv_proj"), 1, GL_FALSE, glm::value_ptr(invP));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, pos_tex);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, lightTexID);
+	glBindImageTexture(0, tileTexID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32I);
+	// Read the counts that are ready, oldest first, without waiting
+	for(int k = 1; k <= OVERFLOW_RING; k++) {
+		int i = (overflowBuf + k) % OVERFLOW_RING;
+		if(!overflowFences[i]) {
+			continue;
+		}
+		GLenum status = glClientWaitSync(overflowFences[i], 0, 0);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break;
+		}
+		GLuint count = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBufIDs[i]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+		overflowTiles = (int)count;
+		glDeleteSync(overflowFences[i]);
+		overflowFences[i] = 0;
+	}
+	// The GPU is a whole ring behind if this count isn't ready yet
+	if(overflowFences[overflowBuf]) {
+		glDeleteSync(overflowFences[overflowBuf]);
+		overflowFences[overflowBuf] = 0;
+	}
+	GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBufIDs[overflowBuf]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, overflowBufIDs[overflowBuf]);
+	glDispatchCompute(tilesX, tilesY, 1);
+	// The lighting pass reads the lists as a texture, and a later cull the
+	// count
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	overflowFences[overflowBuf] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	overflowBuf = (overflowBuf + 1) % OVERFLOW_RING;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+	cullProg->unbind();
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void TiledLighting::bind(const shared_ptr<Program> prog, int unit) const
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, lightTexID);
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_BUFFER, tileTexID);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(prog->getUniform("lights"), unit);
+	glUniform1i(prog->getUniform("tiles"), unit + 1);
+	glUniform1i(prog->getUniform("tile_size"), tileSize);
+	glUniform1i(prog->getUniform("tiles_x"), tilesX);
+	glUniform1i(prog->getUniform("max_lights"), maxLightsPerTile);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void TiledLighting::unbind(int unit) const
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef TILEDLIGHTING_H
+#define TILEDLIGHTING_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Program;
+
+/**
+ * Per-tile light lists for tiled deferred shading.
+ * The screen is split into tileSize x tileSize pixel tiles, and each tile
+ * gets the list of the lights whose sphere of influence may overlap it. The
+ * lists are built either by a compute shader, which also culls against the
+ * depth range of each tile, or on the CPU from the projected light bounds
+ * when compute shaders are not available.
+ * - lights: texture buffer with two RGBA32F texels per light,
+ *   (camera-space position, radius) and (color, 0)
+ * - tiles: texture buffer with maxLightsPerTile+1 R32I texels per tile,
+ *   the number of lights followed by their indices
+ * - A tile with more than maxLightsPerTile lights keeps the first ones, and
+ *   is counted in getOverflowTiles()
+ */
+class TiledLighting
+{
+public:
+	TiledLighting();
+	virtual ~TiledLighting();
+	void setTileSize(int size) { tileSize = size; }
+	void setMaxLightsPerTile(int n) { maxLightsPerTile = n; }
+	int getTileSize() const { return tileSize; }
+	int getMaxLightsPerTile() const { return maxLightsPerTile; }
+	// The prelude declares the G-buffer layout, see Program::setPrelude()
+	void init(const std::string &resourceDir, const std::string &prelude);
+	bool hasCompute() const { return cullProg != nullptr; }
+	// Uploads the lights, with positions in camera space
+	void setLights(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &colors, const std::vector<float> &radii);
+	// Builds the tile lists on the CPU
+	void cullCPU(const glm::mat4 &P, int width, int height);
+	// Builds the tile lists with the compute shader, reading the positions
+	// of the G-buffer
+	void cullGPU(const glm::mat4 &P, int width, int height, GLuint pos_tex);
+	// The number of tiles whose lists were cut by the last cullCPU(), or by
+	// the latest cullGPU() that the GPU has finished, so as not to wait for
+	// it
+	int getOverflowTiles() const { return overflowTiles; }
+	// Binds the light and tile buffers to texture units unit and unit+1, and
+	// sets the uniforms of the tiled lighting shader
+	void bind(const std::shared_ptr<Program> prog, int unit) const;
+	void unbind(int unit) const;
+
+private:
+	void resize(int width, int height);
+
+	int tileSize;
+	int maxLightsPerTile;
+	int tilesX;
+	int tilesY;
+	int nLights;
+	std::vector<float> lightBuf;
+	std::vector<int> tileBuf;
+	int overflowTiles;
+	std::shared_ptr<Program> cullProg;
+	// Storage buffers of the overflow counts of the compute shader, written
+	// by cullGPU() in turn, each with a fence that is signalled when its
+	// count is ready. The counts the GPU hasn't finished when their buffer
+	// comes around again are skipped.
+	static const int OVERFLOW_RING = 3;
+	GLuint overflowBufIDs[OVERFLOW_RING];
+	GLsync overflowFences[OVERFLOW_RING];
+	int overflowBuf;
+	GLuint lightBufID;
+	GLuint lightTexID;
+	GLuint tileBufID;
+	GLuint tileTexID;
+};
+
+#endif
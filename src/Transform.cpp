@@ -0,0 +1,121 @@
+#include "Transform.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Simd.h"
+
+using namespace std;
+
+Transform Transform::translation(const glm::vec3 &t)
+{
+	return Transform(glm::translate(glm::mat4(1.0f), t), TRANSLATION);
+}
+
+Transform Transform::rotation(float angle, const glm::vec3 &axis)
+{
+	return Transform(glm::rotate(glm::mat4(1.0f), angle, axis), ROTATION);
+}
+
+Transform Transform::scale(const glm::vec3 &s)
+{
+	bool uniform = s.x == s.y && s.y == s.z;
+	return Transform(glm::scale(glm::mat4(1.0f), s), uniform ? UNIFORM_SCALE : SCALE);
+}
+
+Transform Transform::scale(float s)
+{
+	return scale(glm::vec3(s));
+}
+
+// The 4x4 inverse transpose of an affine matrix with translation t, from the
+// inverse transpose N of its upper 3x3: N, with -(A^-1*t) = -(N^T*t) in the
+// last row
+static glm::mat4 withTranslation(const glm::mat3 &N, const glm::vec3 &t)
+{
+	glm::mat4 IT(N);
+	for(int c = 0; c < 3; c++) {
+		IT[c][3] = -glm::dot(N[c], t);
+	}
+	return IT;
+}
+
+glm::mat4 Transform::normalMatrix() const
+{
+	if(parts & PROJECTIVE) {
+		return glm::inverse(glm::transpose(M));
+	}
+	if(parts & (SCALE | SHEAR)) {
+		return affineNormalMatrix(M);
+	}
+	glm::mat3 A(M);
+	if(parts & UNIFORM_SCALE) {
+		A /= glm::dot(A[0], A[0]);
+	}
+	return withTranslation(A, glm::vec3(M[3]));
+}
+
+glm::mat4 Transform::affineNormalMatrix(const glm::mat4 &M)
+{
+	glm::vec3 a0(M[0]);
+	glm::vec3 a1(M[1]);
+	glm::vec3 a2(M[2]);
+	glm::mat3 C(glm::cross(a1, a2), glm::cross(a2, a0), glm::cross(a0, a1));
+	return withTranslation(C/glm::dot(a0, C[0]), glm::vec3(M[3]));
+}
+
+void Transform::normalMatrices(const glm::mat4 *M, glm::mat4 *N, int n)
+{
+	// Lane k of the Floats holds matrix i + k: the 9 entries of the upper 3x3
+	// and the translation, gathered into rows of SIMD_WIDTH floats
+	int i = 0;
+	for(; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+		float in[12][SIMD_WIDTH];
+		for(int k = 0; k < SIMD_WIDTH; k++) {
+			const glm::mat4 &m = M[i + k];
+			for(int c = 0; c < 4; c++) {
+				for(int r = 0; r < 3; r++) {
+					in[3*c + r][k] = m[c][r];
+				}
+			}
+		}
+		Floats a[4][3];
+		for(int c = 0; c < 4; c++) {
+			for(int r = 0; r < 3; r++) {
+				a[c][r] = Floats::load(in[3*c + r]);
+			}
+		}
+		// The cofactor columns, a1 x a2, a2 x a0 and a0 x a1
+		Floats cof[3][3];
+		for(int c = 0; c < 3; c++) {
+			const Floats *u = a[(c + 1) % 3];
+			const Floats *v = a[(c + 2) % 3];
+			cof[c][0] = u[1]*v[2] - u[2]*v[1];
+			cof[c][1] = u[2]*v[0] - u[0]*v[2];
+			cof[c][2] = u[0]*v[1] - u[1]*v[0];
+		}
+		Floats invDet = Floats(1.0f)/(a[0][0]*cof[0][0] + a[0][1]*cof[0][1] + a[0][2]*cof[0][2]);
+		float out[12][SIMD_WIDTH];
+		for(int c = 0; c < 3; c++) {
+			Floats n0 = cof[c][0]*invDet;
+			Floats n1 = cof[c][1]*invDet;
+			Floats n2 = cof[c][2]*invDet;
+			n0.store(out[4*c]);
+			n1.store(out[4*c + 1]);
+			n2.store(out[4*c + 2]);
+			// The last row, -(N^T*t)
+			(Floats(0.0f) - (n0*a[3][0] + n1*a[3][1] + n2*a[3][2])).store(out[4*c + 3]);
+		}
+		for(int k = 0; k < SIMD_WIDTH; k++) {
+			glm::mat4 &m = N[i + k];
+			for(int c = 0; c < 3; c++) {
+				for(int r = 0; r < 4; r++) {
+					m[c][r] = out[4*c + r][k];
+				}
+			}
+			m[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+	}
+	for(; i < n; i++) {
+		N[i] = affineNormalMatrix(M[i]);
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/**
+ * A 4x4 matrix that remembers what it was made of, so that its normal matrix
+ * (the inverse transpose) can skip the general 4x4 inverse.
+ * - Without scales or shears, the upper 3x3 is a rotation, and is its own
+ *   inverse transpose. With a uniform scale s it is s*R, whose inverse
+ *   transpose is itself divided by s^2.
+ * - Any other affine matrix A (with translation t) has the inverse transpose
+ *   cof(A)/det(A), whose columns are the cross products of the columns of A,
+ *   and -A^-1*t in the last row. normalMatrices() does that for arrays of
+ *   matrices, SIMD_WIDTH matrices at a time (see Simd.h).
+ * - Only PROJECTIVE matrices, whose last row isn't 0 0 0 1, need
+ *   glm::inverse().
+ * - The product of two transforms is made of the parts of both.
+ */
+class Transform
+{
+public:
+	enum Part
+	{
+		TRANSLATION = 1,
+		ROTATION = 2,
+		UNIFORM_SCALE = 4,
+		SCALE = 8, // Non-uniform
+		SHEAR = 16,
+		PROJECTIVE = 32
+	};
+
+	Transform() : M(1.0f), parts(0) {}
+	// parts are the Part bits of M
+	Transform(const glm::mat4 &M, unsigned parts) : M(M), parts(parts) {}
+	static Transform translation(const glm::vec3 &t);
+	// Around an axis of any length, angle in radians
+	static Transform rotation(float angle, const glm::vec3 &axis);
+	static Transform scale(const glm::vec3 &s);
+	static Transform scale(float s);
+	Transform operator*(const Transform &b) const { return Transform(M*b.M, parts | b.parts); }
+	const glm::mat4 &getMatrix() const { return M; }
+	unsigned getParts() const { return parts; }
+
+	// The inverse transpose of the matrix, the cheapest way its parts allow
+	glm::mat4 normalMatrix() const;
+	// The inverse transpose of any affine matrix, from its cofactors
+	static glm::mat4 affineNormalMatrix(const glm::mat4 &M);
+	// affineNormalMatrix() of n matrices
+	static void normalMatrices(const glm::mat4 *M, glm::mat4 *N, int n);
+
+private:
+	glm::mat4 M;
+	unsigned parts;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "UniformBlocks.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "GLSL.h"
+#include "Transform.h"
+
+using namespace std;
+
+// The layouts std140 gives the blocks in the shaders
+static_assert(sizeof(UniformBlocks::Frame) == 480, "Frame doesn't match its std140 layout");
+static_assert(sizeof(UniformBlocks::Object) == 160, "Object doesn't match its std140 layout");
+
+UniformBlocks::UniformBlocks() :
+	ringSize(3),
+	sync(false),
+	frameBufID(0),
+	objectBufID(0),
+	stride(0),
+	capacity(0),
+	segment(-1),
+	count(0)
+{
+}
+
+UniformBlocks::~UniformBlocks()
+{
+}
+
+void UniformBlocks::init()
+{
+	glGenBuffers(1, &frameBufID);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameBufID);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Frame), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameBufID);
+
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = max(alignment, 1);
+	stride = (sizeof(Object) + alignment - 1)/alignment*alignment;
+	sync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+	if(!sync) {
+		cout << "Sync objects not supported, updating object blocks synchronously" << endl;
+	}
+	ringSize = max(1, ringSize);
+	glGenBuffers(1, &objectBufID);
+	allocRing(256);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void UniformBlocks::allocRing(int c)
+{
+	// New storage, so the fences of the old one don't matter anymore
+	for(GLsync &fence : fences) {
+		if(fence) {
+			glDeleteSync(fence);
+		}
+	}
+	fences.assign(ringSize, 0);
+	capacity = c;
+	segment = -1;
+	glBindBuffer(GL_UNIFORM_BUFFER, objectBufID);
+	glBufferData(GL_UNIFORM_BUFFER, ringSize*capacity*stride, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBlocks::setFrame(const Frame &frame)
+{
+	// Orphan the previous frame's block so that we don't wait on it
+	glBindBuffer(GL_UNIFORM_BUFFER, frameBufID);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Frame), &frame, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameBufID);
+	count = 0;
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+int UniformBlocks::addObject(const glm::mat4 &MV, const glm::vec3 &ka, const glm::vec3 &kd)
+{
+	return addObject(MV, Transform::affineNormalMatrix(MV), ka, kd);
+}
+
+int UniformBlocks::addObject(const glm::mat4 &MV, const glm::mat4 &IT, const glm::vec3 &ka, const glm::vec3 &kd)
+{
+	if((count + 1)*stride > objects.size()) {
+		objects.resize(max((count + 1)*stride, 2*objects.size()));
+	}
+	Object object;
+	object.MV = MV;
+	object.IT = IT;
+	object.ka = ka;
+	object.pad0 = 0.0f;
+	object.kd = kd;
+	object.pad1 = 0.0f;
+	memcpy(&objects[count*stride], &object, sizeof(Object));
+	return count++;
+}
+
+void UniformBlocks::uploadObjects()
+{
+	if(sync && segment >= 0) {
+		// Signals once the draws of the previous frame, which read its
+		// segment, are done
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	if(count > capacity) {
+		allocRing(max(count, 2*capacity));
+	}
+	segment = (segment + 1) % ringSize;
+	if(count == 0) {
+		return;
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, objectBufID);
+	size_t offset = segment*capacity*stride;
+	size_t size = count*stride;
+	if(sync) {
+		GLsync &fence = fences[segment];
+		if(fence) {
+			GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while(status == GL_TIMEOUT_EXPIRED) {
+				status = glClientWaitSync(fence, 0, 1000000000);
+			}
+			glDeleteSync(fence);
+			fence = 0;
+		}
+		// The GPU is done with the segment, so there is nothing to wait for
+		GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+		void *mapped = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, access);
+		if(mapped) {
+			memcpy(mapped, objects.data(), size);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+	} else {
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, objects.data());
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void UniformBlocks::bindObject(int index) const
+{
+	size_t offset = ((size_t)segment*capacity + index)*stride;
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BINDING, objectBufID, offset, sizeof(Object));
+}
@@ -0,0 +1,86 @@
+#pragma once
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/**
+ * The std140 uniform blocks of the shaders, which must declare them the same
+ * way (see bp_vert.glsl).
+ * - The Frame block is uploaded once per frame, and shared by all programs
+ *   through FRAME_BINDING.
+ * - The Object blocks of a frame are added one per draw, uploaded together
+ *   into the next segment of a ring buffer, and bound to OBJECT_BINDING with
+ *   glBindBufferRange() before each draw. With sync objects, a segment is
+ *   only written once the GPU is done with the frame that last used it.
+ * - Needs OpenGL 3.1 or ARB_uniform_buffer_object.
+ */
+class UniformBlocks
+{
+public:
+	enum { FRAME_BINDING = 0, OBJECT_BINDING = 1 };
+	static const int MAX_LIGHTS = 10;
+
+	struct Frame
+	{
+		glm::mat4 projection;
+		glm::mat4 view;
+		// std140 pads the elements of vec3 arrays to 16 bytes
+		glm::vec4 light_positions[MAX_LIGHTS]; // In camera space
+		glm::vec4 light_colors[MAX_LIGHTS];
+		glm::vec3 ks;
+		float s;
+		glm::vec2 window_size;
+		float time;
+		int num_lights;
+	};
+	struct Object
+	{
+		glm::mat4 MV;
+		glm::mat4 IT;
+		glm::vec3 ka;
+		float pad0;
+		glm::vec3 kd;
+		float pad1;
+	};
+
+	UniformBlocks();
+	virtual ~UniformBlocks();
+	void setRingSize(int n) { ringSize = n; }
+	void init();
+	// Uploads the frame block, and starts the objects of the frame
+	void setFrame(const Frame &frame);
+	// Adds the block of a draw, and returns its index in the frame. MV must be
+	// affine.
+	int addObject(const glm::mat4 &MV, const glm::vec3 &ka, const glm::vec3 &kd);
+	// With the inverse transpose of MV already computed
+	int addObject(const glm::mat4 &MV, const glm::mat4 &IT, const glm::vec3 &ka, const glm::vec3 &kd);
+	// Uploads the blocks added since setFrame()
+	void uploadObjects();
+	// Binds the block of a draw of this frame
+	void bindObject(int index) const;
+
+private:
+	void allocRing(int capacity);
+
+	int ringSize;
+	bool sync;
+	GLuint frameBufID;
+	GLuint objectBufID;
+	// Bytes between object blocks, a multiple of the offset alignment
+	size_t stride;
+	// Objects per segment
+	int capacity;
+	int segment;
+	std::vector<GLsync> fences;
+	std::vector<unsigned char> objects;
+	int count;
+};
+
+#endif
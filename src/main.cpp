@@ -1,13 +1,16 @@
 #include <cassert>
+#include <cctype>
 #include <cstring>
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <iostream>
 
 #include <random>
+#include <map>
 
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -28,20 +31,111 @@
 #include "Sphere.h"
 #include "Revo.h"
 #include "Texture.h"
+#include "Instances.h"
+#include "IndirectScene.h"
+#include "GeometryArena.h"
+#include "Bvh.h"
+#include "SceneStore.h"
+#include "UniformBlocks.h"
+#include "TiledLighting.h"
+#include "ClusterBuilder.h"
+#include "ThreadPool.h"
+#include "Transform.h"
+#include "Profiler.h"
+#include "FrameWriter.h"
+#include "HeadlessContext.h"
+#include "SoftwareRenderer.h"
+#include "Simd.h"
+#include "Checks.h"
+#include "Benchmarks.h"
 
 #include "WorldObject.h"
 #include "Light.h"
 
 using namespace std;
 
-GLFWwindow *window; // Main application window
+GLFWwindow *window = NULL; // Main application window, if not headless
+string EXECUTABLE = "A5"; // argv[0], to run the scenes of --bench=scenes
 string RESOURCE_DIR = "./"; // Where the resources are loaded from
 bool OFFLINE = false;
 
+// Runtime settings, see parseOption()
+int NUM_LIGHTS = 10; // Lights beyond the first 10 are placed randomly
+int NUM_OBJECTS = 100; // Placed on a square grid
+float LIGHT_CUTOFF = 1.0f/256.0f; // Light contribution ignored by the tiled pass
+int TILE_SIZE = 16;
+int MAX_LIGHTS_PER_TILE = 256;
+int CLUSTER_SLICES = 24;
+float CLUSTER_FAR = 100.0f; // Depth of the last cluster slice boundary
+bool PACKED_GBUFFER = false; // Depth, octahedral normals and RGBA8 colors
+double FIXED_TIME = -1.0; // Animation time of every frame, if not negative
+int FRAMES = 1; // Number of frames rendered in OFFLINE mode
+double FRAME_DT = 1.0/60.0; // Simulated time between OFFLINE frames
+string OUTPUT = ""; // printf pattern of the OFFLINE frame numbers
+int SAVE_EVERY = 1; // Only every SAVE_EVERY-th OFFLINE frame is written
+int SEED = -1; // Seed of the scene's random numbers, or random if negative
+bool HEADLESS = false; // Render without a window, through EGL
+int WIDTH = 0; // Size of the offscreen framebuffer, or 0 to render to the window
+int HEIGHT = 0;
+string CHECK = ""; // Self-check to run instead of rendering
+string BENCH = ""; // Benchmark to run instead of rendering
+string IMAGE = "output.png"; // Images compared by --check=image-diff
+string REFERENCE = "";
+int IMAGE_TOLERANCE = 8; // Largest channel difference of a matching pixel
+float IMAGE_OUTLIERS = 0.001f; // Fraction of pixels allowed not to match
+float PERCEPTUAL_THRESHOLD = 0.1f; // Color difference visible in a pixel, from 0 to 1
+string GOLDEN_DIR = ""; // Golden images of --bench=scenes, or RESOURCE_DIR/golden
+bool UPDATE_GOLDEN = false; // Replace the golden images instead of comparing
+string BENCH_JSON = "bench.json"; // Frame times of --bench=scenes
+bool PROFILE = false; // Time the render stages, and report on exit
+string PROFILE_CSV = ""; // Where the profile is written, or stdout if empty
+int PROFILE_WINDOW = 240; // Number of frames the statistics are over
+int READBACK_FRAMES = 3; // Frames whose pixels may be in flight at once
+bool SOFTWARE = false; // Render OFFLINE on the CPU, without OpenGL
+int THREADS = 0; // Worker threads besides the main one, or one per core if 0
+bool GPU_DRIVEN = false; // Cull and draw the objects on the GPU, see IndirectScene
+
+// Lighting passes (press 'l' to cycle)
+enum {
+	LIGHTING_FULLSCREEN = 0,
+	LIGHTING_TILED,
+	LIGHTING_CLUSTERED,
+	LIGHTING_VOLUMES,
+	LIGHTING_MODES
+};
+const char *LIGHTING_NAMES[LIGHTING_MODES] = {"fullscreen", "tiled", "clustered", "volumes"};
+int LIGHTING = LIGHTING_FULLSCREEN;
+
+// Size of the light arrays of the full-screen lighting pass
+const int MAX_LIGHTS = UniformBlocks::MAX_LIGHTS;
+
+// Declarations and functions of the G-buffer layout, for the shaders using it
+string GBUFFER_PRELUDE;
+
 shared_ptr<Camera> camera;
 shared_ptr<Program> prog;
 shared_ptr<Program> sp_prog;
 shared_ptr<Program> prog_pass;
+shared_ptr<Program> inst_prog;
+shared_ptr<Program> sp_inst_prog;
+shared_ptr<Program> tiled_prog;
+shared_ptr<Program> clustered_prog;
+shared_ptr<Program> volume_prog;
+
+// Handles of the uniforms set every frame that are not in the uniform blocks,
+// which are the same in every program (see Program::uniform())
+struct Uniforms
+{
+	Program::Uniform P = Program::uniform("P");
+	Program::Uniform MV = Program::uniform("MV");
+	Program::Uniform ks = Program::uniform("ks");
+	Program::Uniform s = Program::uniform("s");
+	Program::Uniform light_position = Program::uniform("light_position");
+	Program::Uniform light_color = Program::uniform("light_color");
+	Program::Uniform window_size = Program::uniform("window_size");
+	Program::Uniform inv_proj = Program::uniform("inv_proj");
+};
+const Uniforms U = Uniforms();
 
 shared_ptr<Shape> shape;
 shared_ptr<Shape> teapot;
@@ -49,11 +143,51 @@ shared_ptr<Shape> w_floor;
 shared_ptr<Shape> sphere;
 shared_ptr<Sphere> cust_sphere;
 shared_ptr<Revo> spiral;
+// The vertices and indices of all the meshes above
+shared_ptr<GeometryArena> arena;
 
 vector<glm::vec3> light_positions;
 vector<glm::vec3> light_colors;
+vector<float> light_radii;
+
+shared_ptr<TiledLighting> tiled;
+shared_ptr<ClusterBuilder> clusters;
+shared_ptr<ThreadPool> pool;
+shared_ptr<Profiler> profiler;
+shared_ptr<FrameWriter> frameWriter;
+shared_ptr<SoftwareRenderer> software;
 
-vector<WorldObject> wobjs;
+// The meshes of the scene, as numbered in the scene store
+enum
+{
+	MESH_BUNNY,
+	MESH_TEAPOT,
+	MESH_SPHERE, // cust_sphere
+	MESH_SPIRAL,
+	MESH_FLOOR,
+	MESH_MARKER, // sphere, for the lights
+	MESHES
+};
+GeometryArena::Mesh sceneMeshes[MESHES]; // Once they are in the arena
+int softwareMeshes[MESHES]; // Index of each mesh in software
+
+// The world objects but the floor, and the floor
+shared_ptr<SceneStore> objects;
+shared_ptr<WorldObject> ground;
+// Bounds of the objects over their whole animation, and the ones visible
+// this frame (press 'f' to draw them all)
+shared_ptr<Bvh> bvh;
+unsigned bvhVersion; // The version of the objects the BVH was built for
+vector<int> visibleObjects;
+
+// Instanced G-buffer path, grouped by mesh (press 'i' to draw object by object)
+bool INSTANCED = false;
+shared_ptr<Instances> meshInstances[MESHES];
+// GPU-driven G-buffer path (press 'g' to switch between it and the one above)
+shared_ptr<IndirectScene> scene;
+unsigned sceneVersion; // The version of the objects the scene was built for
+// The per-frame and per-draw uniform blocks of the G-buffer and lighting passes
+shared_ptr<UniformBlocks> blocks;
 
 int texWidth = 640;
 int texHeight = 480;
@@ -63,9 +197,24 @@ GLuint pos_tex;
 GLuint nor_tex;
 GLuint ke_tex;
 GLuint kd_tex;
+GLuint depthrenderbuffer;
+
+// Framebuffer the final image is drawn into: the window's, or offscreen
+GLuint outputFramebufferID = 0;
+GLuint outputColorbuffer;
+GLuint outputDepthbuffer;
+
+// Light buffer of the light volume pass, sharing the G-buffer's depth and stencil
+GLuint lightFramebufferID;
+GLuint light_tex;
+
+// sphere.obj has a radius of 0.5, and its faces are at least this far from the center
+const float SPHERE_INNER_RADIUS = 0.46f;
 
 bool keyToggles[256] = {false}; // only for English keyboards!
 
+int frameIndex = 0; // Number of frames rendered so far
+
 // This function is called when a GLFW error occurs
 static void error_callback(int error, const char *description)
 {
@@ -109,154 +258,144 @@ static void cursor_position_callback(GLFWwindow* window, double xmouse, double y
 static void char_callback(GLFWwindow *window, unsigned int key)
 {
 	keyToggles[key] = !keyToggles[key];
+	if(key == 'l') {
+		// The tiled and clustered passes need texture buffers
+		do {
+			LIGHTING = (LIGHTING + 1) % LIGHTING_MODES;
+		} while((LIGHTING == LIGHTING_TILED || LIGHTING == LIGHTING_CLUSTERED) && !tiled);
+		cout << "Lighting: " << LIGHTING_NAMES[LIGHTING] << endl;
+	}
 }
 
-// If the window is resized, capture the new size and reset the viewport
-static void resize_callback(GLFWwindow *window, int width, int height)
+// Allocates the G-buffer and light buffer for the window size
+static void allocGBuffer()
 {
-	glViewport(0, 0, width, height);
-	texWidth = width;
-	texHeight = height;
-
-	//glGenFramebuffers(1, &framebufferID);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
-
-	// position texture
-	glBindTexture(GL_TEXTURE_2D, pos_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-
-	// normal texture
-	glBindTexture(GL_TEXTURE_2D, nor_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-
-	// ke texture
-	glBindTexture(GL_TEXTURE_2D, ke_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-
-	// kd texture
-	glBindTexture(GL_TEXTURE_2D, kd_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-	
-	GLuint depthrenderbuffer;
-	glGenRenderbuffers(1, &depthrenderbuffer);
+	if(PACKED_GBUFFER) {
+		glBindTexture(GL_TEXTURE_2D, pos_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, texWidth, texHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+		glBindTexture(GL_TEXTURE_2D, nor_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, texWidth, texHeight, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+		glBindTexture(GL_TEXTURE_2D, ke_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texWidth, texHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	} else {
+		GLuint textures[] = {pos_tex, nor_tex, ke_tex, kd_tex};
+		for(GLuint tex : textures) {
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
+		}
+	}
+	// The depth and stencil of the light buffer. In the packed layout, the
+	// G-buffer's depth is a texture the light passes read, so the light
+	// buffer gets a copy of it instead.
 	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, texWidth, texHeight);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
-
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, texWidth, texHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, light_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
 
+// Allocates the offscreen framebuffer the final image is drawn into
+static void allocOutput()
+{
+	glGenFramebuffers(1, &outputFramebufferID);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebufferID);
+	glGenRenderbuffers(1, &outputColorbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, outputColorbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, texWidth, texHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, outputColorbuffer);
+	glGenRenderbuffers(1, &outputDepthbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, outputDepthbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, texWidth, texHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, outputDepthbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-	    cerr << "Framebuffer is not ok" << endl;
+		cerr << "Output framebuffer is not ok" << endl;
 	}
-
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
+	GLSL::checkError(GET_FILE_LINE);
 }
 
-// https://lencerf.github.io/post/2019-09-21-save-the-opengl-rendering-to-image-file/
-static void saveImage(const char *filepath, GLFWwindow *w)
+// Size of the framebuffer the final image is drawn into
+static void getFramebufferSize(int *width, int *height)
 {
-	int width, height;
-	glfwGetFramebufferSize(w, &width, &height);
-	GLsizei nrChannels = 3;
-	GLsizei stride = nrChannels * width;
-	stride += (stride % 4) ? (4 - stride % 4) : 0;
-	GLsizei bufferSize = stride * height;
-	std::vector<char> buffer(bufferSize);
-	glPixelStorei(GL_PACK_ALIGNMENT, 4);
-	glReadBuffer(GL_BACK);
-	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer.data());
-	stbi_flip_vertically_on_write(true);
-	int rc = stbi_write_png(filepath, width, height, nrChannels, buffer.data(), stride);
-	if(rc) {
-		cout << "Wrote to " << filepath << endl;
+	if(outputFramebufferID) {
+		*width = texWidth;
+		*height = texHeight;
 	} else {
-		cout << "Couldn't write to " << filepath << endl;
+		glfwGetFramebufferSize(window, width, height);
 	}
 }
 
-// This function is called once to initialize the scene and OpenGL
-static void init()
+// If the window is resized, capture the new size and reset the viewport
+static void resize_callback(GLFWwindow *window, int width, int height)
 {
-	// Initialize time.
-	glfwSetTime(0.0);
-	
-	// Set background color.
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	// Enable z-buffer test.
-	glEnable(GL_DEPTH_TEST);
-
+	glViewport(0, 0, width, height);
+	texWidth = width;
+	texHeight = height;
 
-	//initialize the shaders
-	prog = make_shared<Program>();
-	prog->setShaderNames(RESOURCE_DIR + "bp_vert.glsl", RESOURCE_DIR + "dr_frag.glsl");
-	prog->setVerbose(true);
-	prog->init();
-	prog->addAttribute("aPos");
-	prog->addAttribute("aNor");
-	prog->addUniform("MV");
-	prog->addUniform("P");
-	prog->addUniform("IT");
-	prog->addUniform("light_positions");
-	prog->addUniform("light_colors");
-	prog->addUniform("ka");
-	prog->addUniform("kd");
-	prog->addUniform("ks");
-	prog->addUniform("s");
-	prog->setVerbose(false);
+	allocGBuffer();
+}
 
-	sp_prog = make_shared<Program>();
-	sp_prog->setShaderNames(RESOURCE_DIR + "vert.glsl", RESOURCE_DIR + "dr_frag.glsl");
-	sp_prog->setVerbose(true);
-	sp_prog->init();
-	sp_prog->addAttribute("aPos");
-	sp_prog->addAttribute("aNor");
-	sp_prog->addAttribute("aTex");
-	sp_prog->addUniform("MV");
-	sp_prog->addUniform("P");
-	sp_prog->addUniform("IT");
-	sp_prog->addUniform("time");
-	sp_prog->addUniform("light_positions");
-	sp_prog->addUniform("light_colors");
-	sp_prog->addUniform("ka");
-	sp_prog->addUniform("kd");
-	sp_prog->addUniform("ks");
-	sp_prog->addUniform("s");
-	sp_prog->setVerbose(false);
+// https://lencerf.github.io/post/2019-09-21-save-the-opengl-rendering-to-image-file/
+static void saveImage(const char *filepath)
+{
+	int width, height;
+	getFramebufferSize(&width, &height);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFramebufferID);
+	glReadBuffer(outputFramebufferID ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+	frameWriter->capture(filepath, width, height);
+}
 
+// Loads the meshes and builds the objects and lights of the scene. This
+// doesn't need an OpenGL context.
+static void loadScene()
+{
 	camera = make_shared<Camera>();
 	camera->setInitDistance(20.0f); // Camera's initial Z translation
 	
 	shape = make_shared<Shape>();
-	shape->loadMesh(RESOURCE_DIR + "bunny.obj");
-	shape->init();
-
 	teapot = make_shared<Shape>();
-	teapot->loadMesh(RESOURCE_DIR + "teapot.obj");
-	teapot->init();
-
 	w_floor = make_shared<Shape>();
-	w_floor->loadMesh(RESOURCE_DIR + "square.obj");
-	w_floor->init();
-
 	sphere = make_shared<Shape>();
-	sphere->loadMesh(RESOURCE_DIR + "sphere.obj");
-	sphere->init();
+	// Load the meshes concurrently
+	vector< pair<shared_ptr<Shape>, string> > meshes = {
+		{shape, "bunny.obj"},
+		{teapot, "teapot.obj"},
+		{w_floor, "square.obj"},
+		{sphere, "sphere.obj"},
+	};
+	pool->parallelFor((int)meshes.size(), [&meshes](int begin, int end) {
+		for(int i = begin; i < end; i++) {
+			meshes[i].first->loadMesh(RESOURCE_DIR + meshes[i].second, pool);
+		}
+	});
 
 	std::random_device randevice;
-	std::mt19937 gen(randevice());
+	std::mt19937 gen(SEED >= 0 ? (unsigned)SEED : randevice());
+	if(SEED >= 0) {
+		std::srand(SEED);
+	}
 	std::uniform_real_distribution<> distr(0.2, 0.6);
 	std::uniform_real_distribution<> distrad(0.5, 1.0);
 
 	cust_sphere = make_shared<Sphere>();
-	cust_sphere->init(distrad(gen));
+	cust_sphere->generate(distrad(gen));
 
 	spiral = make_shared<Revo>();
-	spiral->init();
+	spiral->generate();
 	
 	// "random" colors aren't true random, I believe it's because it's using the same seed
+	// The objects fill the rows of a square grid, one unit apart, standing
+	// on the floor
+	objects = make_shared<SceneStore>();
+	objects->setThreadPool(pool);
+	objects->reserve(NUM_OBJECTS);
+	int gridSize = (int)ceil(sqrt((double)NUM_OBJECTS));
 	int counter = 0;
-	for(int i = 0; i < 10; i++) {
-		for(int j = 0; j < 10; j++) {
+	for(int i = 0; i < gridSize; i++) {
+		for(int j = 0; j < gridSize && counter < NUM_OBJECTS; j++) {
 			glm::vec3 rotation(0.0, 0.0, 0.0);
 			glm::vec3 translation(i, 0.0, j);
 			double scale_val = distr(gen);
@@ -265,17 +404,28 @@ static void init()
 			glm::vec3 diffuse(((double) std::rand() / (RAND_MAX)), ((double) std::rand() / (RAND_MAX)), ((double) std::rand() / (RAND_MAX)));
 			glm::vec3 specular(1.0f, 1.0f, 1.0f);
 			double shininess = 10.0;
-			if(counter % 4 == 0) {
-				wobjs.emplace_back(rotation, translation, scale, shape, ambient, diffuse, specular, shininess);
-			} else if(counter % 4 == 1) {
-				wobjs.emplace_back(rotation, translation, scale, teapot, ambient, diffuse, specular, shininess);
+			int mesh = MESH_BUNNY;
+			int animation = SceneStore::SPIN;
+			float lowest_y = shape->lowest_y;
+			if(counter % 4 == 1) {
+				mesh = MESH_TEAPOT;
+				animation = SceneStore::SHEAR;
+				lowest_y = teapot->lowest_y;
 			} else if(counter % 4 == 2) {
-				glm::vec3 def_scale(0.5, 0.5, 0.5);
-				wobjs.emplace_back(rotation, translation, scale*def_scale, cust_sphere, ambient, diffuse, specular, shininess);
+				mesh = MESH_SPHERE;
+				animation = SceneStore::BOUNCE;
+				lowest_y = cust_sphere->lowest_y;
+				scale *= glm::vec3(0.5, 0.5, 0.5);
 			} else if(counter % 4 == 3) {
-				glm::vec3 def_scale(0.15, 0.15, 0.15);
-				wobjs.emplace_back(rotation, translation, scale*def_scale, spiral, ambient, diffuse, specular, shininess);
+				// Lying on its side, across the floor
+				mesh = MESH_SPIRAL;
+				animation = SceneStore::STATIC;
+				lowest_y = 0.0f;
+				rotation.z = 0.5 * M_PI;
+				scale *= glm::vec3(0.15, 0.15, 0.15);
 			}
+			translation.y -= lowest_y*scale.y;
+			objects->add(mesh, animation, translation, rotation, scale, ambient, diffuse, specular, (float)shininess);
 			counter++;
 		}
 	}
@@ -330,6 +480,27 @@ static void init()
 		light_positions.emplace_back(2.5, 0.3, 6.5);
 		light_colors.emplace_back(0.2, 0.8, 0.8);
 	}
+
+	// Scatter the rest over the floor. Their colors are scaled down by the
+	// number of them per unit of floor, so that their sum stays well below 1
+	// however many there are: a light missing from a tile or cluster must
+	// show, and not be hidden by the others saturating the pixel.
+	std::uniform_real_distribution<> distpos(-0.5, gridSize - 0.5);
+	std::uniform_real_distribution<> distcol(0.2, 1.0);
+	light_positions.resize(min((int)light_positions.size(), NUM_LIGHTS));
+	light_colors.resize(light_positions.size());
+	double density = (double)(NUM_LIGHTS - (int)light_positions.size())/(gridSize*gridSize);
+	double intensity = min(1.0, 0.1/density);
+	while((int)light_positions.size() < NUM_LIGHTS) {
+		light_positions.emplace_back(distpos(gen), 0.3, distpos(gen));
+		light_colors.emplace_back(intensity*distcol(gen), intensity*distcol(gen), intensity*distcol(gen));
+	}
+	for(unsigned int i = 0; i < light_colors.size(); i++) {
+		light_radii.push_back(Light::cutoffRadius(light_colors[i], LIGHT_CUTOFF));
+	}
+	if(NUM_LIGHTS > MAX_LIGHTS && LIGHTING == LIGHTING_FULLSCREEN) {
+		cout << "Only the first " << MAX_LIGHTS << " lights are shaded without the tiled pass" << endl;
+	}
 	
 
 	
@@ -337,66 +508,220 @@ static void init()
 	// Add the floor
 	{
 		glm::vec3 rotation(0.0, 0.0, 0.0);
-		glm::vec3 translation(4.5, 0.0, 4.5);
-		glm::vec3 scale(12.0, 1.0, 12.0);
+		float center = 0.5f*(gridSize - 1);
+		glm::vec3 translation(center, 0.0, center);
+		glm::vec3 scale(gridSize + 2.0, 1.0, gridSize + 2.0);
 		glm::vec3 ambient(0.0, 0.0, 0.0);
 		glm::vec3 diffuse(1.0, 1.0, 1.0);
 		glm::vec3 specular(1.0, 1.0, 1.0);
 		double shininess = 10;
-		wobjs.emplace_back(rotation, translation, scale, w_floor, ambient, diffuse, specular, shininess);
+		ground = make_shared<WorldObject>(rotation, translation, scale, w_floor, ambient, diffuse, specular, shininess);
+	}
+}
+
+// Builds the BVH of the objects, or refits it if it has as many boxes, when
+// the objects have changed since the last time
+static void updateBvh()
+{
+	if(bvh && bvhVersion == objects->getVersion()) {
+		return;
+	}
+	vector<Bvh::Box> bounds;
+	bounds.reserve(objects->size());
+	for(int i = 0; i < objects->size(); i++) {
+		const GeometryArena::Mesh &mesh = sceneMeshes[objects->getMeshes()[i]];
+		bounds.push_back(objects->getBounds(i, Bvh::Box(mesh.boundsMin, mesh.boundsMax)));
+	}
+	if(bvh && bvh->getBoxCount() == (int)bounds.size()) {
+		bvh->refit(bounds);
+	} else {
+		bvh = make_shared<Bvh>();
+		bvh->build(bounds);
+	}
+	bvhVersion = objects->getVersion();
+}
+
+// Uploads the light markers and the objects to the GPU-driven scene, with
+// the same mesh numbers as the scene store
+static void buildIndirectScene()
+{
+	scene->clear();
+	sceneVersion = objects->getVersion();
+	auto M = make_shared<MatrixStack>();
+	glm::vec3 zero_vec(0.0);
+	for(int m = 0; m < MESHES; m++) {
+		scene->addMesh(sceneMeshes[m]);
+	}
+	for(unsigned int i = 0; i < light_positions.size(); i++) {
+		M->pushMatrix();
+			M->scale(0.1, 0.1, 0.1);
+			scene->addObject(MESH_MARKER, M->topMatrix(), light_positions[i], SceneStore::STATIC, light_colors[i], zero_vec);
+		M->popMatrix();
+	}
+	for(int i = 0; i < objects->size(); i++) {
+		scene->addObject(objects->getMeshes()[i], objects->getLocals()[i], objects->getTranslations()[i], objects->getAnimations()[i], objects->getAmbients()[i], objects->getDiffuses()[i]);
+	}
+	scene->upload();
+}
+
+// This function is called once to initialize the scene and OpenGL
+static void init()
+{
+	// Initialize time.
+	if(window) {
+		glfwSetTime(0.0);
+	}
+	
+	// Set background color.
+	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	// Enable z-buffer test.
+	glEnable(GL_DEPTH_TEST);
+
+
+	// The packed layout needs RG16 and depth-stencil textures
+	if(PACKED_GBUFFER && !GLEW_VERSION_3_0) {
+		cout << "Packed G-buffer not supported, using the full one" << endl;
+		PACKED_GBUFFER = false;
+	}
+	char *gbuffer = GLSL::textFileRead((RESOURCE_DIR + "gbuffer.glsl").c_str());
+	GBUFFER_PRELUDE = string(PACKED_GBUFFER ? "#define PACKED_GBUFFER\n" : "") + (gbuffer ? gbuffer : "");
+	free(gbuffer);
+
+	//initialize the shaders
+	prog = make_shared<Program>();
+	prog->setShaderNames(RESOURCE_DIR + "bp_vert.glsl", RESOURCE_DIR + "dr_frag.glsl");
+	prog->setPrelude(GBUFFER_PRELUDE);
+	GeometryArena::setAttributeLocations(prog);
+	prog->setVerbose(true);
+	prog->init();
+	prog->addUniformBlock("Frame", UniformBlocks::FRAME_BINDING);
+	prog->addUniformBlock("Object", UniformBlocks::OBJECT_BINDING);
+	prog->setVerbose(false);
+
+	sp_prog = make_shared<Program>();
+	sp_prog->setShaderNames(RESOURCE_DIR + "vert.glsl", RESOURCE_DIR + "dr_frag.glsl");
+	sp_prog->setPrelude(GBUFFER_PRELUDE);
+	GeometryArena::setAttributeLocations(sp_prog);
+	sp_prog->setVerbose(true);
+	sp_prog->init();
+	sp_prog->addUniformBlock("Frame", UniformBlocks::FRAME_BINDING);
+	sp_prog->addUniformBlock("Object", UniformBlocks::OBJECT_BINDING);
+	sp_prog->setVerbose(false);
+
+	// Instancing needs glDrawArraysInstanced and glVertexAttribDivisor
+	INSTANCED = GLEW_VERSION_3_3;
+	if(INSTANCED) {
+		inst_prog = make_shared<Program>();
+		inst_prog->setShaderNames(RESOURCE_DIR + "inst_vert.glsl", RESOURCE_DIR + "inst_frag.glsl");
+		inst_prog->setPrelude(GBUFFER_PRELUDE);
+		GeometryArena::setAttributeLocations(inst_prog);
+		inst_prog->setVerbose(true);
+		inst_prog->init();
+		inst_prog->addAttribute("iMV");
+		inst_prog->addAttribute("iIT");
+		inst_prog->addAttribute("iKa");
+		inst_prog->addAttribute("iKd");
+		inst_prog->addAttribute("iKs");
+		inst_prog->addAttribute("iS");
+		inst_prog->addUniformBlock("Frame", UniformBlocks::FRAME_BINDING);
+		inst_prog->setVerbose(false);
+
+		sp_inst_prog = make_shared<Program>();
+		sp_inst_prog->setShaderNames(RESOURCE_DIR + "inst_sp_vert.glsl", RESOURCE_DIR + "inst_frag.glsl");
+		sp_inst_prog->setPrelude(GBUFFER_PRELUDE);
+		GeometryArena::setAttributeLocations(sp_inst_prog);
+		sp_inst_prog->setVerbose(true);
+		sp_inst_prog->init();
+		sp_inst_prog->addAttribute("iMV");
+		sp_inst_prog->addAttribute("iIT");
+		sp_inst_prog->addAttribute("iKa");
+		sp_inst_prog->addAttribute("iKd");
+		sp_inst_prog->addAttribute("iKs");
+		sp_inst_prog->addAttribute("iS");
+		sp_inst_prog->addUniformBlock("Frame", UniformBlocks::FRAME_BINDING);
+		sp_inst_prog->setVerbose(false);
+	} else {
+		cout << "Instanced drawing not supported, drawing object by object" << endl;
+	}
+
+	blocks = make_shared<UniformBlocks>();
+	blocks->init();
+
+	loadScene();
+	// Pack the meshes into the arena, and upload it from this thread, which has
+	// the OpenGL context
+	arena = make_shared<GeometryArena>();
+	shape->init(arena);
+	teapot->init(arena);
+	w_floor->init(arena);
+	sphere->init(arena);
+	cust_sphere->init(arena);
+	spiral->init(arena);
+	arena->upload();
+	sceneMeshes[MESH_BUNNY] = shape->getMesh();
+	sceneMeshes[MESH_TEAPOT] = teapot->getMesh();
+	sceneMeshes[MESH_SPHERE] = cust_sphere->getMesh();
+	sceneMeshes[MESH_SPIRAL] = spiral->getMesh();
+	sceneMeshes[MESH_FLOOR] = w_floor->getMesh();
+	sceneMeshes[MESH_MARKER] = sphere->getMesh();
+
+	updateBvh();
+
+	scene = make_shared<IndirectScene>();
+	if(INSTANCED && scene->init(RESOURCE_DIR, arena)) {
+		buildIndirectScene();
+	} else {
+		cout << "GPU-driven drawing not supported, drawing the objects from the CPU" << endl;
+		scene = nullptr;
 	}
 
 	glGenFramebuffers(1, &framebufferID);
 	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
 
-	// position texture
-	glGenTextures(1, &pos_tex);
-	glBindTexture(GL_TEXTURE_2D, pos_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pos_tex, 0);
-
-	// normal texture
-	glGenTextures(1, &nor_tex);
-	glBindTexture(GL_TEXTURE_2D, nor_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, nor_tex, 0);
-
-	// ke texture
-	glGenTextures(1, &ke_tex);
-	glBindTexture(GL_TEXTURE_2D, ke_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, ke_tex, 0);
-
-	// kd texture
-	glGenTextures(1, &kd_tex);
-	glBindTexture(GL_TEXTURE_2D, kd_tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, texWidth, texHeight, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, kd_tex, 0);
-	
-	GLuint depthrenderbuffer;
+	// G-buffer textures, see gbuffer.glsl for the two layouts
+	GLuint *textures[] = {&pos_tex, &nor_tex, &ke_tex, &kd_tex, &light_tex};
+	for(GLuint *tex : textures) {
+		glGenTextures(1, tex);
+		glBindTexture(GL_TEXTURE_2D, *tex);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	}
+	// The light volume pass needs a stencil
 	glGenRenderbuffers(1, &depthrenderbuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, texWidth, texHeight);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+	allocGBuffer();
+
+	if(PACKED_GBUFFER) {
+		// Positions are rebuilt from the depth
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, nor_tex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, ke_tex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, pos_tex, 0);
+		GLenum attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+		glDrawBuffers(2, attachments);
+		cout << "Packed G-buffer: 12 bytes per pixel" << endl;
+	} else {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pos_tex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, nor_tex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, ke_tex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, kd_tex, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+		GLenum attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+		glDrawBuffers(4, attachments);
+	}
+
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+	    cerr << "Framebuffer is not ok" << endl;
+	}
+
+	// The light buffer, for the light volume pass
+	glGenFramebuffers(1, &lightFramebufferID);
+	glBindFramebuffer(GL_FRAMEBUFFER, lightFramebufferID);
 
-	GLenum attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
-	glDrawBuffers(4, attachments);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, light_tex, 0);
+	// Never pos_tex, which the light passes sample while the stencil passes
+	// write the attachment
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
 
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
 	    cerr << "Framebuffer is not ok" << endl;
@@ -407,16 +732,14 @@ static void init()
 
 	prog_pass = make_shared<Program>();
 	prog_pass->setShaderNames(RESOURCE_DIR + "dr_vert.glsl", RESOURCE_DIR + "bp_frag.glsl");
+	prog_pass->setPrelude(GBUFFER_PRELUDE);
+	GeometryArena::setAttributeLocations(prog_pass);
 	prog_pass->setVerbose(true);
 	prog_pass->init();
-	prog_pass->addAttribute("aPos");
 	prog_pass->addUniform("MV");
 	prog_pass->addUniform("P");
-	prog_pass->addUniform("light_positions");
-	prog_pass->addUniform("light_colors");
-	prog_pass->addUniform("window_size");
-	prog_pass->addUniform("ks");
-	prog_pass->addUniform("s");
+	prog_pass->addUniform("inv_proj");
+	prog_pass->addUniformBlock("Frame", UniformBlocks::FRAME_BINDING);
 	prog_pass->setVerbose(false);
 	prog_pass->addUniform("pos_tex");
 	prog_pass->addUniform("nor_tex");
@@ -429,159 +752,483 @@ static void init()
 	glUniform1i(prog_pass->getUniform("kd_tex"), 3);
 	prog_pass->unbind();
 
+	volume_prog = make_shared<Program>();
+	volume_prog->setShaderNames(RESOURCE_DIR + "dr_vert.glsl", RESOURCE_DIR + "lv_frag.glsl");
+	volume_prog->setPrelude(GBUFFER_PRELUDE);
+	GeometryArena::setAttributeLocations(volume_prog);
+	volume_prog->setVerbose(true);
+	volume_prog->init();
+	volume_prog->addUniform("MV");
+	volume_prog->addUniform("P");
+	volume_prog->addUniform("light_position");
+	volume_prog->addUniform("light_color");
+	volume_prog->addUniform("window_size");
+	volume_prog->addUniform("inv_proj");
+	volume_prog->addUniform("ks");
+	volume_prog->addUniform("s");
+	volume_prog->addUniform("pos_tex");
+	volume_prog->addUniform("nor_tex");
+	volume_prog->addUniform("ke_tex");
+	volume_prog->addUniform("kd_tex");
+	volume_prog->setVerbose(false);
+	volume_prog->bind();
+	glUniform1i(volume_prog->getUniform("pos_tex"), 0);
+	glUniform1i(volume_prog->getUniform("nor_tex"), 1);
+	glUniform1i(volume_prog->getUniform("ke_tex"), 2);
+	glUniform1i(volume_prog->getUniform("kd_tex"), 3);
+	volume_prog->unbind();
+
+	// The tiled pass reads the lights from texture buffers
+	if(GLEW_VERSION_3_1) {
+		tiled = make_shared<TiledLighting>();
+		tiled->setTileSize(TILE_SIZE);
+		tiled->setMaxLightsPerTile(MAX_LIGHTS_PER_TILE);
+		tiled->init(RESOURCE_DIR, GBUFFER_PRELUDE);
+
+		tiled_prog = make_shared<Program>();
+		tiled_prog->setShaderNames(RESOURCE_DIR + "tiled_vert.glsl", RESOURCE_DIR + "tiled_frag.glsl");
+		tiled_prog->setPrelude(GBUFFER_PRELUDE);
+		GeometryArena::setAttributeLocations(tiled_prog);
+		tiled_prog->setVerbose(true);
+		tiled_prog->init();
+		tiled_prog->addUniform("MV");
+		tiled_prog->addUniform("P");
+		tiled_prog->addUniform("window_size");
+		tiled_prog->addUniform("inv_proj");
+		tiled_prog->addUniform("ks");
+		tiled_prog->addUniform("s");
+		tiled_prog->addUniform("pos_tex");
+		tiled_prog->addUniform("nor_tex");
+		tiled_prog->addUniform("ke_tex");
+		tiled_prog->addUniform("kd_tex");
+		tiled_prog->addUniform("lights");
+		tiled_prog->addUniform("tiles");
+		tiled_prog->addUniform("tile_size");
+		tiled_prog->addUniform("tiles_x");
+		tiled_prog->addUniform("max_lights");
+		tiled_prog->setVerbose(false);
+		tiled_prog->bind();
+		glUniform1i(tiled_prog->getUniform("pos_tex"), 0);
+		glUniform1i(tiled_prog->getUniform("nor_tex"), 1);
+		glUniform1i(tiled_prog->getUniform("ke_tex"), 2);
+		glUniform1i(tiled_prog->getUniform("kd_tex"), 3);
+		tiled_prog->unbind();
+
+		clusters = make_shared<ClusterBuilder>();
+		clusters->setThreadPool(pool);
+		clusters->setTileSize(TILE_SIZE);
+		clusters->setSlices(CLUSTER_SLICES);
+		clusters->setSliceFar(CLUSTER_FAR);
+		clusters->init();
+
+		clustered_prog = make_shared<Program>();
+		clustered_prog->setShaderNames(RESOURCE_DIR + "tiled_vert.glsl", RESOURCE_DIR + "clustered_frag.glsl");
+		clustered_prog->setPrelude(GBUFFER_PRELUDE);
+		GeometryArena::setAttributeLocations(clustered_prog);
+		clustered_prog->setVerbose(true);
+		clustered_prog->init();
+		clustered_prog->addUniform("MV");
+		clustered_prog->addUniform("P");
+		clustered_prog->addUniform("window_size");
+		clustered_prog->addUniform("inv_proj");
+		clustered_prog->addUniform("ks");
+		clustered_prog->addUniform("s");
+		clustered_prog->addUniform("pos_tex");
+		clustered_prog->addUniform("nor_tex");
+		clustered_prog->addUniform("ke_tex");
+		clustered_prog->addUniform("kd_tex");
+		clustered_prog->addUniform("lights");
+		clustered_prog->addUniform("clusters");
+		clustered_prog->addUniform("indices");
+		clustered_prog->addUniform("tile_size");
+		clustered_prog->addUniform("tiles_x");
+		clustered_prog->addUniform("tiles_y");
+		clustered_prog->addUniform("slices");
+		clustered_prog->addUniform("znear");
+		clustered_prog->addUniform("slice_scale");
+		clustered_prog->setVerbose(false);
+		clustered_prog->bind();
+		glUniform1i(clustered_prog->getUniform("pos_tex"), 0);
+		glUniform1i(clustered_prog->getUniform("nor_tex"), 1);
+		glUniform1i(clustered_prog->getUniform("ke_tex"), 2);
+		glUniform1i(clustered_prog->getUniform("kd_tex"), 3);
+		clustered_prog->unbind();
+	} else {
+		cout << "Texture buffers not supported, no tiled or clustered lighting" << endl;
+		LIGHTING = LIGHTING_FULLSCREEN;
+	}
+
 
 
 	
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+// Returns the instance list of a mesh, creating it on first use
+static shared_ptr<Instances> getInstances(int mesh)
+{
+	shared_ptr<Instances> &inst = meshInstances[mesh];
+	if(!inst) {
+		inst = make_shared<Instances>();
+		inst->init();
+	}
+	return inst;
+}
+
+// Uploads the instances of each mesh of the program's vertex format (the
+// spiral's, or the others) and draws them with one call per mesh
+static void drawInstances(shared_ptr<Program> p, bool positionOnly)
+{
+	for(int m = 0; m < MESHES; m++) {
+		const shared_ptr<Instances> &inst = meshInstances[m];
+		const GeometryArena::Mesh &mesh = sceneMeshes[m];
+		if(!inst || inst->size() == 0 || (mesh.format == GeometryArena::POSITION) != positionOnly) {
+			continue;
+		}
+		inst->upload();
+		// The instance attributes go into the mesh's vertex array
+		arena->bind(mesh);
+		inst->bind(p);
+		arena->draw(mesh, inst->size());
+		inst->unbind(p);
+	}
+}
+
+// The modelview transform of the marker of light i
+static Transform lightMarker(const Transform &V, int i)
+{
+	return V*Transform::translation(light_positions[i])*Transform::scale(0.1f);
+}
+
+// Draws the light markers and the visible world objects into the G-buffer,
+// with one instanced draw per mesh. The frame block must be set, and the
+// matrices of the visible objects updated.
+static void drawObjectsInstanced(const Transform &V)
+{
+	Profiler::Scope scope(profiler, "objects");
+	for(auto &inst : meshInstances) {
+		if(inst) {
+			inst->clear();
+		}
+	}
+
+	// The lights
+	glm::vec3 zero_vec(0.0);
+	shared_ptr<Instances> lightInstances = getInstances(MESH_MARKER);
+	for(unsigned int i = 0; i < light_positions.size(); i++) {
+		Transform marker = lightMarker(V, i);
+		lightInstances->add(marker.getMatrix(), marker.normalMatrix(), light_colors[i], zero_vec, zero_vec, 1.0f);
+	}
+
+	// The visible objects
+	const vector<glm::mat4> &modelViews = objects->getModelViews();
+	const vector<glm::mat4> &normalMatrices = objects->getNormalMatrices();
+	const vector<int> &meshes = objects->getMeshes();
+	for(size_t j = 0; j < visibleObjects.size(); j++) {
+		int i = visibleObjects[j];
+		getInstances(meshes[i])->add(modelViews[j], normalMatrices[j], objects->getAmbients()[i], objects->getDiffuses()[i], objects->getSpeculars()[i], objects->getShininesses()[i]);
+	}
+
+	inst_prog->bind();
+	drawInstances(inst_prog, false);
+	inst_prog->unbind();
+
+	sp_inst_prog->bind();
+	drawInstances(sp_inst_prog, true);
+	sp_inst_prog->unbind();
+
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+// Draws the light markers and all world objects but the floor into the
+// G-buffer from the GPU-driven scene, with one multi-draw per vertex format.
+// The frame block must be set.
+static void drawObjectsIndirect(const glm::mat4 &projection, const glm::mat4 &view, double t)
+{
+	Profiler::Scope scope(profiler, "objects");
+	scene->cull(projection, view, (float)t);
+
+	inst_prog->bind();
+	scene->draw(GeometryArena::POSITION_NORMAL, inst_prog);
+	scene->draw(GeometryArena::POSITION_NORMAL_TEXCOORD, inst_prog);
+	inst_prog->unbind();
+
+	sp_inst_prog->bind();
+	scene->draw(GeometryArena::POSITION, sp_inst_prog);
+	sp_inst_prog->unbind();
+
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+// Adds the light of each light in camera space by drawing a sphere bounding
+// its influence. A stencil pass first marks the pixels whose surface is
+// inside the sphere, so that only those are shaded. The G-buffer textures
+// must be bound, and the light buffer must be the current framebuffer.
+static void drawLightVolumes(const glm::mat4 &projection, const vector<glm::vec3> &camera_lights)
+{
+	Profiler::Scope scope(profiler, "light-volumes");
+	static auto MV = make_shared<MatrixStack>();
+	MV->clear();
+	glm::vec2 wind_size(texWidth, texHeight);
+	volume_prog->bind();
+	glUniformMatrix4fv(volume_prog->getUniform(U.P), 1, GL_FALSE, glm::value_ptr(projection));
+	glUniform2fv(volume_prog->getUniform(U.window_size), 1, glm::value_ptr(wind_size));
+	glUniformMatrix4fv(volume_prog->getUniform(U.inv_proj), 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+	glUniform3fv(volume_prog->getUniform(U.ks), 1, glm::value_ptr(ground->specular));
+	glUniform1f(volume_prog->getUniform(U.s), ground->shiny);
+	glEnable(GL_STENCIL_TEST);
+	glDepthMask(GL_FALSE);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glCullFace(GL_FRONT);
+	for(unsigned int i = 0; i < camera_lights.size(); i++) {
+		if(light_radii[i] <= 0.0f) {
+			continue;
+		}
+		MV->pushMatrix();
+			MV->translate(camera_lights[i]);
+			MV->scale(light_radii[i]/SPHERE_INNER_RADIUS);
+			glUniformMatrix4fv(volume_prog->getUniform(U.MV), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+			glUniform3fv(volume_prog->getUniform(U.light_position), 1, glm::value_ptr(camera_lights[i]));
+			glUniform3fv(volume_prog->getUniform(U.light_color), 1, glm::value_ptr(light_colors[i]));
+
+			// Surfaces in front of the back faces but behind the front faces
+			// end up with a non-zero stencil
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glEnable(GL_DEPTH_TEST);
+			glDisable(GL_CULL_FACE);
+			glStencilFunc(GL_ALWAYS, 0, 0);
+			glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+			glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+			sphere->draw();
+
+			// Shade them with the back faces, which are not clipped when the
+			// camera is inside the sphere, and reset the stencil
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDisable(GL_DEPTH_TEST);
+			glEnable(GL_CULL_FACE);
+			glEnable(GL_BLEND);
+			glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+			glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+			sphere->draw();
+			glDisable(GL_BLEND);
+		MV->popMatrix();
+	}
+	glCullFace(GL_BACK);
+	glDisable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_STENCIL_TEST);
+	volume_prog->unbind();
+	GLSL::checkError(GET_FILE_LINE);
+}
+
 // This function is called every frame to draw the scene.
 static void render()
 {
 
-	double t = glfwGetTime();
+	// OFFLINE frames are at fixed steps of a simulated clock, so that they
+	// don't depend on how fast they render
+	double t;
+	if(OFFLINE) {
+		t = max(FIXED_TIME, 0.0) + frameIndex*FRAME_DT;
+	} else {
+		t = FIXED_TIME >= 0.0 ? FIXED_TIME : glfwGetTime();
+	}
 
-	auto P = make_shared<MatrixStack>();
-	auto MV = make_shared<MatrixStack>();
+	// The stacks are kept from frame to frame
+	static auto P = make_shared<MatrixStack>();
+	static auto MV = make_shared<MatrixStack>();
+	P->clear();
+	MV->clear();
 
 	int width, height;
-	glfwGetFramebufferSize(window, &width, &height);
+	getFramebufferSize(&width, &height);
 	camera->setAspect((float)width/(float)height);
 
 
 
-	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
-	glViewport(0, 0, width, height);
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glEnable(GL_DEPTH_TEST);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	
-	// Matrix stacks
-	
 	// Apply camera transforms
 	P->pushMatrix();
 	camera->applyProjectionMatrix(P);
+	glm::mat4 projection = P->topMatrix();
 	MV->pushMatrix();
 	camera->applyViewMatrix(MV);
+	glm::mat4 view = MV->topMatrix();
+	// The camera only turns and moves
+	Transform viewTransform(view, Transform::ROTATION | Transform::TRANSLATION);
+
+	// The CPU work on the objects comes first, on the thread pool, and leaves
+	// their matrices in flat arrays that the GL calls below only read
+	bool indirect = scene && GPU_DRIVEN != keyToggles[(unsigned)'g'];
+	bool instanced = INSTANCED && !keyToggles[(unsigned)'i'];
+	if(indirect && sceneVersion != objects->getVersion()) {
+		buildIndirectScene();
+	} else if(!indirect) {
+		// The GPU-driven path culls and animates on its own
+		profiler->begin("culling");
+		if(keyToggles[(unsigned)'f']) {
+			visibleObjects.resize(objects->size());
+			for(unsigned int i = 0; i < visibleObjects.size(); i++) {
+				visibleObjects[i] = i;
+			}
+		} else {
+			updateBvh();
+			bvh->cull(projection*view, visibleObjects);
+		}
+		profiler->count("visible-objects", (double)visibleObjects.size());
+		profiler->count("culled-objects", (double)(objects->size() - visibleObjects.size()));
+		profiler->end();
+		profiler->begin("transforms");
+		objects->update(t, view, visibleObjects);
+		profiler->end();
+	}
+
+	profiler->begin("gbuffer");
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+	glViewport(0, 0, width, height);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glEnable(GL_DEPTH_TEST);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
 	// Handle the lights
-	glm::vec3 camera_lights[10];
+	vector<glm::vec3> camera_lights(light_positions.size());
 	glm::mat4 light_matrix = MV->topMatrix();
 	for(unsigned int i = 0; i < light_positions.size(); i++) {
 		glm::vec4 l_pos_cord(light_positions[i], 1.0);
 		camera_lights[i] = light_matrix * l_pos_cord;
 	}
 
-
+	// The values every program shares, uploaded once. The light volume pass
+	// adds the lights itself.
+	int nPassLights = LIGHTING == LIGHTING_VOLUMES ? 0 : min((int)light_positions.size(), MAX_LIGHTS);
+	UniformBlocks::Frame frame = UniformBlocks::Frame();
+	frame.projection = projection;
+	frame.view = view;
+	for(int i = 0; i < nPassLights; i++) {
+		frame.light_positions[i] = glm::vec4(camera_lights[i], 1.0f);
+		frame.light_colors[i] = glm::vec4(light_colors[i], 1.0f);
+	}
+	frame.ks = ground->specular;
+	frame.s = ground->shiny;
+	frame.window_size = glm::vec2(texWidth, texHeight);
+	frame.time = (float)t;
+	frame.num_lights = nPassLights;
+	blocks->setFrame(frame);
+
+	// The values of each draw, in the order of the draws: the ground, then
+	// the lights and the objects unless they are instanced or GPU-driven
+	glm::vec3 zero_vec(0.0);
+	Transform floor = viewTransform*Transform::translation(ground->translate)*Transform::scale(ground->scale)*Transform::rotation(3*(M_PI/2), glm::vec3(1.0f, 0.0f, 0.0f));
+	blocks->addObject(floor.getMatrix(), floor.normalMatrix(), ground->ambient, ground->diffuse);
+	if(!instanced && !indirect) {
+		for(unsigned int i = 0; i < light_positions.size(); i++) {
+			Transform marker = lightMarker(viewTransform, i);
+			blocks->addObject(marker.getMatrix(), marker.normalMatrix(), light_colors[i], zero_vec);
+		}
+		const vector<glm::mat4> &modelViews = objects->getModelViews();
+		const vector<glm::mat4> &normalMatrices = objects->getNormalMatrices();
+		for(size_t j = 0; j < visibleObjects.size(); j++) {
+			int i = visibleObjects[j];
+			blocks->addObject(modelViews[j], normalMatrices[j], objects->getAmbients()[i], objects->getDiffuses()[i]);
+		}
+	}
+	blocks->uploadObjects();
 	
 	// Make the ground
-	MV->pushMatrix();
-		MV->translate(wobjs[wobjs.size()-1].translate);
-		MV->scale(wobjs[wobjs.size()-1].scale);
-		MV->rotate(3*(M_PI/2), 1.0, 0.0, 0.0);
+	prog->bind();
+	blocks->bindObject(0);
+	ground->shape->draw();
+	prog->unbind();
+	profiler->end();
+
+	if(indirect) {
+		drawObjectsIndirect(projection, frame.view, t);
+	} else if(instanced) {
+		drawObjectsInstanced(viewTransform);
+	} else {
+		// Make the lights
+		profiler->begin("markers");
+		int block = 1;
 		prog->bind();
-		glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniformMatrix4fv(prog->getUniform("IT"), 1, GL_FALSE, glm::value_ptr(glm::inverse(glm::transpose(MV->topMatrix()))));
-		glUniform3fv(prog->getUniform("light_positions"), 10, glm::value_ptr(camera_lights[0]));
-		glUniform3fv(prog->getUniform("light_colors"), 10, glm::value_ptr(light_colors.data()[0]));
-		glUniform3fv(prog->getUniform("ka"), 1, glm::value_ptr(wobjs[wobjs.size()-1].ambient));
-		glUniform3fv(prog->getUniform("kd"), 1, glm::value_ptr(wobjs[wobjs.size()-1].diffuse));
-		glUniform3fv(prog->getUniform("ks"), 1, glm::value_ptr(wobjs[wobjs.size()-1].specular));
-		glUniform1f(prog->getUniform("s"), wobjs[wobjs.size()-1].shiny);
-		wobjs[wobjs.size()-1].shape->draw(prog);
+		for(unsigned int i = 0; i < light_positions.size(); i++) {
+			blocks->bindObject(block++);
+			sphere->draw();
+		}
 		prog->unbind();
-	MV->popMatrix();
-
-	// Make the lights
-	for(unsigned int i = 0; i < light_positions.size(); i++) {
-		MV->pushMatrix();
-			MV->translate(light_positions[i]);
-			MV->scale(0.1, 0.1, 0.1);
-			prog->bind();
-			glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-			glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-			glUniformMatrix4fv(prog->getUniform("IT"), 1, GL_FALSE, glm::value_ptr(glm::inverse(glm::transpose(MV->topMatrix()))));
-			glUniform3fv(prog->getUniform("light_positions"), 10, glm::value_ptr(camera_lights[0]));
-			glUniform3fv(prog->getUniform("light_colors"), 10, glm::value_ptr(light_colors.data()[0]));
-			glUniform3fv(prog->getUniform("ka"), 1, glm::value_ptr(light_colors[i]));
-			glm::vec3 zero_vec(0.0);
-			glUniform3fv(prog->getUniform("kd"), 1, glm::value_ptr(zero_vec));
-			glUniform3fv(prog->getUniform("ks"), 1, glm::value_ptr(zero_vec));
-			glUniform1f(prog->getUniform("s"), 1);
-			sphere->draw(prog);
-			prog->unbind();
-		MV->popMatrix();
-	}
+		profiler->end();
 	
-	// Apply all transformations
-	for(unsigned int i = 0; i < wobjs.size()-1; i++) {	
-		MV->pushMatrix();
-			MV->translate(wobjs[i].translate);
-			if(wobjs[i].shape_type == 0) {
-				MV->translate(0.0, (0.0-wobjs[i].shape->lowest_y)*wobjs[i].scale.y, 0.0);
-				if(wobjs[i].shape == shape) {
-					MV->rotate(t, 0.0, 1.0, 0.0);
-				} else if(wobjs[i].shape == teapot) {
-					glm::mat4 S(1.0f);
-					S[1][2] = 0.5f*cos(t);
-					MV->multMatrix(S);
-				}
-			} else if(wobjs[i].shape_type == 1) {
-				MV->translate(0.0, (0.0-wobjs[i].c_sphere->lowest_y)*wobjs[i].scale.y, 0.0);
-				MV->translate(0.0, 0.4*(0.5 * sin((2.0*M_PI)/(1.7)*(t+0.9)) + 0.5), 0.0);
-				double scale_val = -0.5*(0.5*cos((4.0*M_PI)/(1.7)*(t+0.9))+0.5)+1.0;
-				MV->scale(scale_val, 1.0, scale_val);
-			} else if(wobjs[i].shape_type == 2) {
-				MV->rotate(0.5 * M_PI, 0.0, 0.0, 1.0);
-			}
-			MV->scale(wobjs[i].scale);
-			prog->bind();
-			glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-			glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-			glUniformMatrix4fv(prog->getUniform("IT"), 1, GL_FALSE, glm::value_ptr(glm::inverse(glm::transpose(MV->topMatrix()))));
-			glUniform3fv(prog->getUniform("light_positions"), 10, glm::value_ptr(camera_lights[0]));
-			glUniform3fv(prog->getUniform("light_colors"), 10, glm::value_ptr(light_colors.data()[0]));
-			glUniform3fv(prog->getUniform("ka"), 1, glm::value_ptr(wobjs[i].ambient));
-			glUniform3fv(prog->getUniform("kd"), 1, glm::value_ptr(wobjs[i].diffuse));
-			glUniform3fv(prog->getUniform("ks"), 1, glm::value_ptr(wobjs[i].specular));
-			glUniform1f(prog->getUniform("s"), wobjs[i].shiny);
-			if(wobjs[i].shape_type == 0) {
-				wobjs[i].shape->draw(prog);
-			} else if(wobjs[i].shape_type == 1) {
-				cust_sphere->draw(prog);
-			}
-			prog->unbind();
-			if(wobjs[i].shape_type == 2) {
-				sp_prog->bind();
-				glUniformMatrix4fv(sp_prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-				glUniformMatrix4fv(sp_prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-				glUniformMatrix4fv(sp_prog->getUniform("IT"), 1, GL_FALSE, glm::value_ptr(glm::inverse(glm::transpose(MV->topMatrix()))));
-				glUniform1f(sp_prog->getUniform("time"), t);
-				glUniform3fv(sp_prog->getUniform("light_positions"), 10, glm::value_ptr(camera_lights[0]));
-				glUniform3fv(sp_prog->getUniform("light_colors"), 10, glm::value_ptr(light_colors.data()[0]));
-				glUniform3fv(sp_prog->getUniform("ka"), 1, glm::value_ptr(wobjs[i].ambient));
-				glUniform3fv(sp_prog->getUniform("kd"), 1, glm::value_ptr(wobjs[i].diffuse));
-				glUniform3fv(sp_prog->getUniform("ks"), 1, glm::value_ptr(wobjs[i].specular));
-				glUniform1f(sp_prog->getUniform("s"), wobjs[i].shiny);
-				spiral->draw(sp_prog);
-				sp_prog->unbind();
+		// Apply all transformations
+		profiler->begin("objects");
+		// The spiral's vertices are deformed by its own program
+		shared_ptr<Program> bound;
+		for(int i : visibleObjects) {
+			const GeometryArena::Mesh &mesh = sceneMeshes[objects->getMeshes()[i]];
+			shared_ptr<Program> p = mesh.format == GeometryArena::POSITION ? sp_prog : prog;
+			if(p != bound) {
+				p->bind();
+				bound = p;
 			}
-		MV->popMatrix();
+			blocks->bindObject(block++);
+			arena->draw(mesh);
+		}
+		if(bound) {
+			bound->unbind();
+		}
+		profiler->end();
 	}
 
 	MV->popMatrix();
 	P->popMatrix();
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebufferID);
 	glViewport(0, 0, width, height);
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 	glEnable(GL_DEPTH_TEST);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	shared_ptr<Program> pass = prog_pass;
+	if(LIGHTING == LIGHTING_TILED) {
+		// Bin the lights into screen tiles, on the GPU unless 'c' is pressed
+		Profiler::Scope scope(profiler, "light-binning");
+		tiled->setLights(camera_lights, light_colors, light_radii);
+		if(tiled->hasCompute() && !keyToggles[(unsigned)'c']) {
+			tiled->cullGPU(projection, width, height, pos_tex);
+		} else {
+			tiled->cullCPU(projection, width, height);
+		}
+		int overflow = tiled->getOverflowTiles();
+		profiler->count("tile-overflow", overflow);
+		static bool warned = false;
+		if(overflow > 0 && !warned) {
+			cout << "Warning: " << overflow << " tiles have more than " << tiled->getMaxLightsPerTile() << " lights, the others are dropped (see --max-lights-per-tile)" << endl;
+			warned = true;
+		}
+		pass = tiled_prog;
+	} else if(LIGHTING == LIGHTING_CLUSTERED) {
+		// Bin the lights into screen tiles and depth slices
+		Profiler::Scope scope(profiler, "light-binning");
+		clusters->build(camera_lights, light_radii, projection, width, height);
+		clusters->upload(light_colors);
+		pass = clustered_prog;
+	} else if(LIGHTING == LIGHTING_VOLUMES) {
+		// Accumulate into the light buffer, whose depth-stencil is the
+		// G-buffer's, or in the packed layout a copy of its depth texture.
+		// The full-screen pass only adds the emissive colors.
+		if(PACKED_GBUFFER) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, framebufferID);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, lightFramebufferID);
+			glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, lightFramebufferID);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClearStencil(0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		glDisable(GL_DEPTH_TEST);
+	}
+
+	profiler->begin("lighting");
 	MV->pushMatrix();
-		prog_pass->bind();
+		pass->bind();
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, pos_tex);
 		glActiveTexture(GL_TEXTURE1);
@@ -592,59 +1239,397 @@ static void render()
 		glBindTexture(GL_TEXTURE_2D, kd_tex);
 		glm::vec2 wind_size(texWidth, texHeight);
 		MV->scale(2.0, 2.0, 2.0);
-		glUniformMatrix4fv(prog_pass->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog_pass->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniform3fv(prog_pass->getUniform("light_positions"), 10, glm::value_ptr(camera_lights[0]));
-		glUniform3fv(prog_pass->getUniform("light_colors"), 10, glm::value_ptr(light_colors.data()[0]));
-		glUniform2fv(prog_pass->getUniform("window_size"), 1, glm::value_ptr(wind_size));
-		glUniform3fv(prog_pass->getUniform("ks"), 1, glm::value_ptr(wobjs[0].specular));
-		glUniform1f(prog_pass->getUniform("s"), wobjs[0].shiny);
-		w_floor->draw(prog_pass);
+		glUniformMatrix4fv(pass->getUniform(U.P), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(pass->getUniform(U.MV), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		if(LIGHTING == LIGHTING_TILED) {
+			tiled->bind(pass, 4);
+		} else if(LIGHTING == LIGHTING_CLUSTERED) {
+			clusters->bind(pass, 4);
+		}
+		glUniform2fv(pass->getUniform(U.window_size), 1, glm::value_ptr(wind_size));
+		glUniformMatrix4fv(pass->getUniform(U.inv_proj), 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+		glUniform3fv(pass->getUniform(U.ks), 1, glm::value_ptr(ground->specular));
+		glUniform1f(pass->getUniform(U.s), ground->shiny);
+		w_floor->draw();
+		if(LIGHTING == LIGHTING_TILED) {
+			tiled->unbind(4);
+		} else if(LIGHTING == LIGHTING_CLUSTERED) {
+			clusters->unbind(4);
+		}
 		glActiveTexture(GL_TEXTURE0);
-		prog_pass->unbind();
+		pass->unbind();
 	MV->popMatrix();
-
+	profiler->end();
+
+	if(LIGHTING == LIGHTING_VOLUMES) {
+		drawLightVolumes(projection, camera_lights);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, lightFramebufferID);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFramebufferID);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFramebufferID);
+		glEnable(GL_DEPTH_TEST);
+	}
 
 
 	GLSL::checkError(GET_FILE_LINE);
 	
-	if(OFFLINE) {
-		saveImage("output.png", window);
+	if(OFFLINE && frameIndex % SAVE_EVERY == 0) {
+		Profiler::Scope scope(profiler, "save-image");
+		vector<char> filename(OUTPUT.size() + 32);
+		snprintf(filename.data(), filename.size(), OUTPUT.c_str(), frameIndex);
+		saveImage(filename.data());
 		GLSL::checkError(GET_FILE_LINE);
-		glfwSetWindowShouldClose(window, true);
 	}
+	frameIndex++;
+}
+
+// Draws the scene like render(), but on the CPU with the SoftwareRenderer,
+// and writes the frame
+static void renderSoftware()
+{
+	double t = max(FIXED_TIME, 0.0) + frameIndex*FRAME_DT;
+
+	static auto P = make_shared<MatrixStack>();
+	static auto MV = make_shared<MatrixStack>();
+	P->clear();
+	MV->clear();
+	camera->setAspect((float)texWidth/(float)texHeight);
+	P->pushMatrix();
+	camera->applyProjectionMatrix(P);
+	MV->pushMatrix();
+	camera->applyViewMatrix(MV);
+
+	vector<glm::vec3> camera_lights(light_positions.size());
+	glm::mat4 light_matrix = MV->topMatrix();
+	for(unsigned int i = 0; i < light_positions.size(); i++) {
+		camera_lights[i] = light_matrix * glm::vec4(light_positions[i], 1.0);
+	}
+
+	profiler->begin("rasterize");
+	software->begin(texWidth, texHeight);
+	MV->pushMatrix();
+		MV->translate(ground->translate);
+		MV->scale(ground->scale);
+		MV->rotate(3*(M_PI/2), 1.0, 0.0, 0.0);
+		software->draw(softwareMeshes[MESH_FLOOR], P->topMatrix(), MV->topMatrix(), ground->ambient, ground->diffuse);
+	MV->popMatrix();
+	glm::vec3 zero_vec(0.0);
+	for(unsigned int i = 0; i < light_positions.size(); i++) {
+		MV->pushMatrix();
+			MV->translate(light_positions[i]);
+			MV->scale(0.1, 0.1, 0.1);
+			software->draw(softwareMeshes[MESH_MARKER], P->topMatrix(), MV->topMatrix(), light_colors[i], zero_vec);
+		MV->popMatrix();
+	}
+	objects->update(t, MV->topMatrix());
+	const vector<glm::mat4> &modelViews = objects->getModelViews();
+	for(int i = 0; i < objects->size(); i++) {
+		software->draw(softwareMeshes[objects->getMeshes()[i]], P->topMatrix(), modelViews[i], objects->getAmbients()[i], objects->getDiffuses()[i], t);
+	}
+	software->rasterize();
+	profiler->end();
+
+	// The full-screen pass only has room for the first lights, and the others
+	// cut the lights off at their radii
+	profiler->begin("shade");
+	if(LIGHTING == LIGHTING_FULLSCREEN) {
+		int nPassLights = min((int)camera_lights.size(), MAX_LIGHTS);
+		vector<glm::vec3> positions(camera_lights.begin(), camera_lights.begin() + nPassLights);
+		vector<glm::vec3> colors(light_colors.begin(), light_colors.begin() + nPassLights);
+		software->shade(positions, colors, vector<float>(), ground->specular, ground->shiny);
+	} else {
+		software->shade(camera_lights, light_colors, light_radii, ground->specular, ground->shiny);
+	}
+	profiler->end();
+
+	MV->popMatrix();
+	P->popMatrix();
+
+	if(frameIndex % SAVE_EVERY == 0) {
+		Profiler::Scope scope(profiler, "save-image");
+		vector<char> filename(OUTPUT.size() + 32);
+		snprintf(filename.data(), filename.size(), OUTPUT.c_str(), frameIndex);
+		vector<unsigned char> rgba;
+		software->getImage(rgba);
+		frameWriter->write(filename.data(), texWidth, texHeight, rgba);
+	}
+	frameIndex++;
+}
+
+// Renders the OFFLINE frames with renderSoftware(), without an OpenGL context
+static int runSoftware()
+{
+	texWidth = WIDTH > 0 ? WIDTH : texWidth;
+	texHeight = HEIGHT > 0 ? HEIGHT : texHeight;
+	cout << "Rendering on the CPU at " << texWidth << "x" << texHeight << " with " << pool->size() + 1 << " threads, ";
+	cout << SIMD_WIDTH << " pixels at a time" << endl;
+	loadScene();
+	software = make_shared<SoftwareRenderer>();
+	software->setThreadPool(pool);
+	softwareMeshes[MESH_BUNNY] = software->addMesh(shape->getVertexCount(), shape->getPositions(), shape->getNormals(), shape->getIndices());
+	softwareMeshes[MESH_TEAPOT] = software->addMesh(teapot->getVertexCount(), teapot->getPositions(), teapot->getNormals(), teapot->getIndices());
+	softwareMeshes[MESH_FLOOR] = software->addMesh(w_floor->getVertexCount(), w_floor->getPositions(), w_floor->getNormals(), w_floor->getIndices());
+	softwareMeshes[MESH_MARKER] = software->addMesh(sphere->getVertexCount(), sphere->getPositions(), sphere->getNormals(), sphere->getIndices());
+	softwareMeshes[MESH_SPHERE] = software->addMesh(cust_sphere->getVertexCount(), cust_sphere->getPositions(), cust_sphere->getNormals(), cust_sphere->getIndices());
+	softwareMeshes[MESH_SPIRAL] = software->addMesh(spiral->getVertexCount(), spiral->getPositions(), spiral->getNormals(), spiral->getIndices(), true);
+	if(PROFILE) {
+		profiler->init();
+	}
+	frameWriter = make_shared<FrameWriter>();
+	frameWriter->init(0, false);
+
+	auto start = chrono::steady_clock::now();
+	while(frameIndex < FRAMES) {
+		profiler->beginFrame();
+		renderSoftware();
+		profiler->endFrame();
+	}
+	double rendered = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	bool written = frameWriter->finish();
+	double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Rendered " << frameIndex << " frames of " << software->getTriangleCount() << " triangles in " << rendered << " s (" << frameIndex/rendered << " frames/s), ";
+	cout << "written in " << total << " s (" << frameIndex/total << " frames/s)" << endl;
+	bool profiled = profiler->report(PROFILE_CSV);
+	return written && profiled ? 0 : 1;
+}
+
+// The number of frame number conversions (%d or %0Nd, with N < 10) in an
+// OUTPUT pattern, or -1 if it has any other conversion than %%
+static int outputConversions(const string &pattern)
+{
+	int conversions = 0;
+	for(size_t i = 0; i < pattern.size(); i++) {
+		if(pattern[i] != '%') {
+			continue;
+		}
+		size_t j = i + 1;
+		if(j < pattern.size() && pattern[j] == '%') {
+			i = j;
+			continue;
+		}
+		if(j < pattern.size() && pattern[j] == '0') {
+			j++;
+			if(j < pattern.size() && isdigit((unsigned char)pattern[j])) {
+				j++;
+			}
+		}
+		if(j >= pattern.size() || pattern[j] != 'd') {
+			return -1;
+		}
+		conversions++;
+		i = j;
+	}
+	return conversions;
+}
+
+// Parses an optional argument of the form --name=value
+static bool parseOption(const string &arg)
+{
+	size_t eq = arg.find('=');
+	string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+	string value = eq == string::npos ? "" : arg.substr(eq + 1);
+	if(name == "lights") {
+		NUM_LIGHTS = max(1, atoi(value.c_str()));
+	} else if(name == "objects") {
+		NUM_OBJECTS = max(1, atoi(value.c_str()));
+	} else if(name == "light-cutoff") {
+		LIGHT_CUTOFF = (float)atof(value.c_str());
+	} else if(name == "lighting") {
+		LIGHTING = -1;
+		for(int i = 0; i < LIGHTING_MODES; i++) {
+			if(value == LIGHTING_NAMES[i]) {
+				LIGHTING = i;
+			}
+		}
+		return LIGHTING != -1;
+	} else if(name == "tile-size") {
+		TILE_SIZE = max(1, atoi(value.c_str()));
+	} else if(name == "max-lights-per-tile") {
+		MAX_LIGHTS_PER_TILE = max(1, atoi(value.c_str()));
+	} else if(name == "cluster-slices") {
+		CLUSTER_SLICES = max(1, atoi(value.c_str()));
+	} else if(name == "cluster-far") {
+		CLUSTER_FAR = (float)atof(value.c_str());
+	} else if(name == "gbuffer") {
+		PACKED_GBUFFER = value == "packed";
+		return value == "packed" || value == "full";
+	} else if(name == "time") {
+		FIXED_TIME = atof(value.c_str());
+	} else if(name == "frames") {
+		FRAMES = max(1, atoi(value.c_str()));
+		OFFLINE = true;
+	} else if(name == "dt") {
+		FRAME_DT = atof(value.c_str());
+	} else if(name == "output") {
+		// The pattern is passed to snprintf() with just the frame number
+		OUTPUT = value;
+		return outputConversions(value) == 0 || outputConversions(value) == 1;
+	} else if(name == "save-every") {
+		SAVE_EVERY = max(1, atoi(value.c_str()));
+	} else if(name == "seed") {
+		SEED = max(0, atoi(value.c_str()));
+	} else if(name == "headless") {
+		HEADLESS = true;
+		OFFLINE = true;
+	} else if(name == "width") {
+		WIDTH = max(1, atoi(value.c_str()));
+	} else if(name == "height") {
+		HEIGHT = max(1, atoi(value.c_str()));
+	} else if(name == "check") {
+		CHECK = value;
+	} else if(name == "bench") {
+		BENCH = value;
+	} else if(name == "image") {
+		IMAGE = value;
+	} else if(name == "reference") {
+		REFERENCE = value;
+	} else if(name == "tolerance") {
+		IMAGE_TOLERANCE = atoi(value.c_str());
+	} else if(name == "outliers") {
+		IMAGE_OUTLIERS = (float)atof(value.c_str());
+	} else if(name == "threshold") {
+		PERCEPTUAL_THRESHOLD = (float)atof(value.c_str());
+	} else if(name == "golden") {
+		GOLDEN_DIR = value + "/";
+	} else if(name == "update-golden") {
+		UPDATE_GOLDEN = true;
+	} else if(name == "json") {
+		BENCH_JSON = value;
+	} else if(name == "profile") {
+		PROFILE = true;
+		PROFILE_CSV = value;
+	} else if(name == "profile-window") {
+		PROFILE_WINDOW = max(1, atoi(value.c_str()));
+	} else if(name == "readback-frames") {
+		READBACK_FRAMES = max(1, atoi(value.c_str()));
+	} else if(name == "renderer") {
+		SOFTWARE = value == "cpu";
+		OFFLINE = OFFLINE || SOFTWARE;
+		return value == "cpu" || value == "gl";
+	} else if(name == "threads") {
+		THREADS = max(0, atoi(value.c_str()));
+	} else if(name == "gpu-driven") {
+		GPU_DRIVEN = true;
+	} else {
+		return false;
+	}
+	return true;
 }
 
 int main(int argc, char **argv)
 {
 	if(argc < 2) {
-		cout << "Usage: A5 RESOURCE_DIR" << endl;
-		return 0;
+		cout << "Usage: A5 RESOURCE_DIR [OFFLINE] [--option=value ...]" << endl;
+		return 1;
 	}
+	EXECUTABLE = argv[0];
 	RESOURCE_DIR = argv[1] + string("/");
 	
-	// Optional argument
-	if(argc >= 3) {
-		OFFLINE = atoi(argv[2]) != 0;
+	// Optional arguments
+	for(int i = 2; i < argc; i++) {
+		if(string(argv[i]).compare(0, 2, "--") != 0) {
+			OFFLINE = atoi(argv[i]) != 0;
+		} else if(!parseOption(argv[i])) {
+			cout << "Unknown or invalid option " << argv[i] << endl;
+			return 1;
+		}
 	}
 
-	// Set error callback.
-	glfwSetErrorCallback(error_callback);
-	// Initialize the library.
-	if(!glfwInit()) {
-		return -1;
+	if(GOLDEN_DIR.empty()) {
+		GOLDEN_DIR = RESOURCE_DIR + "golden/";
 	}
-	// Create a windowed mode window and its OpenGL context.
-	window = glfwCreateWindow(640, 480, "YOUR NAME", NULL, NULL);
-	if(!window) {
-		glfwTerminate();
-		return -1;
+	if(OUTPUT.empty()) {
+		OUTPUT = FRAMES > 1 ? "frame%04d.png" : "output.png";
+	} else if(outputConversions(OUTPUT) == 0 && FRAMES > SAVE_EVERY) {
+		cout << "--output=" << OUTPUT << " has no frame number for the " << (FRAMES + SAVE_EVERY - 1)/SAVE_EVERY << " frames saved" << endl;
+		return 1;
+	}
+	if(OFFLINE && SEED < 0) {
+		// Every OFFLINE run renders the same scene
+		SEED = 0;
+	}
+
+	pool = make_shared<ThreadPool>(THREADS);
+	profiler = make_shared<Profiler>();
+	profiler->setWindow(PROFILE_WINDOW);
+	if(CHECK == "clusters") {
+		return Checks::clusters(pool, texWidth, texHeight, CLUSTER_SLICES, CLUSTER_FAR) ? 0 : 1;
+	} else if(CHECK == "vertex-cache") {
+		return Checks::vertexCache(RESOURCE_DIR) ? 0 : 1;
+	} else if(CHECK == "matrix-stack") {
+		return Checks::matrixStack() ? 0 : 1;
+	} else if(CHECK == "normal-matrix") {
+		return Checks::normalMatrix() ? 0 : 1;
+	} else if(CHECK == "image-diff") {
+		return Checks::imageDiff(IMAGE, REFERENCE, IMAGE_TOLERANCE, IMAGE_OUTLIERS, PERCEPTUAL_THRESHOLD) ? 0 : 1;
+	} else if(!CHECK.empty()) {
+		cout << "Unknown check " << CHECK << endl;
+		return 1;
+	}
+	if(BENCH == "obj") {
+		return Benchmarks::obj(RESOURCE_DIR, pool) ? 0 : 1;
+	} else if(BENCH == "scenes") {
+		Benchmarks::Scenes settings;
+		settings.executable = EXECUTABLE;
+		settings.resourceDir = RESOURCE_DIR;
+		settings.goldenDir = GOLDEN_DIR;
+		settings.updateGolden = UPDATE_GOLDEN;
+		settings.json = BENCH_JSON;
+		settings.frames = FRAMES;
+		settings.time = FIXED_TIME;
+		settings.software = SOFTWARE;
+		settings.gpuDriven = GPU_DRIVEN;
+		settings.tolerance = IMAGE_TOLERANCE;
+		settings.outliers = IMAGE_OUTLIERS;
+		settings.threshold = PERCEPTUAL_THRESHOLD;
+		return Benchmarks::scenes(settings) ? 0 : 1;
+	} else if(BENCH == "scene-store") {
+		return Benchmarks::sceneStore() ? 0 : 1;
+	} else if(BENCH == "transforms") {
+		return Benchmarks::transforms(THREADS) ? 0 : 1;
+	} else if(BENCH == "matrix-stack") {
+		return Benchmarks::matrixStack(FRAME_DT) ? 0 : 1;
+	} else if(!BENCH.empty() && BENCH != "uniforms") {
+		cout << "Unknown benchmark " << BENCH << endl;
+		return 1;
+	}
+	if(SOFTWARE) {
+		return runSoftware();
+	}
+
+	HeadlessContext headless;
+	if(HEADLESS) {
+		// Create an OpenGL context without a window.
+		if(!headless.init()) {
+			return -1;
+		}
+	} else {
+		// Set error callback.
+		glfwSetErrorCallback(error_callback);
+		// Initialize the library.
+		if(!glfwInit()) {
+			return -1;
+		}
+		// Create a windowed mode window and its OpenGL context.
+		window = glfwCreateWindow(640, 480, "YOUR NAME", NULL, NULL);
+		if(!window) {
+			glfwTerminate();
+			return -1;
+		}
+		// Make the window's context current.
+		glfwMakeContextCurrent(window);
 	}
-	// Make the window's context current.
-	glfwMakeContextCurrent(window);
 	// Initialize GLEW.
 	glewExperimental = true;
-	if(glewInit() != GLEW_OK) {
+	GLenum glewStatus = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLEW built for GLX has loaded the functions by the time it finds that
+	// there is no X display
+	if(HEADLESS && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY) {
+		glewStatus = GLEW_OK;
+	}
+#endif
+	if(glewStatus != GLEW_OK) {
 		cerr << "Failed to initialize GLEW" << endl;
 		return -1;
 	}
@@ -652,31 +1637,87 @@ int main(int argc, char **argv)
 	cout << "OpenGL version: " << glGetString(GL_VERSION) << endl;
 	cout << "GLSL version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 	GLSL::checkVersion();
-	// Set vsync.
-	glfwSwapInterval(1);
-	// Set keyboard callback.
-	glfwSetKeyCallback(window, key_callback);
-	// Set char callback.
-	glfwSetCharCallback(window, char_callback);
-	// Set cursor position callback.
-	glfwSetCursorPosCallback(window, cursor_position_callback);
-	// Set mouse button callback.
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
-	// Set the window resize call back.
-	glfwSetFramebufferSizeCallback(window, resize_callback);
+	// The shaders read their per-frame and per-draw values from uniform blocks
+	if(!GLEW_VERSION_3_1 && !GLEW_ARB_uniform_buffer_object) {
+		cerr << "Uniform buffer objects not supported" << endl;
+		return -1;
+	}
+	// OFFLINE frames of a given size, and all headless ones, are drawn offscreen.
+	bool offscreen = OFFLINE && (HEADLESS || WIDTH > 0 || HEIGHT > 0);
+	if(offscreen) {
+		texWidth = WIDTH > 0 ? WIDTH : texWidth;
+		texHeight = HEIGHT > 0 ? HEIGHT : texHeight;
+		cout << "Rendering offscreen at " << texWidth << "x" << texHeight << endl;
+	}
+	if(window) {
+		// Set vsync, except OFFLINE, which renders as fast as it can.
+		glfwSwapInterval(OFFLINE ? 0 : 1);
+		// Input would make OFFLINE frames depend on what happens to the window.
+		if(!OFFLINE) {
+			// Set keyboard callback.
+			glfwSetKeyCallback(window, key_callback);
+			// Set char callback.
+			glfwSetCharCallback(window, char_callback);
+			// Set cursor position callback.
+			glfwSetCursorPosCallback(window, cursor_position_callback);
+			// Set mouse button callback.
+			glfwSetMouseButtonCallback(window, mouse_button_callback);
+		}
+		// Set the window resize call back, unless the size is fixed.
+		if(!offscreen) {
+			glfwSetFramebufferSizeCallback(window, resize_callback);
+		}
+	}
 	// Initialize scene.
 	init();
-	// Loop until the user closes the window.
-	while(!glfwWindowShouldClose(window)) {
+	if(BENCH == "uniforms") {
+		bool ok = Benchmarks::uniforms(volume_prog, blocks, texWidth, texHeight);
+		if(window) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
+		headless.destroy();
+		return ok ? 0 : 1;
+	}
+	if(offscreen) {
+		allocOutput();
+	}
+	if(PROFILE) {
+		profiler->init();
+	}
+	frameWriter = make_shared<FrameWriter>();
+	frameWriter->setRingSize(READBACK_FRAMES);
+	if(OFFLINE) {
+		frameWriter->init();
+	}
+	auto start = chrono::steady_clock::now();
+	// Loop until the user closes the window, or all OFFLINE frames are done.
+	while(!(OFFLINE && frameIndex >= FRAMES) && !(window && glfwWindowShouldClose(window))) {
 		// Render scene.
+		profiler->beginFrame();
 		render();
-		// Swap front and back buffers.
-		glfwSwapBuffers(window);
-		// Poll for and process events.
-		glfwPollEvents();
+		profiler->endFrame();
+		if(window) {
+			// Swap front and back buffers.
+			glfwSwapBuffers(window);
+			// Poll for and process events.
+			glfwPollEvents();
+		}
+	}
+	// Finish the readbacks and report the profile while the context still exists.
+	double rendered = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	bool written = frameWriter->finish();
+	if(OFFLINE) {
+		double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Rendered " << frameIndex << " frames in " << rendered << " s (" << frameIndex/rendered << " frames/s), ";
+		cout << "written in " << total << " s (" << frameIndex/total << " frames/s)" << endl;
 	}
+	bool profiled = profiler->report(PROFILE_CSV);
 	// Quit program.
-	glfwDestroyWindow(window);
-	glfwTerminate();
-	return 0;
+	if(window) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+	headless.destroy();
+	return written && profiled ? 0 : 1;
 }